@@ -29,6 +29,38 @@ static const struct option long_options[] =
 		{"ns",          required_argument, 0, 0x10001},
 		{"nameserver",  required_argument, 0, 0x10001},
 
+		{"pin-relay",   no_argument,       0, 0x10002},
+		{"hash-alloc",  no_argument,       0, 0x10003},
+
+		{"listen",      required_argument, 0, 0x10004},
+		{"port",        required_argument, 0, 0x10005},
+		{"reply",       required_argument, 0, 0x10006},
+		{"reply-port",  required_argument, 0, 0x10007},
+		{"unicast",     no_argument,       0, 0x10008},
+
+		{"dedup",       required_argument, 0, 0x10009},
+		{"rapid-commit", no_argument,      0, 0x1000A},
+
+		{"leasetime-min", required_argument, 0, 0x1000B},
+		{"lease-jitter", required_argument, 0, 0x1000C},
+
+		{"engine",      required_argument, 0, 0x1000D},
+		{"xdp",         required_argument, 0, 0x1000E},
+		{"xdp-rate",    required_argument, 0, 0x1000F},
+
+		{"probe",       required_argument, 0, 0x10010},
+		{"probe-timeout", required_argument, 0, 0x10011},
+		{"ddns",        required_argument, 0, 0x10012},
+		{"ddns-port",   required_argument, 0, 0x10013},
+		{"ddns-zone",   required_argument, 0, 0x10014},
+		{"ddns-reverse-zone", required_argument, 0, 0x10015},
+		{"control",     required_argument, 0, 0x10016},
+		{"balance",     required_argument, 0, 0x10017},
+		{"replica",     required_argument, 0, 0x10018},
+		{"standby",     required_argument, 0, 0x10019},
+		{"replica-port", required_argument, 0, 0x1001A},
+		{"handoff",     required_argument, 0, 0x1001B},
+
 		{0, 0, 0, 0}
 	};
 
@@ -108,6 +140,110 @@ bool argv_parse(int argc, char **argv, struct argv *out)
 				out->nameservers[out->nameservers_cnt - 1] = optarg;
 				break;
 
+			case 0x10002:
+				out->pin_relay = true;
+				break;
+
+			case 0x10003:
+				out->hash_alloc = true;
+				break;
+
+			case 0x10004:
+				out->listen = optarg;
+				break;
+
+			case 0x10005:
+				out->port = optarg;
+				break;
+
+			case 0x10006:
+				out->reply = optarg;
+				break;
+
+			case 0x10007:
+				out->reply_port = optarg;
+				break;
+
+			case 0x10008:
+				out->unicast = true;
+				break;
+
+			case 0x10009:
+				out->dedup = optarg;
+				break;
+
+			case 0x1000A:
+				out->rapid_commit = true;
+				break;
+
+			case 0x1000B:
+				out->leasetime_min = optarg;
+				break;
+
+			case 0x1000C:
+				out->lease_jitter = optarg;
+				break;
+
+			case 0x1000D:
+				out->engine = optarg;
+				break;
+
+			case 0x1000E:
+				out->xdp = optarg;
+				break;
+
+			case 0x1000F:
+				out->xdp_rate = optarg;
+				break;
+
+			case 0x10010:
+				out->probe = optarg;
+				break;
+
+			case 0x10011:
+				out->probe_timeout = optarg;
+				break;
+
+			case 0x10012:
+				out->ddns = optarg;
+				break;
+
+			case 0x10013:
+				out->ddns_port = optarg;
+				break;
+
+			case 0x10014:
+				out->ddns_zone = optarg;
+				break;
+
+			case 0x10015:
+				out->ddns_reverse_zone = optarg;
+				break;
+
+			case 0x10016:
+				out->control = optarg;
+				break;
+
+			case 0x10017:
+				out->balance = optarg;
+				break;
+
+			case 0x10018:
+				out->replica = optarg;
+				break;
+
+			case 0x10019:
+				out->standby = optarg;
+				break;
+
+			case 0x1001A:
+				out->replica_port = optarg;
+				break;
+
+			case 0x1001B:
+				out->handoff = optarg;
+				break;
+
 			default:
 				out->argerror = -1;
 				return false;
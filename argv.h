@@ -40,6 +40,68 @@ struct argv
 
 	/* -leasetime INT */
 	char *leasetime;
+	/* -leasetime-min INT */
+	char *leasetime_min;
+	/* -lease-jitter INT */
+	char *lease_jitter;
+
+	/* -pin-relay */
+	bool pin_relay;
+	/* -hash-alloc */
+	bool hash_alloc;
+
+	/* -listen IP */
+	char *listen;
+	/* -port PORT */
+	char *port;
+	/* -reply IP */
+	char *reply;
+	/* -reply-port PORT */
+	char *reply_port;
+	/* -unicast */
+	bool unicast;
+
+	/* -dedup INT */
+	char *dedup;
+	/* -rapid-commit */
+	bool rapid_commit;
+
+	/* -engine ev|uring */
+	char *engine;
+	/* -xdp generic|native */
+	char *xdp;
+	/* -xdp-rate INT */
+	char *xdp_rate;
+
+	/* -probe INT */
+	char *probe;
+	/* -probe-timeout MS */
+	char *probe_timeout;
+
+	/* -ddns IP */
+	char *ddns;
+	/* -ddns-port PORT */
+	char *ddns_port;
+	/* -ddns-zone ZONE */
+	char *ddns_zone;
+	/* -ddns-reverse-zone ZONE */
+	char *ddns_reverse_zone;
+
+	/* -control PATH */
+	char *control;
+
+	/* -balance LIST */
+	char *balance;
+
+	/* -replica IP */
+	char *replica;
+	/* -standby IP */
+	char *standby;
+	/* -replica-port PORT */
+	char *replica_port;
+
+	/* -handoff PATH */
+	char *handoff;
 
 	/* -help */
 	bool help;
@@ -64,6 +126,32 @@ struct argv
 		.help = false,\
 		.version = false,\
 		.debug = false,\
+		.pin_relay = false,\
+		.hash_alloc = false,\
+		.listen = NULL,\
+		.port = NULL,\
+		.reply = NULL,\
+		.reply_port = NULL,\
+		.unicast = false,\
+		.dedup = NULL,\
+		.rapid_commit = false,\
+		.leasetime_min = NULL,\
+		.lease_jitter = NULL,\
+		.engine = NULL,\
+		.xdp = NULL,\
+		.xdp_rate = NULL,\
+		.probe = NULL,\
+		.probe_timeout = NULL,\
+		.ddns = NULL,\
+		.ddns_port = NULL,\
+		.ddns_zone = NULL,\
+		.ddns_reverse_zone = NULL,\
+		.control = NULL,\
+		.balance = NULL,\
+		.replica = NULL,\
+		.standby = NULL,\
+		.replica_port = NULL,\
+		.handoff = NULL,\
 	}
 
 /**
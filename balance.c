@@ -0,0 +1,112 @@
+#include "balance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* The permutation of RFC 3074 section 6 */
+const uint8_t balance_table[BALANCE_BUCKETS] = {
+	251, 175, 119, 215, 81, 14, 79, 191, 103, 49, 181, 143, 186, 157, 0, 232,
+	31, 32, 55, 60, 152, 58, 17, 237, 174, 70, 160, 144, 220, 90, 57, 223,
+	59, 3, 18, 140, 111, 166, 203, 196, 134, 243, 124, 95, 222, 179, 197, 65,
+	180, 48, 36, 15, 107, 46, 233, 130, 165, 30, 123, 161, 209, 23, 97, 16,
+	40, 91, 219, 61, 100, 10, 210, 109, 250, 127, 22, 138, 29, 108, 244, 67,
+	207, 9, 178, 204, 74, 98, 126, 249, 167, 116, 34, 77, 193, 200, 121, 5,
+	20, 113, 71, 35, 128, 13, 182, 94, 25, 226, 227, 199, 75, 27, 41, 245,
+	230, 224, 43, 225, 177, 26, 155, 150, 212, 142, 218, 115, 241, 73, 88, 105,
+	39, 114, 62, 255, 192, 201, 145, 214, 168, 158, 221, 148, 154, 122, 12, 84,
+	82, 163, 44, 139, 228, 236, 205, 242, 217, 11, 187, 146, 159, 64, 86, 239,
+	195, 42, 106, 198, 118, 112, 184, 172, 87, 2, 173, 117, 176, 229, 247, 253,
+	137, 185, 99, 164, 102, 147, 45, 66, 231, 52, 141, 211, 194, 206, 246, 238,
+	56, 110, 78, 248, 63, 240, 189, 93, 92, 51, 53, 183, 19, 171, 72, 50,
+	33, 104, 101, 69, 8, 252, 83, 120, 76, 135, 85, 54, 202, 125, 188, 213,
+	96, 235, 136, 208, 162, 129, 190, 132, 156, 38, 47, 1, 7, 254, 24, 4,
+	216, 131, 89, 21, 28, 133, 37, 153, 149, 80, 170, 68, 6, 169, 234, 151
+};
+
+static void balance_set(struct balance *b, unsigned first, unsigned last)
+{
+	for (unsigned i = first; i <= last; ++i)
+		b->map[i >> 3] |= 1 << (i & 7);
+}
+
+bool balance_parse(struct balance *b, const char *text)
+{
+	char *end;
+
+	memset(b, 0, sizeof(struct balance));
+
+	if (strchr(text, '/') != NULL) {
+		long index = strtol(text, &end, 10);
+
+		if (end == text || *end != '/')
+			return false;
+
+		const char *next = end + 1;
+		long count = strtol(next, &end, 10);
+
+		if (end == next || *end != 0 || count < 1 || count > BALANCE_BUCKETS ||
+				index < 0 || index >= count)
+			return false;
+
+		balance_set(b, index * BALANCE_BUCKETS / count,
+			(index + 1) * BALANCE_BUCKETS / count - 1);
+
+		return true;
+	}
+
+	for (;;)
+	{
+		long first = strtol(text, &end, 10);
+		long last = first;
+
+		if (end == text)
+			return false;
+
+		if (*end == '-') {
+			text = end + 1;
+			last = strtol(text, &end, 10);
+
+			if (end == text)
+				return false;
+		}
+
+		if (first < 0 || last < first || last >= BALANCE_BUCKETS)
+			return false;
+
+		balance_set(b, first, last);
+
+		if (*end == 0)
+			return true;
+
+		if (*end != ',')
+			return false;
+
+		text = end + 1;
+	}
+}
+
+void balance_format(const struct balance *b, char *out, size_t size)
+{
+	size_t len = 0;
+
+	out[0] = 0;
+
+	for (unsigned i = 0; i < BALANCE_BUCKETS && len < size; ++i)
+	{
+		if (!(b->map[i >> 3] & (1 << (i & 7))))
+			continue;
+
+		unsigned last = i;
+
+		while (last + 1 < BALANCE_BUCKETS && b->map[(last + 1) >> 3] & (1 << ((last + 1) & 7)))
+			++last;
+
+		if (last == i)
+			len += snprintf(out + len, size - len, "%s%u", len > 0 ? "," : "", i);
+		else
+			len += snprintf(out + len, size - len, "%s%u-%u", len > 0 ? "," : "", i, last);
+
+		i = last;
+	}
+}
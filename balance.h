@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <netinet/in.h>
+
+#include "dhcp.h"
+
+/* Load balancing between servers on one segment, see RFC 3074: every
+ * client falls into one of 256 buckets by a hash of its client identifier
+ * (61), or of its hardware address if it sends none, and every server
+ * answers only the clients in the buckets assigned to it. Since the servers
+ * agree on the hash, they split the clients between them without talking
+ * to each other.
+ *
+ * Only a DHCPDISCOVER and a DHCPREQUEST without a server identifier are
+ * balanced. A client which already has a lease, i.e. sets ciaddr, or which
+ * names us keeps talking to us.
+ *
+ * The check only reads the header and skims the options, so a request for
+ * another server is dropped before it is parsed.
+ */
+
+#define BALANCE_BUCKETS 256
+
+/* Buckets assigned to a server, one bit each */
+struct balance
+{
+	uint8_t map[BALANCE_BUCKETS / 8];
+};
+
+extern const uint8_t balance_table[BALANCE_BUCKETS];
+
+/**
+ * Pearson hash of RFC 3074 section 6
+ */
+static inline uint8_t balance_hash(const uint8_t *key, size_t len)
+{
+	uint8_t hash = len;
+
+	for (size_t i = len; i > 0;)
+		hash = balance_table[hash ^ key[--i]];
+
+	return hash;
+}
+
+/**
+ * Whether a request is for us
+ *
+ * @param[in] b Buckets assigned to us
+ * @param[in] buf Request
+ * @param[in] len Length of the request, too short or malformed ones are let
+ *                through for the server to reject
+ * @param[in] id Our server identifier
+ */
+static inline bool balance_accepts(const struct balance *b, const uint8_t *buf, size_t len,
+	struct in_addr id)
+{
+	if (len < DHCP_MSG_HDRLEN || !DHCP_MSG_MAGIC_CHECK(DHCP_MSG_F_MAGIC(buf)) ||
+			*DHCP_MSG_F_CIADDR(buf) != 0)
+		return true;
+
+	const uint8_t *key = (const uint8_t *)DHCP_MSG_F_CHADDR(buf);
+	size_t key_len = *DHCP_MSG_F_HLEN(buf) <= 16 ? *DHCP_MSG_F_HLEN(buf) : 16;
+	bool balanced = false;
+
+	for (size_t off = DHCP_MSG_HDRLEN; off < len && buf[off] != DHCP_OPT_END;)
+	{
+		if (buf[off] == DHCP_OPT_STUB) {
+			++off;
+			continue;
+		}
+
+		if (off + 2 > len || off + 2 + buf[off + 1] > len)
+			return true;
+
+		const uint8_t *data = buf + off + 2;
+		uint8_t data_len = buf[off + 1];
+
+		switch (buf[off])
+		{
+			case DHCP_OPT_MSGTYPE:
+				balanced = data_len == 1 && (data[0] == DHCPDISCOVER || data[0] == DHCPREQUEST);
+				break;
+
+			case DHCP_OPT_SERVERID:
+				if (data_len == 4 && memcmp(data, &id.s_addr, 4) == 0)
+					return true;
+				break;
+
+			case DHCP_OPT_CLIENTID:
+				if (data_len > 0) {
+					key = data;
+					key_len = data_len;
+				}
+				break;
+		}
+
+		off += 2 + data_len;
+	}
+
+	if (!balanced)
+		return true;
+
+	uint8_t bucket = balance_hash(key, key_len);
+
+	return b->map[bucket >> 3] & (1 << (bucket & 7));
+}
+
+/**
+ * Parse a list of buckets, e.g. "0-127,200", or "I/N" for the I-th of N
+ * equal shares, counted from 0
+ *
+ * @return Whether the list is valid
+ */
+extern bool balance_parse(struct balance *b, const char *text);
+
+/**
+ * Format the buckets as a list of ranges
+ *
+ * @param[out] out Buffer, large enough for every other bucket
+ * @param[in] size Size of the buffer
+ */
+extern void balance_format(const struct balance *b, char *out, size_t size);
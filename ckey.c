@@ -0,0 +1,115 @@
+#include "ckey.h"
+
+/**
+ * Build a key of its bytes
+ *
+ * @param[in] id Id of a longer key in the overflow table, 0 if it is not
+ *               interned
+ */
+static void ckey_set(struct ckey *key, const uint8_t *data, size_t len, uint16_t id)
+{
+	memset(key, 0, sizeof(struct ckey));
+
+	key->hash = intern_hash(data, len);
+
+	if (len <= CKEY_INLINE) {
+		key->len = len;
+		memcpy(key->data, data, len);
+	} else if (id != 0) {
+		key->len = CKEY_INTERNED;
+		memcpy(key->data, &id, sizeof id);
+	} else {
+		key->len = CKEY_UNKNOWN;
+		key->data[0] = len;
+		memcpy(key->data + 1, data, CKEY_INLINE - 1);
+	}
+}
+
+bool ckey_put(struct ckey *key, struct intern *overflow,
+	const uint8_t *data, size_t len)
+{
+	if (len == 0 || len > 255)
+		return false;
+
+	uint16_t id = len > CKEY_INLINE ? intern_put(overflow, data, len) : 0;
+
+	if (len > CKEY_INLINE && id == 0)
+		return false;
+
+	ckey_set(key, data, len, id);
+
+	return true;
+}
+
+bool ckey_lookup(struct ckey *key, struct intern *overflow,
+	const uint8_t *data, size_t len)
+{
+	if (len == 0 || len > 255)
+		return false;
+
+	uint16_t id = len > CKEY_INLINE ? intern_find(overflow, data, len) : 0;
+
+	if (len > CKEY_INLINE && id == 0)
+		return false;
+
+	ckey_set(key, data, len, id);
+
+	return true;
+}
+
+/**
+ * Get the bytes of the key of a client
+ *
+ * @param[out] hw Buffer for a key of the hardware address, 17 bytes
+ * @param[out] len Length of the key
+ */
+static const uint8_t *ckey_bytes(const uint8_t *id, size_t id_len,
+	uint8_t htype, uint8_t hlen, const uint8_t *chaddr, uint8_t *hw, size_t *len)
+{
+	if (id != NULL && id_len > 0 && id_len <= 255) {
+		*len = id_len;
+		return id;
+	}
+
+	if (hlen > 16)
+		hlen = 16;
+
+	hw[0] = htype;
+	memcpy(hw + 1, chaddr, hlen);
+
+	*len = hlen + 1;
+
+	return hw;
+}
+
+void ckey_make(struct ckey *key, struct intern *overflow,
+	const uint8_t *id, size_t id_len,
+	uint8_t htype, uint8_t hlen, const uint8_t *chaddr)
+{
+	uint8_t hw[17];
+	size_t len;
+	const uint8_t *data = ckey_bytes(id, id_len, htype, hlen, chaddr, hw, &len);
+
+	ckey_set(key, data, len, len > CKEY_INLINE && overflow != NULL ?
+		intern_find(overflow, data, len) : 0);
+}
+
+bool ckey_intern(struct ckey *key, struct intern *overflow,
+	const uint8_t *id, size_t id_len,
+	uint8_t htype, uint8_t hlen, const uint8_t *chaddr)
+{
+	if (key->len != CKEY_UNKNOWN)
+		return true;
+
+	uint8_t hw[17];
+	size_t len;
+	const uint8_t *data = ckey_bytes(id, id_len, htype, hlen, chaddr, hw, &len);
+	uint16_t interned = intern_put(overflow, data, len);
+
+	if (interned == 0)
+		return false;
+
+	ckey_set(key, data, len, interned);
+
+	return true;
+}
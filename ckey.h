@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "intern.h"
+
+/* A client key identifies a client: its client identifier (61) if it sent
+ * one, otherwise its hardware type followed by the hlen bytes of its
+ * hardware address. The common client identifier "type 1 + MAC" therefore
+ * yields the same key as the hardware address it was derived from.
+ *
+ * Keys of up to CKEY_INLINE bytes are stored inline, longer ones are
+ * interned and stored as their id, so a key has a fixed size of 16 bytes and
+ * two keys are equal if their bytes are equal. The hash is computed once and
+ * shared by every table the key is looked up in.
+ *
+ * Only keys of clients which get a lease are interned, see ckey_intern, and
+ * leases hold their ids. A longer key of any other client is CKEY_UNKNOWN,
+ * which finds no lease.
+ */
+
+#define CKEY_INLINE 11
+/* Tags of longer keys, no length of an inline key reaches them */
+#define CKEY_INTERNED (CKEY_INLINE + 1)
+#define CKEY_UNKNOWN (CKEY_INLINE + 2)
+
+struct ckey
+{
+	uint32_t hash;
+	/* Length of the key, 0 for none, or CKEY_INTERNED if data holds the
+	 * id of a longer one, or CKEY_UNKNOWN if a longer one is not interned
+	 * and data holds its length and a prefix
+	 */
+	uint8_t len;
+	uint8_t data[CKEY_INLINE];
+};
+
+static inline bool ckey_eq(const struct ckey *a, const struct ckey *b)
+{
+	return memcmp(a, b, sizeof(struct ckey)) == 0;
+}
+
+/**
+ * Build the key of a client, without interning it
+ *
+ * @param[out] key Key to build
+ * @param[in] overflow Table for keys longer than CKEY_INLINE
+ * @param[in] id Client identifier or NULL
+ * @param[in] id_len Length of the client identifier
+ * @param[in] htype Hardware type
+ * @param[in] hlen Hardware address length
+ * @param[in] chaddr Hardware address, 16 bytes
+ */
+extern void ckey_make(struct ckey *key, struct intern *overflow,
+	const uint8_t *id, size_t id_len,
+	uint8_t htype, uint8_t hlen, const uint8_t *chaddr);
+
+/**
+ * Intern a key of ckey_make for a client which gets a lease, with the same
+ * arguments
+ *
+ * @return Whether the key can be assigned, false if it is CKEY_UNKNOWN
+ *         and the overflow table is full
+ */
+extern bool ckey_intern(struct ckey *key, struct intern *overflow,
+	const uint8_t *id, size_t id_len,
+	uint8_t htype, uint8_t hlen, const uint8_t *chaddr);
+
+/**
+ * Build the key of the bytes of a key, as ckey_get returns them, interning
+ * them if they are longer than CKEY_INLINE
+ *
+ * @return Whether the key could be built, false if the overflow table is
+ *         full
+ */
+extern bool ckey_put(struct ckey *key, struct intern *overflow,
+	const uint8_t *data, size_t len);
+
+/**
+ * Build the key of the bytes of a key, as ckey_get returns them, without
+ * interning them
+ *
+ * @return Whether it can be the key of a client, false if it is longer
+ *         than CKEY_INLINE and was never interned
+ */
+extern bool ckey_lookup(struct ckey *key, struct intern *overflow,
+	const uint8_t *data, size_t len);
+
+/**
+ * Get the id a key holds in the overflow table
+ *
+ * @return The id, or 0 if the key is not interned
+ */
+static inline uint16_t ckey_id(const struct ckey *key)
+{
+	uint16_t id = 0;
+
+	if (key->len == CKEY_INTERNED)
+		memcpy(&id, key->data, sizeof id);
+
+	return id;
+}
+
+/**
+ * Get the bytes of a key
+ *
+ * @param[out] len Length of the key
+ * @return The key, or NULL if it is not interned
+ */
+static inline const uint8_t *ckey_get(const struct ckey *key,
+	struct intern *overflow, size_t *len)
+{
+	if (key->len <= CKEY_INLINE) {
+		*len = key->len;
+		return key->data;
+	}
+
+	if (key->len == CKEY_UNKNOWN)
+		return NULL;
+
+	return intern_get(overflow, ckey_id(key), len);
+}
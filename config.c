@@ -1,5 +1,9 @@
 #include "config.h"
 
+#include <string.h>
+
+#include "ddns.h"
+
 bool config_fill(struct config *cfg, struct argv *argv)
 {
 	cfg->argv = argv;
@@ -38,5 +42,235 @@ bool config_fill(struct config *cfg, struct argv *argv)
 	if (argv->prefixlen)
 		cfg->prefixlen = atoi(argv->prefixlen);
 
+	if (argv->leasetime_min)
+		cfg->leasetime_min = atoi(argv->leasetime_min);
+
+	if (argv->lease_jitter) {
+		int jitter = atoi(argv->lease_jitter);
+
+		/* T1 has to stay below T2 */
+		if (jitter < 0 || jitter > 20) {
+			cfg->error = "Invalid lease jitter";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->lease_jitter = jitter;
+	}
+
+	cfg->pin_relay = argv->pin_relay;
+	cfg->hash_alloc = argv->hash_alloc;
+
+	if (argv->listen)
+		if (inet_pton(AF_INET, argv->listen, &cfg->listen) != 1) {
+			cfg->error = "Invalid listen address";
+			config_free(cfg);
+			return false;
+		}
+
+	if (argv->reply)
+		if (inet_pton(AF_INET, argv->reply, &cfg->reply) != 1) {
+			cfg->error = "Invalid reply address";
+			config_free(cfg);
+			return false;
+		}
+
+	if (argv->port) {
+		int port = atoi(argv->port);
+
+		if (port <= 0 || port > 65535) {
+			cfg->error = "Invalid port";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->port = port;
+	}
+
+	if (argv->reply_port) {
+		int port = atoi(argv->reply_port);
+
+		if (port <= 0 || port > 65535) {
+			cfg->error = "Invalid reply port";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->reply_port = port;
+	}
+
+	cfg->unicast = argv->unicast;
+	cfg->rapid_commit = argv->rapid_commit;
+
+	if (argv->dedup) {
+		int dedup = atoi(argv->dedup);
+
+		if (dedup < 0 || dedup > 1 << 20) {
+			cfg->error = "Invalid dedup size";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->dedup = dedup;
+	}
+
+	if (argv->engine) {
+		if (strcmp(argv->engine, "ev") == 0)
+			cfg->engine = CONFIG_ENGINE_EV;
+		else if (strcmp(argv->engine, "uring") == 0)
+			cfg->engine = CONFIG_ENGINE_URING;
+		else {
+			cfg->error = "Unknown engine";
+			config_free(cfg);
+			return false;
+		}
+	}
+
+	if (argv->xdp) {
+		if (strcmp(argv->xdp, "generic") == 0)
+			cfg->xdp = CONFIG_XDP_GENERIC;
+		else if (strcmp(argv->xdp, "native") == 0)
+			cfg->xdp = CONFIG_XDP_NATIVE;
+		else {
+			cfg->error = "Unknown XDP mode";
+			config_free(cfg);
+			return false;
+		}
+
+		if (argv->interface == NULL) {
+			cfg->error = "-xdp needs -interface";
+			config_free(cfg);
+			return false;
+		}
+	}
+
+	if (argv->xdp_rate) {
+		int rate = atoi(argv->xdp_rate);
+
+		if (rate < 0) {
+			cfg->error = "Invalid XDP rate";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->xdp_rate = rate;
+	}
+
+	if (argv->probe) {
+		int probe = atoi(argv->probe);
+
+		if (probe < 0 || probe > 1 << 15) {
+			cfg->error = "Invalid number of probes";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->probe = probe;
+	}
+
+	if (argv->probe_timeout) {
+		int timeout = atoi(argv->probe_timeout);
+
+		if (timeout <= 0 || timeout > 10000) {
+			cfg->error = "Invalid probe timeout";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->probe_timeout = timeout;
+	}
+
+	if (argv->ddns)
+		if (inet_pton(AF_INET, argv->ddns, &cfg->ddns) != 1 ||
+				cfg->ddns.s_addr == INADDR_ANY) {
+			cfg->error = "Invalid DDNS server";
+			config_free(cfg);
+			return false;
+		}
+
+	if (argv->ddns_port) {
+		int port = atoi(argv->ddns_port);
+
+		if (port <= 0 || port > 65535) {
+			cfg->error = "Invalid DDNS port";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->ddns_port = port;
+	}
+
+	if (argv->ddns_zone) {
+		uint8_t wire[DDNS_NAME_MAXLEN];
+
+		if (ddns_name(argv->ddns_zone, wire) == 0) {
+			cfg->error = "Invalid DDNS zone";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->ddns_zone = argv->ddns_zone;
+	}
+
+	if (argv->ddns_reverse_zone) {
+		if (!ddns_reverse_valid(argv->ddns_reverse_zone)) {
+			cfg->error = "Invalid DDNS reverse zone";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->ddns_reverse_zone = argv->ddns_reverse_zone;
+	}
+
+	if (cfg->ddns.s_addr != INADDR_ANY && cfg->ddns_zone == NULL) {
+		cfg->error = "-ddns needs -ddns-zone";
+		config_free(cfg);
+		return false;
+	}
+
+	cfg->control = argv->control;
+
+	if (argv->balance) {
+		if (!balance_parse(&cfg->buckets, argv->balance)) {
+			cfg->error = "Invalid balance buckets";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->balance = true;
+	}
+
+	if (argv->replica)
+		if (inet_pton(AF_INET, argv->replica, &cfg->replica) != 1 ||
+				cfg->replica.s_addr == INADDR_ANY) {
+			cfg->error = "Invalid replica address";
+			config_free(cfg);
+			return false;
+		}
+
+	if (argv->standby) {
+		if (inet_pton(AF_INET, argv->standby, &cfg->standby_listen) != 1) {
+			cfg->error = "Invalid standby address";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->standby = true;
+	}
+
+	if (argv->replica_port) {
+		int port = atoi(argv->replica_port);
+
+		if (port <= 0 || port > 65535) {
+			cfg->error = "Invalid replica port";
+			config_free(cfg);
+			return false;
+		}
+
+		cfg->replica_port = port;
+	}
+
+	cfg->handoff = argv->handoff;
+
 	return true;
 }
@@ -7,6 +7,26 @@
 #include <arpa/inet.h>
 
 #include "argv.h"
+#include "balance.h"
+
+/* How the socket is read and written */
+enum config_engine
+{
+	/* recvfrom and sendto whenever libev reports the socket readable */
+	CONFIG_ENGINE_EV,
+	/* A multishot receive and batched sends on an io_uring */
+	CONFIG_ENGINE_URING
+};
+
+/* Whether and how the prefilter is attached to the interface */
+enum config_xdp
+{
+	CONFIG_XDP_OFF,
+	/* Above the driver, works everywhere */
+	CONFIG_XDP_GENERIC,
+	/* In the driver, which has to support it */
+	CONFIG_XDP_NATIVE
+};
 
 struct config
 {
@@ -23,6 +43,76 @@ struct config
 
 	uint32_t leasetime;
 	uint8_t prefixlen;
+
+	/* Shortest lease time, for a nearly exhausted pool, 0 for leasetime */
+	uint32_t leasetime_min;
+	/* Spread of T1 and T2 between clients, in percent of the lease time */
+	uint8_t lease_jitter;
+
+	/* Keep addresses of relayed clients with their relay agent circuit */
+	bool pin_relay;
+	/* Derive addresses from a hash of the client */
+	bool hash_alloc;
+
+	/* Address and port we receive on */
+	struct in_addr listen;
+	uint16_t port;
+
+	/* Destination of replies which are not relayed */
+	struct in_addr reply;
+	uint16_t reply_port;
+
+	/* Send replies to the source of the request instead of broadcasting
+	 * them, for tests over loopback
+	 */
+	bool unicast;
+
+	/* Number of replies kept for retransmitted requests, 0 for none */
+	uint32_t dedup;
+
+	/* Commit leases on a DHCPDISCOVER with Rapid Commit (80) */
+	bool rapid_commit;
+
+	enum config_engine engine;
+
+	enum config_xdp xdp;
+	/* Requests per second and hardware address the prefilter lets
+	 * through, 0 for any number
+	 */
+	uint32_t xdp_rate;
+
+	/* Addresses probed at once before they are offered, 0 for none */
+	uint32_t probe;
+	/* Milliseconds to wait for an answer to a probe */
+	uint32_t probe_timeout;
+
+	/* Name server to send dynamic updates to, INADDR_ANY for none */
+	struct in_addr ddns;
+	uint16_t ddns_port;
+	/* Zone of the host names and reverse zone, NULL for none */
+	const char *ddns_zone;
+	const char *ddns_reverse_zone;
+
+	/* Path of the control socket, NULL for none */
+	const char *control;
+
+	/* Only serve clients in these buckets, see balance.h */
+	bool balance;
+	struct balance buckets;
+
+	/* Standby to stream the leases to, INADDR_ANY for none */
+	struct in_addr replica;
+	/* Whether to follow a primary, whose stream is accepted on
+	 * standby_listen, until it fails
+	 */
+	bool standby;
+	struct in_addr standby_listen;
+	uint16_t replica_port;
+
+	/* Path of the socket to take over from a running server and hand
+	 * off to the next one, NULL for none
+	 */
+	const char *handoff;
 };
 
 #define CONFIG_EMPTY {\
@@ -33,7 +123,35 @@ struct config
 		.nameservers_cnt = 0,\
 		.iprange = {{0}, {0}},\
 		.leasetime = 3600,\
-		.prefixlen = 24\
+		.prefixlen = 24,\
+		.leasetime_min = 0,\
+		.lease_jitter = 10,\
+		.pin_relay = false,\
+		.hash_alloc = false,\
+		.listen = {INADDR_ANY},\
+		.port = 67,\
+		.reply = {INADDR_BROADCAST},\
+		.reply_port = 68,\
+		.unicast = false,\
+		.dedup = 4096,\
+		.rapid_commit = false,\
+		.engine = CONFIG_ENGINE_EV,\
+		.xdp = CONFIG_XDP_OFF,\
+		.xdp_rate = 10,\
+		.probe = 0,\
+		.probe_timeout = 500,\
+		.ddns = {INADDR_ANY},\
+		.ddns_port = 53,\
+		.ddns_zone = NULL,\
+		.ddns_reverse_zone = NULL,\
+		.control = NULL,\
+		.balance = false,\
+		.buckets = {{0}},\
+		.replica = {INADDR_ANY},\
+		.standby = false,\
+		.standby_listen = {INADDR_ANY},\
+		.replica_port = 647,\
+		.handoff = NULL\
 	}
 
 /**
@@ -0,0 +1,579 @@
+#include "control.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+/* Longest line of a lease record */
+#define CONTROL_RECORD_MAXLEN 1024
+
+static const char *const control_states[] = {
+	[LEASE_FREE] = "free",
+	[LEASE_OFFERED] = "offered",
+	[LEASE_BOUND] = "bound",
+	[LEASE_DECLINED] = "declined",
+	[LEASE_PROBING] = "probing"
+};
+
+/**
+ * Remove a connection from the list and free it
+ *
+ * @param[in] keep Whether to keep the socket open, it was handed on
+ */
+static void control_drop(struct control_conn *conn, bool keep)
+{
+	struct control *c = conn->control;
+	struct control_conn **link = &c->conns;
+
+	while (*link != conn)
+		link = &(*link)->next;
+
+	*link = conn->next;
+	--c->conns_cnt;
+
+	ev_io_stop(c->loop, &conn->watch);
+
+	if (!keep)
+		close(conn->fd);
+
+	free(conn);
+}
+
+/**
+ * Write a short answer, it fits the socket buffer
+ */
+static void control_reply(struct control_conn *conn, const char *text)
+{
+	(void)send(conn->fd, text, strlen(text), MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+static int control_hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+/**
+ * Parse hex bytes, optionally separated by colons or dashes
+ *
+ * @return Number of bytes, 0 if the text is no such bytes or longer
+ *         than max
+ */
+static size_t control_parse_hex(const char *text, uint8_t *out, size_t max)
+{
+	size_t len = 0;
+
+	while (*text != 0)
+	{
+		if (*text == ':' || *text == '-') {
+			++text;
+			continue;
+		}
+
+		int hi = control_hex_digit(text[0]);
+		int lo = hi >= 0 ? control_hex_digit(text[1]) : -1;
+
+		if (lo < 0 || len == max)
+			return 0;
+
+		out[len++] = hi << 4 | lo;
+		text += 2;
+	}
+
+	return len;
+}
+
+/**
+ * Format a lease record as a line of JSON
+ *
+ * @return Length of the line, at most CONTROL_RECORD_MAXLEN
+ */
+static size_t control_format(struct server *s, struct lease *l, char *out)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	struct in_addr addr = lease_address(s->leases, l);
+	char address[INET_ADDRSTRLEN];
+	char client[2 * 255 + 1];
+	size_t client_len = 0;
+	size_t hostname_len = 0;
+
+	const uint8_t *key = ckey_get(&l->key, s->clientids, &client_len);
+	const uint8_t *hostname = intern_get(s->hostnames, l->hostname, &hostname_len);
+
+	if (key == NULL)
+		client_len = 0;
+
+	for (size_t i = 0; i < client_len; ++i)
+	{
+		client[2 * i] = hex[key[i] >> 4];
+		client[2 * i + 1] = hex[key[i] & 0x0f];
+	}
+
+	client[2 * client_len] = 0;
+
+	inet_ntop(AF_INET, &addr, address, sizeof address);
+
+	int len = snprintf(out, CONTROL_RECORD_MAXLEN, "{\"address\":\"%s\",\"state\":\"%s\","
+		"\"client\":\"%s\",\"hostname\":\"%.*s\",\"expires\":%.0f}\n",
+		address, control_states[l->state], client,
+		(int)(hostname != NULL ? hostname_len : 0), hostname != NULL ? (const char *)hostname : "",
+		l->expires);
+
+	return len < CONTROL_RECORD_MAXLEN ? (size_t)len : CONTROL_RECORD_MAXLEN - 1;
+}
+
+/**
+ * Handle a lease command
+ */
+static void control_lease(struct control_conn *conn, char **save)
+{
+	struct server *s = conn->control->server;
+	char *by = strtok_r(NULL, " \t", save);
+	char *value = strtok_r(NULL, " \t", save);
+	struct lease *l = NULL;
+
+	if (by == NULL || value == NULL) {
+		control_reply(conn, "error lease needs ip, mac or client and a value\n");
+		return;
+	}
+
+	if (strcmp(by, "ip") == 0) {
+		struct in_addr address;
+
+		if (inet_pton(AF_INET, value, &address) != 1) {
+			control_reply(conn, "error invalid address\n");
+			return;
+		}
+
+		l = lease_at(s->leases, address);
+	} else if (strcmp(by, "mac") == 0 || strcmp(by, "client") == 0) {
+		/* A hardware address is keyed with its type, Ethernet */
+		bool mac = by[0] == 'm';
+		uint8_t data[255];
+		size_t len = control_parse_hex(value, data + mac, sizeof data - mac);
+		struct ckey key;
+
+		if (len == 0 || (mac && len > 16)) {
+			control_reply(conn, "error invalid hex\n");
+			return;
+		}
+
+		if (mac)
+			data[0] = 1;
+
+		if (ckey_lookup(&key, s->clientids, data, len + mac))
+			l = lease_find(s->leases, &key);
+	} else {
+		control_reply(conn, "error lease needs ip, mac or client and a value\n");
+		return;
+	}
+
+	if (l == NULL || l->state == LEASE_FREE) {
+		control_reply(conn, "error no lease\n");
+		return;
+	}
+
+	char line[CONTROL_RECORD_MAXLEN];
+
+	control_format(s, l, line);
+	control_reply(conn, line);
+}
+
+static bool control_write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t written = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (written < 0 && errno == EINTR)
+			continue;
+
+		if (written < 0)
+			return false;
+
+		buf += written;
+		len -= written;
+	}
+
+	return true;
+}
+
+/**
+ * Write all records in use, in the child
+ */
+static void control_dump_write(struct server *s, int fd)
+{
+	char buf[65536];
+	size_t len = 0;
+	uint32_t cnt = 0;
+
+	for (uint32_t i = 0; i < s->leases->size; ++i)
+	{
+		struct lease *l = &s->leases->a[i];
+
+		if (l->state == LEASE_FREE)
+			continue;
+
+		if (sizeof buf - len < CONTROL_RECORD_MAXLEN) {
+			if (!control_write_all(fd, buf, len))
+				return;
+
+			len = 0;
+		}
+
+		len += control_format(s, l, buf + len);
+		++cnt;
+	}
+
+	len += snprintf(buf + len, sizeof buf - len, "{\"end\":true,\"leases\":%u}\n", cnt);
+
+	control_write_all(fd, buf, len);
+}
+
+/**
+ * Handle a dump command: fork a child which writes the records as they
+ * are now
+ *
+ * @return Whether the connection was handed to the child
+ */
+static bool control_dump(struct control_conn *conn)
+{
+	struct control *c = conn->control;
+	ev_child *w = NULL;
+
+	for (size_t i = 0; i < CONTROL_DUMPS && w == NULL; ++i)
+		if (!ev_is_active(&c->dumps[i]))
+			w = &c->dumps[i];
+
+	if (w == NULL) {
+		control_reply(conn, "error too many dumps\n");
+		return false;
+	}
+
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		control_reply(conn, "error could not fork\n");
+		return false;
+	}
+
+	if (pid == 0) {
+		/* The child may block, only the server may not */
+		fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) & ~O_NONBLOCK);
+		control_dump_write(c->server, conn->fd);
+		_exit(0);
+	}
+
+	ev_child_set(w, pid, 0);
+	ev_child_start(c->loop, w);
+
+	control_drop(conn, false);
+
+	return true;
+}
+
+static void control_dump_cb(EV_P_ ev_child *w, int revents)
+{
+	(void)revents;
+
+	ev_child_stop(EV_A_ w);
+}
+
+/**
+ * Handle a balance command: show the buckets served, or assign others
+ */
+static void control_balance(struct control_conn *conn, char **save)
+{
+	struct server *s = conn->control->server;
+	char *list = strtok_r(NULL, " \t", save);
+	char line[1024];
+
+	if (list != NULL && strcmp(list, "off") == 0) {
+		s->balance = false;
+	} else if (list != NULL) {
+		struct balance buckets;
+
+		if (!balance_parse(&buckets, list)) {
+			control_reply(conn, "error invalid buckets\n");
+			return;
+		}
+
+		s->buckets = buckets;
+		s->balance = true;
+	}
+
+	if (!s->balance) {
+		control_reply(conn, "balance off\n");
+		return;
+	}
+
+	strcpy(line, "balance ");
+	balance_format(&s->buckets, line + 8, sizeof line - 9);
+	strcat(line, "\n");
+
+	control_reply(conn, line);
+}
+
+/**
+ * Handle a takeover command: stop following the primary and serve
+ */
+static void control_takeover(struct control_conn *conn)
+{
+	struct replica *r = conn->control->replica;
+
+	if (r == NULL || !replica_takeover(r)) {
+		control_reply(conn, "error not a standby\n");
+		return;
+	}
+
+	control_reply(conn, "takeover ok\n");
+}
+
+/**
+ * Handle a subscribe command
+ *
+ * @return Whether the connection was handed to the event stream
+ */
+static bool control_subscribe(struct control_conn *conn, char **save)
+{
+	bool binary = false;
+	bool replay = false;
+	char *arg;
+
+	while ((arg = strtok_r(NULL, " \t", save)) != NULL)
+	{
+		if (strcmp(arg, "json") == 0) {
+			binary = false;
+		} else if (strcmp(arg, "binary") == 0) {
+			binary = true;
+		} else if (strcmp(arg, "replay") == 0) {
+			replay = true;
+		} else {
+			control_reply(conn, "error unknown argument\n");
+			return false;
+		}
+	}
+
+	struct events *events = conn->control->events;
+	int fd = conn->fd;
+
+	if (events->subscribers_cnt >= EVENTS_SUBSCRIBERS) {
+		control_reply(conn, "error too many subscribers\n");
+		return false;
+	}
+
+	control_drop(conn, true);
+	events_subscribe(events, fd, binary, replay);
+
+	return true;
+}
+
+/**
+ * Handle a command line
+ *
+ * @return Whether the connection is still ours
+ */
+static bool control_command(struct control_conn *conn, char *line)
+{
+	char *save;
+	char *cmd = strtok_r(line, " \t", &save);
+
+	if (cmd == NULL)
+		return true;
+
+	if (strcmp(cmd, "lease") == 0) {
+		control_lease(conn, &save);
+		return true;
+	}
+
+	if (strcmp(cmd, "balance") == 0) {
+		control_balance(conn, &save);
+		return true;
+	}
+
+	if (strcmp(cmd, "takeover") == 0) {
+		control_takeover(conn);
+		return true;
+	}
+
+	if (strcmp(cmd, "dump") == 0)
+		return !control_dump(conn);
+
+	if (strcmp(cmd, "subscribe") == 0)
+		return !control_subscribe(conn, &save);
+
+	control_reply(conn, "error unknown command\n");
+
+	return true;
+}
+
+static void control_read_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	struct control_conn *conn = w->data;
+	ssize_t len = recv(conn->fd, conn->line + conn->line_len,
+		sizeof conn->line - conn->line_len, MSG_DONTWAIT);
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (len <= 0) {
+		control_drop(conn, false);
+		return;
+	}
+
+	conn->line_len += len;
+
+	char *nl;
+
+	while ((nl = memchr(conn->line, '\n', conn->line_len)) != NULL)
+	{
+		size_t used = nl + 1 - conn->line;
+
+		*nl = 0;
+
+		if (nl > conn->line && nl[-1] == '\r')
+			nl[-1] = 0;
+
+		if (!control_command(conn, conn->line))
+			return;
+
+		memmove(conn->line, conn->line + used, conn->line_len - used);
+		conn->line_len -= used;
+	}
+
+	if (conn->line_len == sizeof conn->line) {
+		control_reply(conn, "error line too long\n");
+		control_drop(conn, false);
+	}
+}
+
+static void control_accept_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)revents;
+
+	struct control *c = w->data;
+	int fd;
+
+	while ((fd = accept4(c->sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		struct control_conn *conn = NULL;
+
+		if (c->conns_cnt < CONTROL_CONNS)
+			conn = calloc(1, sizeof(struct control_conn));
+
+		if (conn == NULL) {
+			close(fd);
+			continue;
+		}
+
+		conn->control = c;
+		conn->fd = fd;
+		conn->next = c->conns;
+		c->conns = conn;
+		++c->conns_cnt;
+
+		ev_io_init(&conn->watch, control_read_cb, fd, EV_READ);
+		conn->watch.data = conn;
+		ev_io_start(EV_A_ &conn->watch);
+	}
+}
+
+struct control *control_create(struct ev_loop *loop, const char *path,
+	struct server *server, struct events *events, struct replica *replica)
+{
+	struct control *c = calloc(1, sizeof(struct control));
+
+	if (c == NULL)
+		return NULL;
+
+	if (strlen(path) >= sizeof c->addr.sun_path) {
+		free(c);
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	c->addr.sun_family = AF_UNIX;
+	strcpy(c->addr.sun_path, path);
+
+	c->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	struct stat st;
+
+	/* A socket left behind by a previous run, or of the server we took
+	 * over from
+	 */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	/* Leases and events are for the user of the server only, before anybody
+	 * can connect
+	 */
+	if (c->sock < 0 ||
+			bind(c->sock, (const struct sockaddr *)&c->addr, sizeof c->addr) < 0 ||
+			chmod(path, 0600) < 0 ||
+			listen(c->sock, CONTROL_CONNS) < 0 ||
+			stat(path, &st) < 0) {
+		int err = errno;
+
+		if (c->sock >= 0)
+			close(c->sock);
+
+		free(c);
+		errno = err;
+
+		return NULL;
+	}
+
+	c->loop = loop;
+	c->dev = st.st_dev;
+	c->ino = st.st_ino;
+	c->server = server;
+	c->events = events;
+	c->replica = replica;
+
+	for (size_t i = 0; i < CONTROL_DUMPS; ++i)
+		ev_child_init(&c->dumps[i], control_dump_cb, 0, 0);
+
+	ev_io_init(&c->accept_watch, control_accept_cb, c->sock, EV_READ);
+	c->accept_watch.data = c;
+	ev_io_start(loop, &c->accept_watch);
+
+	return c;
+}
+
+void control_destroy(struct control *c)
+{
+	while (c->conns != NULL)
+		control_drop(c->conns, false);
+
+	for (size_t i = 0; i < CONTROL_DUMPS; ++i)
+		ev_child_stop(c->loop, &c->dumps[i]);
+
+	ev_io_stop(c->loop, &c->accept_watch);
+	close(c->sock);
+
+	/* A successor we handed off to has its own socket there */
+	struct stat st;
+
+	if (stat(c->addr.sun_path, &st) == 0 && st.st_dev == c->dev && st.st_ino == c->ino)
+		unlink(c->addr.sun_path);
+
+	free(c);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include <ev.h>
+
+#include "server.h"
+#include "events.h"
+#include "replica.h"
+
+/* The control socket, a Unix stream socket which takes commands, one per
+ * line:
+ *
+ *     lease ip IP
+ *     lease mac MAC
+ *     lease client HEX
+ *
+ * answer with the lease record of an address, a hardware address or a
+ * client identifier as a JSON line:
+ *
+ *     {"address":"10.0.0.10","state":"bound","client":"01020000000001",
+ *      "hostname":"laptop","expires":1700003600}
+ *
+ *     dump
+ *
+ * streams all records in use as such lines, followed by
+ * {"end":true,"leases":N}, and closes the connection, see RFC 6926 for
+ * the idea. The dump is written by a child process, so it sees the table
+ * as it was when the command came in, in pages the kernel copies on write,
+ * and the server goes on while a slow reader takes its time.
+ *
+ *     balance [LIST|off]
+ *
+ * shows the buckets served with load balancing, see balance.h, after
+ * assigning others or turning it off.
+ *
+ *     takeover
+ *
+ * makes a standby serve the clients of its primary right away, see
+ * replica.h, e.g. for a planned switchover.
+ *
+ *     subscribe [json|binary] [replay]
+ *
+ * turns the connection into a stream of lease events, see events.h, in
+ * JSON by default, optionally starting with the events still kept.
+ *
+ * A command which fails is answered with a line starting with "error".
+ */
+
+/* Connections waiting for a command at most */
+#define CONTROL_CONNS 16
+/* Longest command line */
+#define CONTROL_LINE_MAXLEN 256
+/* Dumps running at once at most */
+#define CONTROL_DUMPS 4
+
+struct control_conn
+{
+	struct control *control;
+	int fd;
+	ev_io watch;
+
+	char line[CONTROL_LINE_MAXLEN];
+	size_t line_len;
+
+	struct control_conn *next;
+};
+
+struct control
+{
+	struct ev_loop *loop;
+	int sock;
+	struct sockaddr_un addr;
+	/* The socket file we created, it is only removed if still there */
+	dev_t dev;
+	ino_t ino;
+	ev_io accept_watch;
+
+	/* Leases are looked up here */
+	struct server *server;
+	/* Lease events for subscribers */
+	struct events *events;
+	/* Told to take over, NULL for none */
+	struct replica *replica;
+
+	/* Children writing dumps */
+	ev_child dumps[CONTROL_DUMPS];
+
+	struct control_conn *conns;
+	size_t conns_cnt;
+};
+
+/**
+ * Create the socket, replacing a stale one, and start accepting connections
+ *
+ * @param[in] loop Event loop
+ * @param[in] path Path of the socket
+ * @param[in] server Server whose leases are queried
+ * @param[in] events Event stream subscribers are added to
+ * @param[in] replica Replication of the leases, NULL for none
+ * @return The control socket, or NULL with errno set
+ */
+extern struct control *control_create(struct ev_loop *loop, const char *path,
+	struct server *server, struct events *events, struct replica *replica);
+
+/**
+ * Close all connections and remove the socket, unless a successor took
+ * the path over, running dumps finish
+ */
+extern void control_destroy(struct control *c);
@@ -0,0 +1,629 @@
+#include "ddns.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+
+#include <sys/socket.h>
+
+#include "intern.h"
+
+#define DDNS_NONE UINT32_MAX
+
+/* Header flags of an update, its opcode is 5 */
+#define DDNS_OPCODE_UPDATE 0x2800
+#define DDNS_RCODE_SERVFAIL 2
+
+#define DDNS_TYPE_A 1
+#define DDNS_TYPE_SOA 6
+#define DDNS_TYPE_PTR 12
+
+#define DDNS_CLASS_IN 1
+#define DDNS_CLASS_NONE 254
+#define DDNS_CLASS_ANY 255
+
+/* The zone follows the header */
+#define DDNS_ZONE_AT 12
+
+size_t ddns_name(const char *name, uint8_t wire[DDNS_NAME_MAXLEN])
+{
+	size_t len = 0;
+
+	while (*name != 0)
+	{
+		const char *dot = strchr(name, '.');
+		size_t label = dot != NULL ? (size_t)(dot - name) : strlen(name);
+
+		if (label == 0 || label > 63 || len + 1 + label + 1 > DDNS_NAME_MAXLEN)
+			return 0;
+
+		for (size_t i = 0; i < label; ++i)
+		{
+			char c = name[i];
+
+			if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+					(c >= '0' && c <= '9') || c == '-' || c == '_'))
+				return 0;
+		}
+
+		wire[len++] = label;
+		memcpy(wire + len, name, label);
+		len += label;
+
+		name += label;
+
+		if (*name == '.')
+			++name;
+	}
+
+	if (len == 0)
+		return 0;
+
+	wire[len++] = 0;
+
+	return len;
+}
+
+/**
+ * Parse a reverse zone
+ *
+ * @param[in] name Dotted name
+ * @param[out] prefix Leading octets of the addresses in the zone
+ * @return Number of octets, -1 if it is no reverse zone
+ */
+static int ddns_reverse_parse(const char *name, uint8_t prefix[3])
+{
+	uint8_t octets[4];
+	int cnt = 0;
+
+	for (;;)
+	{
+		if (strcasecmp(name, "in-addr.arpa") == 0 || strcasecmp(name, "in-addr.arpa.") == 0)
+			break;
+
+		char *end;
+		long octet = strtol(name, &end, 10);
+
+		if (end == name || *end != '.' || octet < 0 || octet > 255 || cnt == 3)
+			return -1;
+
+		octets[cnt++] = octet;
+		name = end + 1;
+	}
+
+	/* The name has them in reverse */
+	for (int i = 0; i < cnt; ++i)
+		prefix[i] = octets[cnt - 1 - i];
+
+	return cnt;
+}
+
+bool ddns_reverse_valid(const char *name)
+{
+	uint8_t prefix[3];
+
+	return ddns_reverse_parse(name, prefix) >= 0;
+}
+
+static uint32_t ddns_hash(const uint8_t *name, size_t len, struct in_addr address)
+{
+	uint32_t hash = intern_hash(name, len);
+	const uint8_t *addr = (const uint8_t *)&address.s_addr;
+
+	for (size_t i = 0; i < 4; ++i)
+		hash = (hash ^ addr[i]) * 16777619u;
+
+	return hash & (DDNS_QUEUE - 1);
+}
+
+/**
+ * Append to a message
+ *
+ * @return Whether it fit
+ */
+static bool ddns_put(struct ddns_msg *m, const void *data, size_t len)
+{
+	if (m->len + len > DDNS_MSG_MAXLEN)
+		return false;
+
+	memcpy(m->data + m->len, data, len);
+	m->len += len;
+
+	return true;
+}
+
+/**
+ * Append the fixed part of a record and count it in the header
+ *
+ * @param[in] rdlen Length of the data, which the caller appends
+ */
+static bool ddns_put_rr(struct ddns_msg *m, uint16_t type, uint16_t class,
+	uint32_t ttl, uint16_t rdlen)
+{
+	uint8_t rr[10] = {
+		type >> 8, type & 0xff,
+		class >> 8, class & 0xff,
+		ttl >> 24, (ttl >> 16) & 0xff, (ttl >> 8) & 0xff, ttl & 0xff,
+		rdlen >> 8, rdlen & 0xff
+	};
+
+	if (!ddns_put(m, rr, sizeof rr))
+		return false;
+
+	uint16_t cnt = (m->data[8] << 8 | m->data[9]) + 1;
+
+	m->data[8] = cnt >> 8;
+	m->data[9] = cnt & 0xff;
+
+	return true;
+}
+
+/**
+ * Append a pointer to a name earlier in the message
+ */
+static bool ddns_put_ptr(struct ddns_msg *m, uint16_t at)
+{
+	uint8_t ptr[2] = { 0xc0 | at >> 8, at & 0xff };
+
+	return ddns_put(m, ptr, sizeof ptr);
+}
+
+/**
+ * Start a message with the header and the zone section
+ */
+static void ddns_begin(struct ddns *d, struct ddns_msg *m, const uint8_t *zone,
+	size_t zone_len)
+{
+	uint16_t id = d->next_id++;
+	uint8_t header[DDNS_ZONE_AT] = {
+		id >> 8, id & 0xff,
+		DDNS_OPCODE_UPDATE >> 8, DDNS_OPCODE_UPDATE & 0xff,
+		/* One zone, no prerequisites, the updates counted as they are
+		 * appended, no additional records
+		 */
+		0, 1, 0, 0, 0, 0, 0, 0
+	};
+	uint8_t question[4] = { 0, DDNS_TYPE_SOA, 0, DDNS_CLASS_IN };
+
+	m->id = id;
+	m->attempts = 0;
+	m->updates = 0;
+	m->len = 0;
+
+	ddns_put(m, header, sizeof header);
+	ddns_put(m, zone, zone_len);
+	ddns_put(m, question, sizeof question);
+}
+
+/**
+ * Append the A records of an update: all records of the name are replaced
+ * by the address, or just the address is deleted
+ */
+static bool ddns_put_a(struct ddns_msg *m, const struct ddns_update *u)
+{
+	uint16_t owner = m->len;
+
+	if (!ddns_put(m, &u->name_len, 1) || !ddns_put(m, u->name, u->name_len) ||
+			!ddns_put_ptr(m, DDNS_ZONE_AT))
+		return false;
+
+	if (!u->add)
+		return ddns_put_rr(m, DDNS_TYPE_A, DDNS_CLASS_NONE, 0, 4) &&
+			ddns_put(m, &u->address.s_addr, 4);
+
+	return ddns_put_rr(m, DDNS_TYPE_A, DDNS_CLASS_ANY, 0, 0) &&
+		ddns_put_ptr(m, owner) &&
+		ddns_put_rr(m, DDNS_TYPE_A, DDNS_CLASS_IN, DDNS_TTL, 4) &&
+		ddns_put(m, &u->address.s_addr, 4);
+}
+
+/**
+ * Append the PTR records of an update, which replace or delete all records
+ * of the address
+ *
+ * @param[in,out] target Offset of the forward zone in the message, 0 if it
+ *                       was not written yet
+ */
+static bool ddns_put_reverse(struct ddns *d, struct ddns_msg *m,
+	const struct ddns_update *u, uint16_t *target)
+{
+	const uint8_t *addr = (const uint8_t *)&u->address.s_addr;
+	uint16_t owner = m->len;
+
+	for (int i = 3; i >= d->reverse_octets; --i)
+	{
+		char label[4];
+		uint8_t len = snprintf(label, sizeof label, "%u", addr[i]);
+
+		if (!ddns_put(m, &len, 1) || !ddns_put(m, label, len))
+			return false;
+	}
+
+	if (!ddns_put_ptr(m, DDNS_ZONE_AT) ||
+			!ddns_put_rr(m, DDNS_TYPE_PTR, DDNS_CLASS_ANY, 0, 0))
+		return false;
+
+	if (!u->add)
+		return true;
+
+	uint16_t rdlen = 1 + u->name_len + (*target != 0 ? 2 : d->zone_len);
+
+	if (!ddns_put_ptr(m, owner) ||
+			!ddns_put_rr(m, DDNS_TYPE_PTR, DDNS_CLASS_IN, DDNS_TTL, rdlen) ||
+			!ddns_put(m, &u->name_len, 1) || !ddns_put(m, u->name, u->name_len))
+		return false;
+
+	if (*target != 0)
+		return ddns_put_ptr(m, *target);
+
+	uint16_t at = m->len;
+
+	if (!ddns_put(m, d->zone, d->zone_len))
+		return false;
+
+	*target = at;
+
+	return true;
+}
+
+static bool ddns_in_reverse(const struct ddns *d, struct in_addr address)
+{
+	return d->reverse_len > 0 &&
+		memcmp(&address.s_addr, d->reverse_prefix, d->reverse_octets) == 0;
+}
+
+static struct ddns_msg *ddns_free_msg(struct ddns *d, const struct ddns_msg *other)
+{
+	for (size_t i = 0; i < DDNS_INFLIGHT; ++i)
+		if (!d->msgs[i].active && &d->msgs[i] != other)
+			return &d->msgs[i];
+
+	return NULL;
+}
+
+/**
+ * Start the retry timer for the earliest deadline, if any
+ */
+static void ddns_arm(struct ddns *d)
+{
+	ev_tstamp deadline = 0;
+
+	for (size_t i = 0; i < DDNS_INFLIGHT; ++i)
+		if (d->msgs[i].active && (deadline == 0 || d->msgs[i].deadline < deadline))
+			deadline = d->msgs[i].deadline;
+
+	ev_timer_stop(d->loop, &d->retry_watch);
+
+	if (deadline == 0)
+		return;
+
+	ev_tstamp after = deadline - ev_now(d->loop);
+
+	ev_timer_set(&d->retry_watch, after > 0 ? after : 0, 0);
+	ev_timer_start(d->loop, &d->retry_watch);
+}
+
+/**
+ * Send a message, again if it was sent before, with a doubled timeout
+ */
+static void ddns_send(struct ddns *d, struct ddns_msg *m)
+{
+	/* Lost like a lost answer if it fails, the retry covers both */
+	if (send(d->sock, m->data, m->len, MSG_DONTWAIT) >= 0)
+		++d->stats.sent;
+
+	m->active = true;
+	m->deadline = ev_now(d->loop) + DDNS_TIMEOUT * (1 << m->attempts);
+	++m->attempts;
+}
+
+/**
+ * Take an update off the queue and free it
+ */
+static void ddns_dequeue(struct ddns *d)
+{
+	uint32_t idx = d->head;
+	struct ddns_update *u = &d->updates[idx];
+	uint32_t *link = &d->buckets[ddns_hash(u->name, u->name_len, u->address)];
+
+	while (*link != idx)
+		link = &d->updates[*link].chain;
+
+	*link = u->chain;
+
+	d->head = u->next;
+
+	if (d->head == DDNS_NONE)
+		d->tail = DDNS_NONE;
+
+	u->next = d->free;
+	d->free = idx;
+}
+
+/**
+ * Pack queued updates into messages and send them, as long as messages
+ * may be sent
+ */
+static void ddns_flush(struct ddns *d)
+{
+	while (d->head != DDNS_NONE)
+	{
+		struct ddns_msg *fwd = ddns_free_msg(d, NULL);
+		struct ddns_msg *rev = d->reverse_len > 0 ? ddns_free_msg(d, fwd) : NULL;
+
+		if (fwd == NULL || (d->reverse_len > 0 && rev == NULL))
+			break;
+
+		ddns_begin(d, fwd, d->zone, d->zone_len);
+
+		if (rev != NULL)
+			ddns_begin(d, rev, d->reverse, d->reverse_len);
+
+		uint16_t target = 0;
+
+		while (d->head != DDNS_NONE)
+		{
+			const struct ddns_update *u = &d->updates[d->head];
+			uint16_t fwd_len = fwd->len;
+			uint16_t fwd_cnt = fwd->data[8] << 8 | fwd->data[9];
+
+			if (!ddns_put_a(fwd, u)) {
+				fwd->len = fwd_len;
+				fwd->data[8] = fwd_cnt >> 8;
+				fwd->data[9] = fwd_cnt & 0xff;
+				break;
+			}
+
+			if (ddns_in_reverse(d, u->address)) {
+				uint16_t rev_len = rev->len;
+				uint16_t rev_cnt = rev->data[8] << 8 | rev->data[9];
+				uint16_t rev_target = target;
+
+				if (!ddns_put_reverse(d, rev, u, &target)) {
+					rev->len = rev_len;
+					rev->data[8] = rev_cnt >> 8;
+					rev->data[9] = rev_cnt & 0xff;
+					target = rev_target;
+
+					fwd->len = fwd_len;
+					fwd->data[8] = fwd_cnt >> 8;
+					fwd->data[9] = fwd_cnt & 0xff;
+					break;
+				}
+
+				++rev->updates;
+			}
+
+			++fwd->updates;
+			ddns_dequeue(d);
+		}
+
+		/* Nothing fits an empty message */
+		if (fwd->updates == 0)
+			break;
+
+		ddns_send(d, fwd);
+
+		if (rev != NULL && rev->updates > 0)
+			ddns_send(d, rev);
+	}
+
+	ddns_arm(d);
+}
+
+static void ddns_flush_cb(EV_P_ ev_timer *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	ddns_flush(w->data);
+}
+
+static void ddns_retry_cb(EV_P_ ev_timer *w, int revents)
+{
+	(void)revents;
+
+	struct ddns *d = w->data;
+	ev_tstamp now = ev_now(EV_A);
+
+	for (size_t i = 0; i < DDNS_INFLIGHT; ++i)
+	{
+		struct ddns_msg *m = &d->msgs[i];
+
+		if (!m->active || m->deadline > now)
+			continue;
+
+		if (m->attempts < DDNS_ATTEMPTS) {
+			ddns_send(d, m);
+		} else {
+			d->stats.failed += m->updates;
+			m->active = false;
+		}
+	}
+
+	/* Messages may have been freed */
+	ddns_flush(d);
+}
+
+static void ddns_read_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	struct ddns *d = w->data;
+	uint8_t buf[512];
+	ssize_t len;
+	bool freed = false;
+
+	while ((len = recv(d->sock, buf, sizeof buf, MSG_DONTWAIT)) >= 0 || errno == EINTR ||
+			errno == ECONNREFUSED)
+	{
+		/* An answer to an update, with the opcode echoed */
+		if (len < DDNS_ZONE_AT || !(buf[2] & 0x80) || (buf[2] & 0x78) != 0x28)
+			continue;
+
+		uint16_t id = buf[0] << 8 | buf[1];
+		uint8_t rcode = buf[3] & 0x0f;
+
+		for (size_t i = 0; i < DDNS_INFLIGHT; ++i)
+		{
+			struct ddns_msg *m = &d->msgs[i];
+
+			if (!m->active || m->id != id)
+				continue;
+
+			/* Retried when it times out */
+			if (rcode == DDNS_RCODE_SERVFAIL)
+				break;
+
+			if (rcode == 0)
+				d->stats.acked += m->updates;
+			else
+				d->stats.failed += m->updates;
+
+			m->active = false;
+			freed = true;
+			break;
+		}
+	}
+
+	if (freed)
+		ddns_flush(d);
+}
+
+struct ddns *ddns_create(struct ev_loop *loop,
+	const struct sockaddr_in *server, const char *zone, const char *reverse)
+{
+	struct ddns *d = calloc(1, sizeof(struct ddns));
+
+	if (d == NULL)
+		return NULL;
+
+	d->zone_len = ddns_name(zone, d->zone);
+
+	if (reverse != NULL) {
+		int octets = ddns_reverse_parse(reverse, d->reverse_prefix);
+
+		d->reverse_len = ddns_name(reverse, d->reverse);
+		d->reverse_octets = octets;
+
+		if (octets < 0)
+			d->reverse_len = 0;
+	}
+
+	if (d->zone_len == 0 || (reverse != NULL && d->reverse_len == 0)) {
+		free(d);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	d->sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+
+	if (d->sock < 0 || connect(d->sock, (const struct sockaddr *)server, sizeof *server) < 0) {
+		int err = errno;
+
+		if (d->sock >= 0)
+			close(d->sock);
+
+		free(d);
+		errno = err;
+
+		return NULL;
+	}
+
+	d->loop = loop;
+	d->next_id = (getpid() ^ time(NULL)) & 0xffff;
+
+	for (uint32_t i = 0; i < DDNS_QUEUE; ++i)
+	{
+		d->buckets[i] = DDNS_NONE;
+		d->updates[i].next = i + 1 < DDNS_QUEUE ? i + 1 : DDNS_NONE;
+	}
+
+	d->head = DDNS_NONE;
+	d->tail = DDNS_NONE;
+	d->free = 0;
+
+	ev_io_init(&d->read_watch, ddns_read_cb, d->sock, EV_READ);
+	d->read_watch.data = d;
+	ev_io_start(loop, &d->read_watch);
+
+	ev_init(&d->flush_watch, ddns_flush_cb);
+	d->flush_watch.data = d;
+
+	ev_init(&d->retry_watch, ddns_retry_cb);
+	d->retry_watch.data = d;
+
+	return d;
+}
+
+void ddns_destroy(struct ddns *d)
+{
+	ev_io_stop(d->loop, &d->read_watch);
+	ev_timer_stop(d->loop, &d->flush_watch);
+	ev_timer_stop(d->loop, &d->retry_watch);
+
+	close(d->sock);
+	free(d);
+}
+
+bool ddns_update(struct ddns *d, const uint8_t *name, size_t len,
+	struct in_addr address, bool add)
+{
+	if (len == 0 || len > sizeof d->updates[0].name)
+		return false;
+
+	uint32_t *bucket = &d->buckets[ddns_hash(name, len, address)];
+
+	for (uint32_t idx = *bucket; idx != DDNS_NONE; idx = d->updates[idx].chain)
+	{
+		struct ddns_update *u = &d->updates[idx];
+
+		if (u->name_len == len && u->address.s_addr == address.s_addr &&
+				memcmp(u->name, name, len) == 0) {
+			u->add = add;
+			++d->stats.coalesced;
+			return true;
+		}
+	}
+
+	if (d->free == DDNS_NONE) {
+		++d->stats.dropped;
+		return false;
+	}
+
+	uint32_t idx = d->free;
+	struct ddns_update *u = &d->updates[idx];
+
+	d->free = u->next;
+
+	u->address = address;
+	u->add = add;
+	u->name_len = len;
+	memcpy(u->name, name, len);
+
+	u->chain = *bucket;
+	*bucket = idx;
+
+	u->next = DDNS_NONE;
+
+	if (d->tail != DDNS_NONE)
+		d->updates[d->tail].next = idx;
+	else
+		d->head = idx;
+
+	d->tail = idx;
+
+	++d->stats.queued;
+
+	if (!ev_is_active(&d->flush_watch)) {
+		ev_timer_set(&d->flush_watch, DDNS_DELAY, 0);
+		ev_timer_start(d->loop, &d->flush_watch);
+	}
+
+	return true;
+}
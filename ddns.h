@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+#include <ev.h>
+
+/* Dynamic DNS updates, see RFC 2136: an A record in the zone for every
+ * bound client with a host name, and a PTR record in the reverse zone.
+ *
+ * Updates never wait for the name server. They are queued, keyed by name
+ * and address, so a client which binds and releases in quick succession
+ * costs one update, the latest. A short delay collects them into messages
+ * of a few dozen records each, which are sent on a UDP socket with a
+ * number of them in flight. A message which is not answered in time, or
+ * is answered with SERVFAIL, is sent again with an exponential backoff
+ * and dropped after a few attempts. Other errors drop it at once.
+ *
+ * Updates replace the A records of a name, so the last client to bind a
+ * name owns it. There is no authentication, the name server has to allow
+ * updates from the address of the server.
+ */
+
+/* Updates queued at most, a power of two */
+#define DDNS_QUEUE 4096
+/* Messages in flight at most */
+#define DDNS_INFLIGHT 16
+/* Messages stay below the EDNS buffer size recommended for UDP */
+#define DDNS_MSG_MAXLEN 1232
+/* Longest name in wire format */
+#define DDNS_NAME_MAXLEN 255
+
+/* Seconds updates are collected before they are sent */
+#define DDNS_DELAY 0.1
+/* Seconds to wait for the first answer, doubled with every attempt */
+#define DDNS_TIMEOUT 1.
+#define DDNS_ATTEMPTS 4
+/* Time to live of the records */
+#define DDNS_TTL 300
+
+struct ddns_update
+{
+	struct in_addr address;
+	bool add;
+	uint8_t name_len;
+	uint8_t name[63];
+
+	/* Next in the hash bucket, queue or free list, UINT32_MAX ends them */
+	uint32_t chain;
+	uint32_t next;
+};
+
+struct ddns_msg
+{
+	/* Waiting for an answer */
+	bool active;
+	uint16_t id;
+	uint8_t attempts;
+	ev_tstamp deadline;
+
+	/* Updates carried, for the statistics */
+	uint32_t updates;
+
+	uint16_t len;
+	uint8_t data[DDNS_MSG_MAXLEN];
+};
+
+struct ddns_stats
+{
+	/* Updates queued, replaced by a later one for the same name and
+	 * address, and dropped because the queue was full
+	 */
+	uint64_t queued;
+	uint64_t coalesced;
+	uint64_t dropped;
+
+	/* Messages sent, including retries */
+	uint64_t sent;
+
+	/* Updates the name server accepted, and those it refused or never
+	 * answered, counted once per zone
+	 */
+	uint64_t acked;
+	uint64_t failed;
+};
+
+struct ddns
+{
+	struct ev_loop *loop;
+	int sock;
+
+	ev_io read_watch;
+	ev_timer flush_watch;
+	ev_timer retry_watch;
+
+	/* Zones in wire format, the reverse zone with the number of leading
+	 * octets its name fixes, which prefix
+	 */
+	uint8_t zone[DDNS_NAME_MAXLEN];
+	size_t zone_len;
+	uint8_t reverse[DDNS_NAME_MAXLEN];
+	size_t reverse_len;
+	uint8_t reverse_octets;
+	uint8_t reverse_prefix[3];
+
+	struct ddns_update updates[DDNS_QUEUE];
+	uint32_t buckets[DDNS_QUEUE];
+	/* Queued updates, oldest first, and free ones */
+	uint32_t head;
+	uint32_t tail;
+	uint32_t free;
+
+	struct ddns_msg msgs[DDNS_INFLIGHT];
+	uint16_t next_id;
+
+	struct ddns_stats stats;
+};
+
+/**
+ * Convert a name to wire format
+ *
+ * @param[in] name Dotted name, a trailing dot is optional
+ * @param[out] wire Name in wire format
+ * @return Length of the name in wire format, 0 if it is invalid
+ */
+extern size_t ddns_name(const char *name, uint8_t wire[DDNS_NAME_MAXLEN]);
+
+/**
+ * Check a reverse zone
+ *
+ * @param[in] name Dotted name below in-addr.arpa, fixing whole octets
+ * @return Whether it is one
+ */
+extern bool ddns_reverse_valid(const char *name);
+
+/**
+ * Open the socket and start watching it
+ *
+ * @param[in] loop Event loop
+ * @param[in] server Address of the name server
+ * @param[in] zone Zone of the host names, checked with ddns_name
+ * @param[in] reverse Reverse zone, checked with ddns_reverse_valid, NULL
+ *                    for none. Only addresses in it get PTR records.
+ * @return The client, or NULL with errno set
+ */
+extern struct ddns *ddns_create(struct ev_loop *loop,
+	const struct sockaddr_in *server, const char *zone, const char *reverse);
+
+extern void ddns_destroy(struct ddns *d);
+
+/**
+ * Queue an update, replacing one queued for the same name and address
+ *
+ * @param[in] d Client
+ * @param[in] name Host name, a single label
+ * @param[in] len Length of the name, 1 to 63
+ * @param[in] address Address of the host, network byte order
+ * @param[in] add Whether to add the records or to delete them
+ * @return Whether it was queued, false if the queue is full
+ */
+extern bool ddns_update(struct ddns *d, const uint8_t *name, size_t len,
+	struct in_addr address, bool add);
@@ -0,0 +1,82 @@
+#include "dedup.h"
+
+#include <stdlib.h>
+
+struct dedup *dedup_create(uint32_t size)
+{
+	uint32_t replies = 1;
+
+	while (replies < size && replies < 1u << 24)
+		replies <<= 1;
+
+	uint32_t slots = replies < DEDUP_WAYS ? DEDUP_WAYS : replies * 2;
+
+	struct dedup *d = calloc(1, sizeof(struct dedup));
+
+	if (d == NULL)
+		return NULL;
+
+	/* calloc leaves every slot empty */
+	d->buckets = calloc(slots / DEDUP_WAYS, sizeof(struct dedup_bucket));
+	d->ring_size = (size_t)replies * DEDUP_RING_PER_REPLY;
+	d->ring = malloc(d->ring_size);
+
+	if (d->buckets == NULL || d->ring == NULL) {
+		dedup_destroy(d);
+		return NULL;
+	}
+
+	d->mask = slots / DEDUP_WAYS - 1;
+
+	return d;
+}
+
+void dedup_destroy(struct dedup *d)
+{
+	free(d->buckets);
+	free(d->ring);
+	free(d);
+}
+
+void dedup_store(struct dedup *d, const uint8_t *buf, size_t len,
+	const struct sockaddr_in *dest)
+{
+	size_t size = (sizeof(struct dedup_reply) + len + 7) & ~(size_t)7;
+
+	if (!d->pending_set || len > DEDUP_DATA_LEN || size > d->ring_size)
+		return;
+
+	/* Records don't wrap, the rest of the ring is skipped instead */
+	size_t off = d->head & (d->ring_size - 1);
+
+	if (off + size > d->ring_size) {
+		d->head += d->ring_size - off;
+		off = 0;
+	}
+
+	struct dedup_reply *r = (struct dedup_reply *)(d->ring + off);
+
+	r->req = d->pending;
+	r->dest = *dest;
+	r->len = len;
+	memcpy(r->data, buf, len);
+
+	/* The slot written longest ago, empty ones have position 0 */
+	struct dedup_bucket *b = dedup_bucket(d, r->req.key.hash, r->req.xid, r->req.type);
+	struct dedup_slot *slot = &b->slots[0];
+
+	for (unsigned i = 1; i < DEDUP_WAYS; ++i)
+		if (b->slots[i].pos < slot->pos)
+			slot = &b->slots[i];
+
+	*slot = (struct dedup_slot){
+		.hash = r->req.key.hash,
+		.xid = r->req.xid,
+		.pos = d->head + 1
+	};
+
+	d->head += size;
+
+	/* One reply per request */
+	d->pending_set = false;
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <netinet/in.h>
+
+#include <ev.h>
+
+#include "ckey.h"
+#include "dhcp.h"
+
+/* Replies to recent requests, so a retransmitted request is answered with
+ * the bytes sent the first time instead of being handled again. A request
+ * is a retransmission if client key, transaction id, message type and flags
+ * match; clients use the same xid for DHCPDISCOVER and DHCPREQUEST, hence
+ * the type. Flags are part of it since a client may set the broadcast bit
+ * when it retries, which changes where a relay agent sends the reply.
+ *
+ * Replies are appended to a ring of bytes, and an index of 4-way buckets
+ * the size of a cache line points into it, so storing a reply is a
+ * sequential write and a lookup touches one line and, on a hit, the reply.
+ * Nothing is allocated after creation. A new request takes the oldest slot
+ * of its bucket, and the ring overwrites the oldest replies. Replies are only
+ * answered from for DEDUP_TIMEOUT seconds, which covers the first
+ * retransmissions of a client (4 s and 8 s, see RFC 2131 section 4.1) but
+ * not a client which starts over.
+ */
+
+#ifndef DEDUP_TIMEOUT
+#define DEDUP_TIMEOUT 10.
+#endif
+
+/* Replies longer than this are not cached, a client has to accept
+ * DHCP_MSG_LEN bytes and most replies are much shorter anyway.
+ */
+#ifndef DEDUP_DATA_LEN
+#define DEDUP_DATA_LEN DHCP_MSG_LEN
+#endif
+
+/* Bytes of ring per reply, a reply with header is about 350 bytes */
+#ifndef DEDUP_RING_PER_REPLY
+#define DEDUP_RING_PER_REPLY 512
+#endif
+
+/* What identifies a request */
+struct dedup_request
+{
+	struct ckey key;
+	uint32_t xid;
+	uint16_t flags;
+	uint8_t type;
+	/* Until when a retransmission is answered */
+	ev_tstamp expires;
+};
+
+/* A reply in the ring, 8 byte aligned */
+struct dedup_reply
+{
+	struct dedup_request req;
+	struct sockaddr_in dest;
+	uint16_t len;
+	uint8_t data[];
+};
+
+struct dedup_slot
+{
+	uint32_t hash;
+	uint32_t xid;
+	/* Ring position of the reply + 1, 0 for an empty slot */
+	uint64_t pos;
+};
+
+#define DEDUP_WAYS 4
+
+struct dedup_bucket
+{
+	struct dedup_slot slots[DEDUP_WAYS];
+};
+
+struct dedup
+{
+	struct dedup_bucket *buckets;
+	uint32_t mask;
+
+	uint8_t *ring;
+	size_t ring_size;
+	/* Bytes ever written to the ring */
+	uint64_t head;
+
+	/* The request being handled, its reply is stored by dedup_store */
+	struct dedup_request pending;
+	bool pending_set;
+
+	uint64_t hits;
+};
+
+/**
+ * Create a cache
+ *
+ * @param[in] size Number of replies, rounded up to a power of two; the
+ *                 index has twice as many slots so few are lost to full
+ *                 buckets
+ * @return The cache, or NULL if it could not be allocated
+ */
+extern struct dedup *dedup_create(uint32_t size);
+
+extern void dedup_destroy(struct dedup *d);
+
+static inline struct dedup_bucket *dedup_bucket(struct dedup *d,
+	uint32_t hash, uint32_t xid, uint8_t type)
+{
+	/* The xid is as random as the hash, or a counter; both are mixed */
+	uint32_t h = hash ^ (xid + type) * 0x85EBCA6B;
+
+	h ^= h >> 16;
+	h *= 0xC2B2AE35;
+	h ^= h >> 13;
+
+	return &d->buckets[h & d->mask];
+}
+
+/**
+ * Find the reply to an earlier transmission of a request
+ *
+ * @param[in] d Cache
+ * @param[in] key Client key of the request
+ * @param[in] xid Transaction id, as in the message
+ * @param[in] type Message type of the request
+ * @param[in] flags Flags field, as in the message
+ * @param[in] now Time the request arrived
+ * @return The reply, valid until the next dedup_store, or NULL if the
+ *         request is not a retransmission of one answered before
+ */
+static inline const struct dedup_reply *dedup_find(struct dedup *d,
+	const struct ckey *key, uint32_t xid, uint8_t type, uint16_t flags,
+	ev_tstamp now)
+{
+	struct dedup_bucket *b = dedup_bucket(d, key->hash, xid, type);
+
+	for (unsigned i = 0; i < DEDUP_WAYS; ++i)
+	{
+		struct dedup_slot *slot = &b->slots[i];
+
+		if (slot->pos == 0 || slot->xid != xid || slot->hash != key->hash)
+			continue;
+
+		/* Not yet overwritten by newer replies? */
+		uint64_t pos = slot->pos - 1;
+
+		if (d->head - pos > d->ring_size)
+			continue;
+
+		const struct dedup_reply *r = (struct dedup_reply *)(d->ring + (pos & (d->ring_size - 1)));
+
+		if (r->req.expires <= now || r->req.type != type || r->req.flags != flags ||
+				!ckey_eq(&r->req.key, key))
+			continue;
+
+		++d->hits;
+
+		return r;
+	}
+
+	return NULL;
+}
+
+/**
+ * Remember the request being handled, so dedup_store knows whose reply it
+ * gets
+ */
+static inline void dedup_begin(struct dedup *d, const struct ckey *key,
+	uint32_t xid, uint8_t type, uint16_t flags, ev_tstamp now)
+{
+	d->pending.key = *key;
+	d->pending.xid = xid;
+	d->pending.type = type;
+	d->pending.flags = flags;
+	d->pending.expires = now + DEDUP_TIMEOUT;
+	d->pending_set = true;
+}
+
+/**
+ * Keep the reply to the request passed to dedup_begin, a reply which does
+ * not fit is not kept
+ */
+extern void dedup_store(struct dedup *d, const uint8_t *buf, size_t len,
+	const struct sockaddr_in *dest);
@@ -4,51 +4,139 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
-static uint32_t netmask_from_prefixlen(uint8_t prefixlen)
+bool dhcp_optab_add(struct dhcp_optab *tab, uint8_t code,
+	const void *data, size_t len)
 {
-	return htonl(0xFFFFFFFFU - (1 << (32 - prefixlen)) + 1);
+	if (code == DHCP_OPT_STUB || code == DHCP_OPT_END)
+		return false;
+
+	if (len > 255 || tab->len + 2 + len > DHCP_OPTAB_LEN)
+		return false;
+
+	if (tab->idx[code].len > 0)
+		return false;
+
+	tab->idx[code].off = tab->len;
+	tab->idx[code].len = len + 2;
+
+	tab->data[tab->len] = code;
+	tab->data[tab->len + 1] = len;
+	memcpy(tab->data + tab->len + 2, data, len);
+
+	tab->len += len + 2;
+
+	return true;
 }
 
-uint8_t *dhcp_opt_add_lease(uint8_t *options, size_t *_send_len, struct dhcp_lease *lease)
+/* The regions an overloaded message puts options into, in the order a
+ * client reads them: options field, file, sname. Each region keeps room for
+ * its END option, the options field additionally for the overload option.
+ */
+static size_t dhcp_opt_encode_overload(uint8_t *msg, size_t len, size_t limit,
+	const struct dhcp_optab *tab, const uint8_t *prl, size_t prl_len)
 {
-	size_t send_len = 0;
+	struct {
+		size_t pos;
+		size_t end;
+	} r[3] = {
+		{ len, limit - 4 },
+		{ DHCP_MSG_F_FILE(msg) - msg, DHCP_MSG_F_MAGIC(msg) - msg - 1 },
+		{ DHCP_MSG_F_SNAME(msg) - msg, DHCP_MSG_F_FILE(msg) - msg - 1 }
+	};
+	uint64_t seen[4] = {0};
+	size_t cnt = prl != NULL ? prl_len : tab->len;
+	size_t k = 0;
 
-	if (lease->prefixlen > 0)
+	for (size_t i = 0; i < cnt; )
 	{
-		options[0] = DHCP_OPT_NETMASK;
-		options[1] = 4;
-		ARRAY_COPY((options + 2), (uint8_t*)((uint32_t[]){netmask_from_prefixlen(lease->prefixlen)}), 4);
-		DHCP_OPT_CONT(options, send_len);
+		uint8_t code;
+
+		if (prl != NULL) {
+			code = prl[i++];
+		} else {
+			code = tab->data[i];
+			i += tab->idx[code].len;
+		}
+
+		if (tab->idx[code].len == 0 || seen[code / 64] & (1ULL << (code % 64)))
+			continue;
+		seen[code / 64] |= 1ULL << (code % 64);
+
+		/* Options are never moved back to an earlier region, so the client
+		 * sees them in the requested order. Options which do not fit
+		 * anywhere are left out.
+		 */
+		for (size_t j = k; j < 3; ++j)
+			if (r[j].pos + tab->idx[code].len <= r[j].end)
+			{
+				memcpy(msg + r[j].pos, tab->data + tab->idx[code].off, tab->idx[code].len);
+				r[j].pos += tab->idx[code].len;
+				k = j;
+				break;
+			}
 	}
 
-	if (lease->routers_cnt > 0)
-	{
-		options[0] = DHCP_OPT_ROUTER;
-		options[1] = lease->routers_cnt * 4;
-		for (size_t i = 0; i < lease->routers_cnt; ++i)
-			*(struct in_addr *)(options + 2 + (i * 4)) = lease->routers[i];
-		DHCP_OPT_CONT(options, send_len);
+	uint8_t overload = 0;
+
+	if (r[1].pos > (size_t)(DHCP_MSG_F_FILE(msg) - msg)) {
+		msg[r[1].pos] = DHCP_OPT_END;
+		overload |= 1;
 	}
 
-	if (lease->leasetime > 0)
-	{
-		options[0] = DHCP_OPT_LEASETIME;
-		options[1] = 4;
-		*(uint32_t*)(options + 2) = htonl(lease->leasetime);
-		DHCP_OPT_CONT(options, send_len);
+	if (r[2].pos > (size_t)(DHCP_MSG_F_SNAME(msg) - msg)) {
+		msg[r[2].pos] = DHCP_OPT_END;
+		overload |= 2;
 	}
 
-	if (lease->nameservers_cnt > 0)
-	{
-		options[0] = DHCP_OPT_DNS;
-		options[1] = lease->nameservers_cnt * 4;
-		for (size_t i = 0; i < lease->nameservers_cnt; ++i)
-			*(struct in_addr *)(options + 2 + (i * 4)) = lease->nameservers[i];
-		DHCP_OPT_CONT(options, send_len);
+	len = r[0].pos;
+
+	if (overload) {
+		msg[len++] = DHCP_OPT_OVERLOAD;
+		msg[len++] = 1;
+		msg[len++] = overload;
+	}
+
+	msg[len++] = DHCP_OPT_END;
+
+	return len;
+}
+
+size_t dhcp_opt_encode(uint8_t *msg, size_t len, size_t limit,
+	const struct dhcp_optab *tab, const uint8_t *prl, size_t prl_len)
+{
+	uint64_t seen[4] = {0};
+	bool dup = false;
+	size_t total = 0;
+
+	if (prl == NULL)
+		total = tab->len;
+	else
+		for (size_t i = 0; i < prl_len; ++i)
+		{
+			dup |= (seen[prl[i] / 64] & (1ULL << (prl[i] % 64))) != 0;
+			seen[prl[i] / 64] |= 1ULL << (prl[i] % 64);
+			total += tab->idx[prl[i]].len;
+		}
+
+	/* A client which repeats codes in its list gets them deduplicated by the
+	 * slow path, anything else fitting into the options field is a plain
+	 * sequence of copies from the table.
+	 */
+	if (dup || len + total + 1 > limit)
+		return dhcp_opt_encode_overload(msg, len, limit, tab, prl, prl_len);
+
+	if (prl == NULL) {
+		memcpy(msg + len, tab->data, tab->len);
+		len += tab->len;
+	} else {
+		for (size_t i = 0; i < prl_len; ++i)
+		{
+			memcpy(msg + len, tab->data + tab->idx[prl[i]].off, tab->idx[prl[i]].len);
+			len += tab->idx[prl[i]].len;
+		}
 	}
 
-	if (_send_len != NULL)
-		*_send_len += send_len;
+	msg[len++] = DHCP_OPT_END;
 
-	return options;
+	return len;
 }
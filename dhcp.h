@@ -10,6 +10,7 @@
 #include <netinet/in.h>
 
 #include "array.h"
+#include "ckey.h"
 
 /* A DHCP message consists of a fixed-length header and a variable-length
  * option part:
@@ -62,8 +63,13 @@
 #define DHCP_MSG_F_MAGIC(m)   ((uint8_t*)((m)+236))
 #define DHCP_MSG_F_OPTIONS(m) ((uint8_t*)((m)+240))
 
+#define DHCP_MSG_F_SNAME(m)   ((uint8_t*)((m)+44))
+#define DHCP_MSG_F_FILE(m)    ((uint8_t*)((m)+108))
+
 #define DHCP_MSG_LEN    (576)
 #define DHCP_MSG_HDRLEN (240)
+/* Largest message we send, an ethernet frame without IP and UDP header */
+#define DHCP_MSG_MAXLEN (1500 - 28)
 #define DHCP_MSG_MAGIC  ((uint8_t[]){ 99, 130, 83, 99 })
 
 #define DHCP_MSG_MAGIC_CHECK(m) (m[0] == 99 && m[1] == 130 && m[2] == 83 && m[3] == 99)
@@ -90,10 +96,20 @@ enum dhcp_opt_type
 	DHCP_OPT_NETMASK = 1,
 	DHCP_OPT_ROUTER = 3,
 	DHCP_OPT_DNS = 6,
+	DHCP_OPT_HOSTNAME = 12,
 	DHCP_OPT_REQIPADDR = 50,
 	DHCP_OPT_LEASETIME = 51,
+	DHCP_OPT_OVERLOAD = 52,
 	DHCP_OPT_MSGTYPE = 53,
 	DHCP_OPT_SERVERID = 54,
+	DHCP_OPT_PARAMLIST = 55,
+	DHCP_OPT_MAXMSGSIZE = 57,
+	DHCP_OPT_RENEWALTIME = 58,
+	DHCP_OPT_REBINDTIME = 59,
+	DHCP_OPT_CLIENTID = 61,
+	DHCP_OPT_RAPIDCOMMIT = 80,
+	DHCP_OPT_CLIENTFQDN = 81,
+	DHCP_OPT_RELAYINFO = 82,
 	DHCP_OPT_END = 255
 };
 
@@ -127,7 +143,43 @@ struct dhcp_msg
 	struct in_addr yiaddr;
 	struct in_addr siaddr;
 	struct in_addr giaddr;
-	uint8_t chaddr[16];
+	/* Client identifier (61) or hardware address, see ckey_make */
+	struct ckey key;
+	/* Client identifier (61), NULL if the client sent none */
+	uint8_t *clientid;
+	size_t clientid_len;
+
+	/* Parameter Request List (55), NULL if the client sent none */
+	uint8_t *prl;
+	size_t prl_len;
+	/* Maximum DHCP message size (57), 0 if the client sent none */
+	uint16_t maxsize;
+	/* The client asked for Rapid Commit (80) */
+	bool rapid_commit;
+	/* The address of the client's lease was probed already */
+	bool probed;
+
+	/* Host Name (12) or, preferred, Client FQDN (81) without its flags,
+	 * NULL if the client sent neither
+	 */
+	uint8_t *hostname;
+	size_t hostname_len;
+	/* The name is in DNS wire format, see RFC 4702 section 2.3.1 */
+	bool hostname_wire;
+
+	/* Requested IP address (50) and server identifier (54), network byte
+	 * order, INADDR_ANY if the client sent none
+	 */
+	struct in_addr reqaddr;
+	struct in_addr server_id;
+
+	/* Relay agent information (82), NULL if the relay sent none */
+	uint8_t *relay;
+	size_t relay_len;
+	/* Id of the relay agent information if an address is pinned to it, 0
+	 * otherwise
+	 */
+	uint16_t relay_id;
 
 	struct sockaddr *source;
 	struct sockaddr_in *sid;
@@ -137,26 +189,39 @@ struct dhcp_lease
 {
 	struct in_addr address;
 
-	struct in_addr *routers;
-	size_t routers_cnt;
-
-	struct in_addr *nameservers;
-	size_t nameservers_cnt;
-
 	ev_tstamp leasetime;
-	uint8_t prefixlen;
+	/* Renewal (T1) and rebinding (T2) time, 0 to leave them to the client */
+	ev_tstamp renewal;
+	ev_tstamp rebinding;
 };
 
 #define DHCP_LEASE_EMPTY {\
 		.address = {INADDR_ANY},\
-		.routers = NULL,\
-		.routers_cnt = 0,\
-		.nameservers = NULL,\
-		.nameservers_cnt = 0,\
 		.leasetime = 0,\
-		.prefixlen = 0\
+		.renewal = 0,\
+		.rebinding = 0\
 	}
 
+#ifndef DHCP_OPTAB_LEN
+#define DHCP_OPTAB_LEN 1024
+#endif
+
+/* Table of pre-encoded options. data holds the complete options, code,
+ * length and value, in the order they were added, and idx locates each
+ * option in data by its code. An option with idx[code].len == 0 is not
+ * present.
+ */
+struct dhcp_optab
+{
+	uint8_t data[DHCP_OPTAB_LEN];
+	size_t len;
+
+	struct {
+		uint16_t off;
+		uint16_t len;
+	} idx[256];
+};
+
 /**
  * Prepare new DHCP message from a specified DHCP message
  *
@@ -202,7 +267,7 @@ static inline void dhcp_msg_reply(uint8_t *reply, uint8_t **options,
 #define dhcp_opt_insert_val(buf, buf_len, send_len, opt, type, vtype, value) \
 	do { vtype v = value; dhcp_opt_insert(buf, buf_len, send_len, opt, type, sizeof(vtype), (uint8_t *)(&(v))); } while(0)
 
-static inline bool dhcp_opt_insert(uint8_t *buf, size_t buf_len, size_t *send_len, uint8_t **opt, enum dhcp_msg_type type, size_t data_len, uint8_t *data)
+static inline bool dhcp_opt_insert(uint8_t *buf, size_t buf_len, size_t *send_len, uint8_t **opt, enum dhcp_opt_type type, size_t data_len, uint8_t *data)
 {
 	if(!buf || !*buf || !opt | !*opt) {
 		return false;
@@ -253,6 +318,32 @@ static inline bool dhcp_opt_next(uint8_t **cur, struct dhcp_opt *opt, uint8_t *e
 	return true;
 }
 
-extern uint8_t *dhcp_opt_add_lease(uint8_t *options,
-	size_t *send_len,
-	struct dhcp_lease *lease);
+/**
+ * Add an option to a table of pre-encoded options
+ *
+ * @param[out] tab Option table
+ * @param[in] code Option code
+ * @param[in] data Option value
+ * @param[in] len Length of the option value
+ */
+extern bool dhcp_optab_add(struct dhcp_optab *tab, uint8_t code,
+	const void *data, size_t len);
+
+/**
+ * Append options from a table to a message and terminate the option list
+ *
+ * Without a Parameter Request List all options of the table are appended in
+ * the order they were added, otherwise the requested options are appended in
+ * the order the client asked for them. If the options do not fit into limit,
+ * the sname and file fields are used as well (option overload).
+ *
+ * @param[in,out] msg Message whose options start at DHCP_MSG_HDRLEN
+ * @param[in] len Current length of msg, options up to len are kept
+ * @param[in] limit Maximum length of msg
+ * @param[in] tab Option table
+ * @param[in] prl Parameter Request List or NULL
+ * @param[in] prl_len Length of prl
+ * @return New length of msg
+ */
+extern size_t dhcp_opt_encode(uint8_t *msg, size_t len, size_t limit,
+	const struct dhcp_optab *tab, const uint8_t *prl, size_t prl_len);
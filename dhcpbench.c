@@ -0,0 +1,744 @@
+/* In-process benchmark of the message handlers
+ *
+ * Micro-benchmarks time the building blocks of the hot path one by one.
+ * Then synthetic clients run DORA, with every DISCOVER sent twice, RENEW,
+ * INFORM and RELEASE against a server which is fed from memory instead of a
+ * socket, with a virtual clock. No privileges, interfaces or ports are
+ * needed, and nothing but the handlers is measured.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "array.h"
+#include "dhcp.h"
+#include "argv.h"
+#include "error.h"
+#include "config.h"
+#include "server.h"
+
+/* Room for each synthetic message, they are all well below */
+#define BENCH_SLOT_LEN 320
+
+/* Every BENCH_RELAY_EVERY-th client is behind a relay agent */
+#define BENCH_RELAY_EVERY 8
+
+struct config cfg = CONFIG_EMPTY;
+
+struct server server = SERVER_EMPTY;
+
+static const char USAGE[] =
+"%s [dhcpd options] [-- [CLIENTS [ROUNDS]] [NAME=VALUE]...]\n"
+"\tRun the micro-benchmarks, then each of CLIENTS clients (default 50000)\n"
+"\tsends DISCOVER, REQUEST, INFORM and RELEASE, ROUNDS (default 10) times.\n"
+"\tjson=FILE       Write the results as JSON to FILE\n"
+"\tbaseline=FILE   Compare to results written before, fail on regressions\n"
+"\tthreshold=PCT   Slowdown which counts as regression (default 10)\n"
+"\titers=N         Iterations of each micro-benchmark\n";
+
+/* Allocations are counted by wrapping the allocator of the C library */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t bench_allocs = 0;
+
+void *malloc(size_t size)
+{
+	++bench_allocs;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	++bench_allocs;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	++bench_allocs;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+enum bench_phase
+{
+	BENCH_DISCOVER = 0,
+	/* The same DHCPDISCOVER again, as if the offers got lost */
+	BENCH_RETRANSMIT,
+	BENCH_REQUEST,
+	/* DHCPREQUEST of a RENEWING client, with ciaddr only */
+	BENCH_RENEW,
+	BENCH_INFORM,
+	BENCH_RELEASE,
+	BENCH_PHASES
+};
+
+static const char *bench_names[BENCH_PHASES] = {
+	"discover", "retransmit", "request", "renew", "inform", "release"
+};
+
+static const enum dhcp_msg_type bench_types[BENCH_PHASES] = {
+	DHCPDISCOVER, DHCPDISCOVER, DHCPREQUEST, DHCPREQUEST, DHCPINFORM, DHCPRELEASE
+};
+
+struct bench_stats
+{
+	uint64_t packets;
+	uint64_t replies;
+	uint64_t allocs;
+	uint64_t ns;
+	/* Fastest round, which is less noisy than the mean */
+	uint64_t best_ns;
+	uint64_t best_packets;
+};
+
+struct bench
+{
+	uint32_t clients;
+
+	/* One message per client, BENCH_SLOT_LEN bytes apart */
+	uint8_t *msgs;
+	uint16_t *lens;
+
+	/* Address offered to each client, network byte order */
+	uint32_t *offered;
+
+	uint64_t replies;
+
+	struct bench_stats stats[BENCH_PHASES];
+};
+
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Sink of the server, keeps the offered address of each client
+ */
+static bool bench_send(void *ctx, const uint8_t *buf, size_t len, const struct sockaddr_in *dest)
+{
+	struct bench *b = (struct bench *)ctx;
+	uint32_t i = ntohl(*DHCP_MSG_F_XID(buf));
+
+	(void)len;
+	(void)dest;
+
+	++b->replies;
+
+	/* The message type is always the first option of our replies */
+	if (DHCP_MSG_F_OPTIONS(buf)[2] == DHCPOFFER && i < b->clients)
+		b->offered[i] = *DHCP_MSG_F_YIADDR(buf);
+
+	return true;
+}
+
+/**
+ * Build the message of a phase for client i
+ */
+static size_t bench_msg(struct bench *b, enum bench_phase phase, uint32_t i, uint8_t *buf)
+{
+	size_t send_len = DHCP_MSG_HDRLEN;
+	uint32_t addr = b->offered[i];
+
+	memset(buf, 0, DHCP_MSG_HDRLEN);
+	*DHCP_MSG_F_OP(buf) = 1;
+	*DHCP_MSG_F_HTYPE(buf) = 1;
+	*DHCP_MSG_F_HLEN(buf) = 6;
+	*DHCP_MSG_F_XID(buf) = htonl(i);
+	ARRAY_COPY(DHCP_MSG_F_MAGIC(buf), DHCP_MSG_MAGIC, 4);
+
+	uint8_t *chaddr = (uint8_t *)DHCP_MSG_F_CHADDR(buf);
+
+	chaddr[0] = 0x02;
+	chaddr[2] = i >> 24;
+	chaddr[3] = i >> 16;
+	chaddr[4] = i >> 8;
+	chaddr[5] = i;
+
+	if (phase == BENCH_RENEW || phase == BENCH_INFORM || phase == BENCH_RELEASE)
+		*DHCP_MSG_F_CIADDR(buf) = addr;
+
+	uint8_t *options = DHCP_MSG_F_OPTIONS(buf);
+
+	options[0] = DHCP_OPT_MSGTYPE;
+	options[1] = 1;
+	options[2] = bench_types[phase];
+	DHCP_OPT_CONT(options, send_len);
+
+	if (phase == BENCH_REQUEST) {
+		options[0] = DHCP_OPT_REQIPADDR;
+		options[1] = 4;
+		memcpy(options + 2, &addr, 4);
+		DHCP_OPT_CONT(options, send_len);
+	}
+
+	if (phase == BENCH_REQUEST || phase == BENCH_RELEASE) {
+		options[0] = DHCP_OPT_SERVERID;
+		options[1] = 4;
+		memcpy(options + 2, &server.id.sin_addr, 4);
+		DHCP_OPT_CONT(options, send_len);
+	}
+
+	if (phase != BENCH_RELEASE) {
+		options[0] = DHCP_OPT_PARAMLIST;
+		options[1] = 3;
+		options[2] = DHCP_OPT_NETMASK;
+		options[3] = DHCP_OPT_ROUTER;
+		options[4] = DHCP_OPT_DNS;
+		DHCP_OPT_CONT(options, send_len);
+	}
+
+	if (i % BENCH_RELAY_EVERY == 0) {
+		*DHCP_MSG_F_HOPS(buf) = 1;
+		*DHCP_MSG_F_GIADDR(buf) = htonl(0xC0000201);
+
+		options[0] = DHCP_OPT_RELAYINFO;
+		options[1] = 4;
+		options[2] = 1;
+		options[3] = 2;
+		options[4] = i >> 8;
+		options[5] = i;
+		DHCP_OPT_CONT(options, send_len);
+	}
+
+	options[0] = DHCP_OPT_END;
+	DHCP_OPT_CONT(options, send_len);
+
+	return send_len;
+}
+
+/**
+ * Build the messages of a phase for all clients, then feed them to the
+ * server and measure it
+ */
+static void bench_phase(struct bench *b, enum bench_phase phase, ev_tstamp *now)
+{
+	struct bench_stats *stats = &b->stats[phase];
+	struct sockaddr_in client = {
+		.sin_family = AF_INET,
+		.sin_port = htons(68),
+		.sin_addr = {INADDR_ANY}
+	};
+	struct sockaddr_in relay = {
+		.sin_family = AF_INET,
+		.sin_port = htons(67),
+		.sin_addr = {htonl(0xC0000201)}
+	};
+
+	for (uint32_t i = 0; i < b->clients; ++i)
+		b->lens[i] = bench_msg(b, phase, i, b->msgs + (size_t)i * BENCH_SLOT_LEN);
+
+	uint64_t replies = b->replies;
+	uint64_t allocs = bench_allocs;
+	uint64_t start = bench_ns();
+
+	for (uint32_t i = 0; i < b->clients; ++i)
+	{
+		*now += 1e-6;
+
+		server_handle(&server, b->msgs + (size_t)i * BENCH_SLOT_LEN, b->lens[i],
+			i % BENCH_RELAY_EVERY == 0 ? &relay : &client, *now);
+	}
+
+	uint64_t ns = bench_ns() - start;
+
+	if (stats->best_packets == 0 || ns < stats->best_ns) {
+		stats->best_ns = ns;
+		stats->best_packets = b->clients;
+	}
+
+	stats->ns += ns;
+	stats->allocs += bench_allocs - allocs;
+	stats->replies += b->replies - replies;
+	stats->packets += b->clients;
+}
+
+/* Micro-benchmarks run each function this often, BENCH_MICRO_REPEAT times,
+ * and keep the fastest run
+ */
+#define BENCH_MICRO_ITERS (1 << 20)
+#define BENCH_MICRO_REPEAT 5
+#define BENCH_MICRO_SIZE 65536
+
+#define BENCH_RESULTS_MAX 32
+
+/* Result of a benchmark, as written to and read from the JSON file */
+struct bench_result
+{
+	char name[32];
+	double ns;
+	double allocs;
+};
+
+static struct bench_result results[BENCH_RESULTS_MAX];
+static size_t results_cnt = 0;
+
+/* State of the micro-benchmarks */
+static struct {
+	uint8_t msg[BENCH_SLOT_LEN];
+	size_t msg_len;
+	uint8_t buf[DHCP_MSG_MAXLEN];
+	struct pool *pool;
+	struct lease_table *leases;
+	struct ckey *keys;
+	struct ckey *misses;
+} micro;
+
+/* Results of the micro-benchmarks end up here, so they are not optimized
+ * away
+ */
+static volatile uint64_t bench_sink;
+
+static void bench_result(const char *name, double ns, double allocs)
+{
+	if (results_cnt == BENCH_RESULTS_MAX)
+		return;
+
+	snprintf(results[results_cnt].name, sizeof results[0].name, "%s", name);
+	results[results_cnt].ns = ns;
+	results[results_cnt].allocs = allocs;
+	++results_cnt;
+}
+
+static void bench_report(const char *name, struct bench_stats *stats)
+{
+	char result[32];
+
+	printf("%-9s %10llu %10llu %12.0f %8.1f %10.3f\n", name,
+		(unsigned long long)stats->packets,
+		(unsigned long long)stats->replies,
+		stats->ns > 0 ? stats->packets * 1e9 / stats->ns : 0.,
+		stats->packets > 0 ? (double)stats->ns / stats->packets : 0.,
+		stats->packets > 0 ? (double)stats->allocs / stats->packets : 0.);
+
+	snprintf(result, sizeof result, "macro.%s", name);
+	bench_result(result,
+		stats->best_packets > 0 ? (double)stats->best_ns / stats->best_packets : 0.,
+		stats->packets > 0 ? (double)stats->allocs / stats->packets : 0.);
+}
+
+/**
+ * Walk the options of a request, as server_handle does
+ */
+static uint64_t micro_opt_parse(uint32_t iters)
+{
+	uint64_t sum = 0;
+
+	for (uint32_t i = 0; i < iters; ++i)
+	{
+		uint8_t *options = DHCP_MSG_F_OPTIONS(micro.msg);
+		struct dhcp_opt opt;
+
+		while (dhcp_opt_next(&options, &opt, micro.msg + micro.msg_len))
+			sum += opt.code + opt.len;
+	}
+
+	return sum;
+}
+
+/**
+ * Encode the scope options in the order of a Parameter Request List
+ */
+static uint64_t micro_opt_encode(uint32_t iters)
+{
+	static const uint8_t prl[] = { DHCP_OPT_NETMASK, DHCP_OPT_ROUTER, DHCP_OPT_DNS };
+	uint64_t sum = 0;
+
+	for (uint32_t i = 0; i < iters; ++i)
+		sum += dhcp_opt_encode(micro.buf, DHCP_MSG_HDRLEN + 3, DHCP_MSG_LEN,
+			&server.scope.opts, prl, sizeof prl);
+
+	return sum;
+}
+
+static uint64_t micro_ckey_make(uint32_t iters)
+{
+	uint8_t chaddr[16] = { 0x02 };
+	struct ckey key;
+	uint64_t sum = 0;
+
+	for (uint32_t i = 0; i < iters; ++i)
+	{
+		memcpy(chaddr + 2, &i, 4);
+		ckey_make(&key, server.clientids, NULL, 0, 1, 6, chaddr);
+		sum += key.hash;
+	}
+
+	return sum;
+}
+
+static uint64_t micro_pool_get(uint32_t iters)
+{
+	struct in_addr address;
+	uint64_t sum = 0;
+
+	for (uint32_t i = 0; i < iters; ++i)
+	{
+		pool_get(micro.pool, &address);
+		pool_add(micro.pool, address);
+		sum += address.s_addr;
+	}
+
+	return sum;
+}
+
+static uint64_t micro_pool_get_hash(uint32_t iters)
+{
+	struct in_addr address;
+	uint64_t sum = 0;
+
+	for (uint32_t i = 0; i < iters; ++i)
+	{
+		pool_get_hash(micro.pool, i * 2654435761U, &address);
+		pool_add(micro.pool, address);
+		sum += address.s_addr;
+	}
+
+	return sum;
+}
+
+static uint64_t micro_lease_find(uint32_t iters)
+{
+	uint64_t sum = 0;
+
+	for (uint32_t i = 0; i < iters; ++i)
+		sum += lease_find(micro.leases, &micro.keys[i % BENCH_MICRO_SIZE]) != NULL;
+
+	return sum;
+}
+
+static uint64_t micro_lease_miss(uint32_t iters)
+{
+	uint64_t sum = 0;
+
+	for (uint32_t i = 0; i < iters; ++i)
+		sum += lease_find(micro.leases, &micro.misses[i % BENCH_MICRO_SIZE]) == NULL;
+
+	return sum;
+}
+
+static void bench_micro_init(struct bench *b)
+{
+	struct in_addr first = { htonl(0x0A010000) };
+	struct in_addr last = { htonl(0x0A010000 + BENCH_MICRO_SIZE - 1) };
+
+	micro.msg_len = bench_msg(b, BENCH_REQUEST, 0, micro.msg);
+	memcpy(micro.buf, micro.msg, DHCP_MSG_HDRLEN);
+
+	micro.pool = pool_create(first, last);
+	micro.leases = lease_table_create(first, last);
+	micro.keys = calloc(BENCH_MICRO_SIZE, sizeof(struct ckey));
+	micro.misses = calloc(BENCH_MICRO_SIZE, sizeof(struct ckey));
+
+	if (micro.pool == NULL || micro.leases == NULL || micro.keys == NULL || micro.misses == NULL)
+		dhcpd_error(1, errno, "Could not allocate micro-benchmarks");
+
+	for (uint32_t i = 0; i < BENCH_MICRO_SIZE; ++i)
+	{
+		uint8_t chaddr[16] = { 0x02, 0x01 };
+		struct in_addr address = { htonl(ntohl(first.s_addr) + i) };
+
+		pool_add(micro.pool, address);
+
+		memcpy(chaddr + 2, &i, 4);
+		ckey_make(&micro.keys[i], NULL, NULL, 0, 1, 6, chaddr);
+		lease_assign(micro.leases, lease_at(micro.leases, address), &micro.keys[i]);
+
+		chaddr[1] = 0x02;
+		ckey_make(&micro.misses[i], NULL, NULL, 0, 1, 6, chaddr);
+	}
+}
+
+static void bench_micro_free(void)
+{
+	pool_destroy(micro.pool);
+	lease_table_destroy(micro.leases);
+	free(micro.keys);
+	free(micro.misses);
+}
+
+static void bench_micro(const char *name, uint64_t (*fn)(uint32_t), uint32_t iters)
+{
+	char result[32];
+	uint64_t best = UINT64_MAX;
+	uint64_t allocs = bench_allocs;
+
+	for (int r = 0; r < BENCH_MICRO_REPEAT; ++r)
+	{
+		uint64_t start = bench_ns();
+
+		bench_sink += fn(iters);
+
+		uint64_t ns = bench_ns() - start;
+
+		if (ns < best)
+			best = ns;
+	}
+
+	allocs = bench_allocs - allocs;
+
+	printf("%-16s %12u %8.2f %10.3f\n", name, iters, (double)best / iters,
+		(double)allocs / iters / BENCH_MICRO_REPEAT);
+
+	snprintf(result, sizeof result, "micro.%s", name);
+	bench_result(result, (double)best / iters, (double)allocs / iters / BENCH_MICRO_REPEAT);
+}
+
+/**
+ * Write all results as JSON, one benchmark per line
+ */
+static void bench_json(const char *path)
+{
+	FILE *file = fopen(path, "w");
+
+	if (file == NULL)
+		dhcpd_error(1, errno, "Could not write %s", path);
+
+	fprintf(file, "{\n\t\"benchmarks\": [\n");
+
+	for (size_t i = 0; i < results_cnt; ++i)
+		fprintf(file, "\t\t{\"name\": \"%s\", \"ns_per_op\": %.3f, \"allocs_per_op\": %.4f}%s\n",
+			results[i].name, results[i].ns, results[i].allocs,
+			i + 1 < results_cnt ? "," : "");
+
+	fprintf(file, "\t]\n}\n");
+
+	if (fclose(file) != 0)
+		dhcpd_error(1, errno, "Could not write %s", path);
+}
+
+/**
+ * Compare the results to a baseline written by bench_json. Time is noisy,
+ * so only a slowdown beyond the threshold counts, while allocations are
+ * exact and any additional one counts.
+ *
+ * @param[in] path Baseline
+ * @param[in] threshold Slowdown in percent which counts as a regression
+ * @return Number of regressions
+ */
+static size_t bench_compare(const char *path, double threshold)
+{
+	FILE *file = fopen(path, "r");
+	char line[256];
+	size_t regressions = 0;
+
+	if (file == NULL)
+		dhcpd_error(1, errno, "Could not read baseline %s", path);
+
+	printf("\n%-20s %10s %10s %8s\n", "benchmark", "baseline", "ns/op", "change");
+
+	while (fgets(line, sizeof line, file) != NULL)
+	{
+		char name[32];
+		double ns, allocs;
+
+		if (sscanf(line, " {\"name\": \"%31[^\"]\", \"ns_per_op\": %lf, \"allocs_per_op\": %lf",
+				name, &ns, &allocs) != 3)
+			continue;
+
+		for (size_t i = 0; i < results_cnt; ++i)
+		{
+			if (strcmp(results[i].name, name) != 0)
+				continue;
+
+			double change = ns > 0 ? (results[i].ns - ns) / ns * 100 : 0;
+			bool slower = change > threshold;
+			bool allocating = results[i].allocs > allocs + 0.0001;
+
+			regressions += slower || allocating;
+
+			printf("%-20s %10.2f %10.2f %+7.1f%%%s%s\n", name, ns, results[i].ns, change,
+				slower ? " SLOWER" : "", allocating ? " ALLOCATES" : "");
+		}
+	}
+
+	fclose(file);
+
+	return regressions;
+}
+
+int main(int argc, char **argv)
+{
+	struct argv argv_cfg = ARGV_EMPTY;
+	int optc = 1;
+
+	/* dhcpd options up to --, our own after it */
+	while (optc < argc && strcmp(argv[optc], "--") != 0)
+		++optc;
+
+	if (!argv_parse(optc, argv, &argv_cfg))
+	{
+		if (argv_cfg.argerror == -1)
+			dhcpd_error(1, 0, "Unexpected argument list end");
+		else
+			dhcpd_error(1, 0, "Unexpected argument %s", argv_cfg.argv[argv_cfg.argerror]);
+	}
+
+	if (argv_cfg.help)
+	{
+		printf(USAGE, argv_cfg.arg0);
+		exit(0);
+	}
+
+	if (!config_fill(&cfg, &argv_cfg))
+		dhcpd_error(1, 0, cfg.error);
+
+	struct bench b = { .clients = 50000 };
+	uint32_t rounds = 10;
+	uint32_t iters = BENCH_MICRO_ITERS;
+	const char *json = NULL;
+	const char *baseline = NULL;
+	double threshold = 10;
+	int pos = 0;
+
+	for (int i = optc + 1; i < argc; ++i)
+	{
+		char *val = strchr(argv[i], '=');
+
+		if (val == NULL) {
+			if (pos++ == 0)
+				b.clients = atoi(argv[i]);
+			else
+				rounds = atoi(argv[i]);
+			continue;
+		}
+
+		*val++ = 0;
+
+		if (!strcmp(argv[i], "json"))
+			json = val;
+		else if (!strcmp(argv[i], "baseline"))
+			baseline = val;
+		else if (!strcmp(argv[i], "threshold"))
+			threshold = atof(val);
+		else if (!strcmp(argv[i], "iters"))
+			iters = atoi(val);
+		else
+			dhcpd_error(1, 0, "Unknown argument %s", argv[i]);
+	}
+
+	if (b.clients == 0 || iters == 0)
+		dhcpd_error(1, 0, "Invalid number of clients or iterations");
+
+	/* Without a range every client gets an address, with some to spare */
+	if (argv_cfg.iprange[0] == NULL)
+		cfg.iprange[0].s_addr = htonl(0x0A000001);
+	if (argv_cfg.iprange[1] == NULL)
+		cfg.iprange[1].s_addr = htonl(ntohl(cfg.iprange[0].s_addr) + b.clients + b.clients / 4);
+
+	/* Replies carry a router and nameservers, like in most networks */
+	if (cfg.routers_cnt == 0) {
+		cfg.routers = realloc(cfg.routers, ++cfg.routers_cnt * sizeof(struct in_addr));
+		cfg.routers[0].s_addr = htonl(0x0A000001);
+	}
+
+	if (cfg.nameservers_cnt == 0) {
+		cfg.nameservers = realloc(cfg.nameservers, (cfg.nameservers_cnt = 2) * sizeof(struct in_addr));
+		cfg.nameservers[0].s_addr = htonl(0x0A000002);
+		cfg.nameservers[1].s_addr = htonl(0x0A000003);
+	}
+
+	/* Every client has to fit into the cache for the retransmissions */
+	if (argv_cfg.dedup == NULL && cfg.dedup < b.clients)
+		cfg.dedup = b.clients;
+
+	if (!server_init(&server, &cfg))
+		dhcpd_error(1, errno, "Could not allocate address pool and leases");
+
+	server.id.sin_addr.s_addr = htonl(0xC0000001);
+	server.sink.send = bench_send;
+	server.sink.ctx = &b;
+
+	b.msgs = malloc((size_t)b.clients * BENCH_SLOT_LEN);
+	b.lens = calloc(b.clients, sizeof(uint16_t));
+	b.offered = calloc(b.clients, sizeof(uint32_t));
+
+	if (b.msgs == NULL || b.lens == NULL || b.offered == NULL)
+		dhcpd_error(1, errno, "Could not allocate messages");
+
+	bench_micro_init(&b);
+
+	printf("%-16s %12s %8s %10s\n", "micro", "iterations", "ns/op", "allocs/op");
+
+	bench_micro("opt_parse", micro_opt_parse, iters);
+	bench_micro("opt_encode", micro_opt_encode, iters);
+	bench_micro("ckey_make", micro_ckey_make, iters);
+	bench_micro("pool_get", micro_pool_get, iters);
+	bench_micro("pool_get_hash", micro_pool_get_hash, iters);
+	bench_micro("lease_find", micro_lease_find, iters);
+	bench_micro("lease_miss", micro_lease_miss, iters);
+
+	bench_micro_free();
+
+	ev_tstamp now = 0;
+
+	for (uint32_t r = 0; r < rounds; ++r)
+	{
+		for (enum bench_phase p = 0; p < BENCH_PHASES; ++p)
+			bench_phase(&b, p, &now);
+
+		server_expire(&server, now);
+
+		/* Clients reuse their xid, which must not look like a
+		 * retransmission in the next round
+		 */
+		now += DEDUP_TIMEOUT;
+	}
+
+	struct bench_stats total = {0};
+
+	printf("\n%-9s %10s %10s %12s %8s %10s\n",
+		"type", "packets", "replies", "packets/s", "ns/pkt", "allocs/pkt");
+
+	for (enum bench_phase p = 0; p < BENCH_PHASES; ++p)
+	{
+		bench_report(bench_names[p], &b.stats[p]);
+
+		total.packets += b.stats[p].packets;
+		total.replies += b.stats[p].replies;
+		total.allocs += b.stats[p].allocs;
+		total.ns += b.stats[p].ns;
+		total.best_ns += b.stats[p].best_ns;
+		total.best_packets += b.stats[p].best_packets;
+	}
+
+	bench_report("total", &total);
+
+	if (json != NULL)
+		bench_json(json);
+
+	size_t regressions = baseline != NULL ? bench_compare(baseline, threshold) : 0;
+
+	if (regressions > 0)
+		printf("%zu benchmarks regressed against the baseline\n", regressions);
+
+	free(b.msgs);
+	free(b.lens);
+	free(b.offered);
+
+	server_free(&server);
+	config_free(&cfg);
+	argv_free(&argv_cfg);
+
+	return regressions > 0 ? 1 : 0;
+}
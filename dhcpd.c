@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <errno.h>
 #include <time.h>
+#include <inttypes.h>
+#include <signal.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -34,8 +36,15 @@
 #include "error.h"
 #include "config.h"
 #include "iplist.h"
-#include "packet.h"
-#include "pool.h"
+#include "server.h"
+#include "uring.h"
+#include "prefilter.h"
+#include "probe.h"
+#include "ddns.h"
+#include "events.h"
+#include "control.h"
+#include "replica.h"
+#include "handoff.h"
 
 #ifndef RECV_BUF_LEN
 #define RECV_BUF_LEN 4096
@@ -45,6 +54,10 @@
 #define SEND_BUF_LEN 4096
 #endif
 
+#ifndef LEASE_SWEEP_INTERVAL
+#define LEASE_SWEEP_INTERVAL 10.
+#endif
+
 #define VERSION "0.1"
 
 uint8_t recv_buffer[RECV_BUF_LEN];
@@ -52,246 +65,443 @@ uint8_t send_buffer[SEND_BUF_LEN];
 
 struct config cfg = CONFIG_EMPTY;
 
-struct pool *pool;
+struct server server = SERVER_EMPTY;
 
 bool debug = false;
 
-static const char BROKEN_SOFTWARE_NOTIFICATION[] =
-"#################################### ALERT ####################################\n"
-"  BROKEN SOFTWARE NOTIFICATION - SOMETHING SENDS INVALID DHCP MESSAGES IN YOUR\n"
-"                                    NETWORK\n";
+/* Attached to the interface with -xdp */
+struct prefilter *prefilter = NULL;
+
+/* Sends dynamic updates with -ddns */
+struct ddns *ddns = NULL;
+
+/* Lease events for subscribers on the control socket */
+struct events *events = NULL;
+
+/* Streams the leases to a standby, or follows a primary */
+struct replica *replica = NULL;
+
+/* Queries leases and takes commands with -control */
+struct control *control = NULL;
+
+/* The socket of the server, read by read_watch directly or through the
+ * ring of the io_uring engine
+ */
+int sock = -1;
+ev_io read_watch;
+struct uring *uring = NULL;
+
+/* The socket a standby accepted its primary on, kept while a successor
+ * takes over in case it fails
+ */
+int standby_sock = -1;
+
+/* Messages received, dropped as invalid by the server, dropped as
+ * another server's with -balance, and left to the primary by a standby
+ */
+uint64_t stats_received = 0;
+uint64_t stats_invalid = 0;
+uint64_t stats_balanced = 0;
+uint64_t stats_standby = 0;
+
 static const char USAGE[] =
 "%s [-h[elp]] [-v[ersion]] [-d[ebug]] [-user UID] [-group GID]\n"
 "\t[-interface IF] [-db FILE]\n"
-"\t[-new] [-allocate] [-iprange IP IP] [-router IP]... [-nameserver IP]...\n";
+"\t[-new] [-allocate] [-iprange IP IP] [-router IP]... [-nameserver IP]...\n"
+"\t[-pin-relay] [-hash-alloc]\n"
+"\t[-listen IP] [-port PORT] [-reply IP] [-reply-port PORT] [-unicast]\n"
+"\t[-dedup INT] [-rapid-commit] [-leasetime-min INT] [-lease-jitter INT]\n"
+"\t[-engine ev|uring] [-xdp generic|native] [-xdp-rate INT]\n"
+"\t[-probe INT] [-probe-timeout MS]\n"
+"\t[-ddns IP] [-ddns-port PORT] [-ddns-zone ZONE] [-ddns-reverse-zone ZONE]\n"
+"\t[-control PATH] [-balance LIST]\n"
+"\t[-replica IP] [-standby IP] [-replica-port PORT] [-handoff PATH]\n";
 
 /**
- * Handle DHCPDISCOVER request and reply to that
+ * Send a reply on the socket of the server
  */
-static void discover_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+static bool socket_send(void *ctx, const uint8_t *buf, size_t len, const struct sockaddr_in *dest)
 {
-	(void)EV_A;
+	int sock = *(int *)ctx;
 
-	/* XXX: Take address from pool
-	 * 			If it is empty, ask for new address
-	 *			If not, send offer
-	 *				and publish lease
-	 *				and rebalance pool if below threshhold?
-	 */
+	return sendto(sock, buf, len, MSG_DONTWAIT,
+		(const struct sockaddr *)dest, sizeof *dest) >= 0;
+}
+
+/**
+ * Handle libev IO event to socket and pass the message to the server
+ */
+static void req_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)revents;
+
+	/* Initialize address struct passed to recvfrom */
+	struct sockaddr_in srcaddr = {
+		.sin_addr = {INADDR_ANY}
+	};
+	socklen_t srcaddrlen = sizeof srcaddr;
+
+	/* Receive data from socket */
+	ssize_t recvd = recvfrom(
+		w->fd,
+		recv_buffer,
+		RECV_BUF_LEN,
+		MSG_DONTWAIT,
+		(struct sockaddr * restrict)&srcaddr, &srcaddrlen);
 
-	struct dhcp_lease lease = DHCP_LEASE_EMPTY;
+	/* Detect errors */
+	if (recvd < 0)
+		return;
 
-	struct pool_entry *entry;
+	++stats_received;
 
-	entry = pool_get(pool);
+	if (replica != NULL && replica->standby) {
+		++stats_standby;
+		return;
+	}
 
-	/* If our pool is empty we'll ask the network to offer an address to us.
-	 * In the meantime, we won't respond to the client.
-	 */
-	if (entry == NULL) {
-		// XXX: Ask for address
+	if (server.balance && !balance_accepts(&server.buckets, recv_buffer, recvd, server.id.sin_addr)) {
+		++stats_balanced;
 		return;
 	}
 
-	lease = (struct dhcp_lease){
-		.routers = cfg.routers,
-		.routers_cnt = cfg.routers_cnt,
-		.nameservers = cfg.nameservers,
-		.nameservers_cnt = cfg.nameservers_cnt,
-		.leasetime = cfg.leasetime,
-		.prefixlen = cfg.prefixlen,
-		.address = entry->address
-	};
+	if (server_handle(&server, recv_buffer, recvd, &srcaddr, ev_now(EV_A)) == 0)
+		++stats_invalid;
+}
+
+/**
+ * Pass a datagram received by the io_uring engine to the server
+ */
+static void uring_req_cb(void *ctx, uint8_t *buf, size_t len, struct sockaddr_in *src)
+{
+	struct ev_loop *loop = ctx;
+
+	++stats_received;
 
-	free(entry);
+	if (replica != NULL && replica->standby) {
+		++stats_standby;
+		return;
+	}
 
-	send_offer(w->fd, msg, &lease);
+	if (server.balance && !balance_accepts(&server.buckets, buf, len, server.id.sin_addr)) {
+		++stats_balanced;
+		return;
+	}
 
-	// XXX: Send (lease.address, msg->chaddr, lease.leasetime) to DHT
+	if (server_handle(&server, buf, len, src, ev_now(loop)) == 0)
+		++stats_invalid;
 }
 
 /**
- * Handle to DHCPREQUEST request and reply to that, and allocate lease if
- * enabled
+ * Handle libev IO event to the io_uring descriptor, i.e. completions
  */
-static void request_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+static void uring_cb(EV_P_ ev_io *w, int revents)
 {
-	(void)EV_A;
+	(void)revents;
 
-	/* XXX: Fetch lease with callback
-	 *
-	 * struct:
-	 * 		- request_id
-	 * 		- dhcp_msg
-	 * 		- callback_ptr
-	 * 		- timeout
-	 *
-	 * timeout -> NAK
-	 *
-	 * Callback: Check whether lease matches client
-	 *           If yes, ACK
-	 *           If no, NAK
-	 */
+	struct uring *u = w->data;
 
-	struct in_addr *requested_server;
-	struct in_addr *requested_addr;
-	uint8_t *options;
-	struct dhcp_opt current_opt;
+	if (!uring_poll(u, uring_req_cb, EV_A))
+		dhcpd_error(1, errno, "Could not receive with io_uring");
+}
 
-	requested_addr = NULL;
-	requested_server = (struct in_addr *)DHCP_MSG_F_SIADDR(msg->data);
-	options = DHCP_MSG_F_OPTIONS(msg->data);
+/**
+ * Start a probe for the server
+ */
+static bool probe_send(void *ctx, struct in_addr address, uint32_t id)
+{
+	return probe_start((struct probe *)ctx, address, id);
+}
 
-	while (dhcp_opt_next(&options, &current_opt, msg->end))
-		switch (current_opt.code)
-		{
-			case DHCP_OPT_REQIPADDR:
-				requested_addr = (struct in_addr *)current_opt.data;
-				break;
-			case DHCP_OPT_SERVERID:
-				requested_server = (struct in_addr *)current_opt.data;
-				break;
-		}
+/**
+ * Pass the result of a probe to the server, which sends the offer
+ */
+static void probe_done(void *ctx, uint32_t id, bool in_use)
+{
+	struct ev_loop *loop = ctx;
 
-	if (requested_server->s_addr != msg->sid->sin_addr.s_addr)
-		return;
+	server_probed(&server, id, in_use, ev_now(loop));
 
-	struct dhcp_lease lease = DHCP_LEASE_EMPTY;
+	/* The ring only submits by itself when it has completions */
+	if (server.sink.send == uring_send)
+		uring_flush(server.sink.ctx);
+}
+
+/**
+ * Publish a lease event to subscribers, queue a dynamic update for a bound
+ * client with a host name, or for one which lost its lease, and mark the
+ * lease for the standby. A standby leaves all of that to the primary.
+ * A declined address concerns no client, only the standby learns of it.
+ */
+static void lease_event(void *ctx, const struct server_event *e)
+{
+	(void)ctx;
 
-	lease.address = *requested_addr;
+	if (replica != NULL) {
+		if (replica->standby)
+			return;
 
-	if (0) {
-		// NACK
-		send_nak(w->fd, msg);
-	} else {
-		// ACK
-		send_ack(w->fd, msg, &lease);
+		replica_note(replica, e->address);
 	}
+
+	if (e->type == SERVER_EVENT_DECLINED)
+		return;
+
+	if (events != NULL)
+		events_publish(events, e);
+
+	if (ddns == NULL || e->hostname == NULL || e->type == SERVER_EVENT_RENEWED)
+		return;
+
+	ddns_update(ddns, e->hostname, e->hostname_len, e->address,
+		e->type == SERVER_EVENT_BOUND);
 }
 
 /**
- * Handle DHCPRELEASE request and release the lease if it was allocated
+ * Handle libev timer event and time out requests waiting for a result
  */
-static void release_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+static void timeout_cb(EV_P_ ev_timer *w, int revents)
 {
-	(void)EV_A;
 	(void)w;
-	(void)msg;
+	(void)revents;
+
+	server_timeout(&server, ev_now(EV_A));
 
-	/* XXX: Send message to manager */
+	if (server.sink.send == uring_send)
+		uring_flush(server.sink.ctx);
 }
 
 /**
- * Handle DHCPDECLINE request and do nothing at the moment
+ * Set the timer of waiting requests to the earliest deadline before the
+ * loop blocks, one timer covers all of them
  */
-static void decline_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+static void pending_prepare_cb(EV_P_ ev_prepare *w, int revents)
 {
-	(void)EV_A;
-	(void)w;
-	(void)msg;
+	(void)revents;
+
+	ev_timer *timer = w->data;
+	ev_tstamp at;
+
+	ev_timer_stop(EV_A_ timer);
+
+	if (!server_next_timeout(&server, &at))
+		return;
 
-	/* XXX: Send message to manager */
+	ev_timer_set(timer, at > ev_now(EV_A) ? at - ev_now(EV_A) : 0, 0);
+	ev_timer_start(EV_A_ timer);
 }
 
 /**
- * Handle DHCPINFORM request and reply with the correct information
+ * Handle libev timer event and free expired leases
  */
-static void inform_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+static void expire_cb(EV_P_ ev_timer *w, int revents)
 {
-	(void)EV_A;
 	(void)w;
-	(void)msg;
+	(void)revents;
 
-	/* XXX: http://tools.ietf.org/html/draft-ietf-dhc-dhcpinform-clarify-04
-	 */
+	server_expire(&server, ev_now(EV_A));
 }
 
 /**
- * Handle libev IO event to socket and call the correct message type
- * handler.
+ * Serve the clients of the primary we followed
  */
-static void req_cb(EV_P_ ev_io *w, int revents)
+static void takeover(void *ctx)
 {
-	(void)revents;
+	(void)ctx;
 
-	/* Initialize address struct passed to recvfrom */
-	struct sockaddr_in srcaddr = {
-		.sin_addr = {INADDR_ANY}
-	};
-	socklen_t srcaddrlen = AF_INET;
+	fprintf(stderr, "Serving %" PRIu32 " addresses, %" PRIu32 " free\n",
+		server.pool->size, server.pool->free);
+}
 
-	/* Receive data from socket */
-	ssize_t recvd = recvfrom(
-		w->fd,
-		recv_buffer,
-		RECV_BUF_LEN,
-		MSG_DONTWAIT,
-		(struct sockaddr * restrict)&srcaddr, &srcaddrlen);
+/**
+ * Start reading the socket with the engine of -engine
+ */
+static void engine_start(struct ev_loop *loop)
+{
+	if (cfg.engine == CONFIG_ENGINE_URING)
+	{
+		if ((uring = uring_create(sock)) == NULL)
+			dhcpd_error(1, errno, "Could not set up io_uring");
 
-	/* Detect errors */
-	if (recvd < 0)
-		return;
-	/* Detect too small messages */
-	if (recvd < DHCP_MSG_HDRLEN)
-		return;
-	/* Check magic value */
-	uint8_t *magic = DHCP_MSG_F_MAGIC(recv_buffer);
-	if (!DHCP_MSG_MAGIC_CHECK(magic))
-		return;
+		server.sink.send = uring_send;
+		server.sink.ctx = uring;
+
+		ev_io_init(&read_watch, uring_cb, uring_fd(uring), EV_READ);
+		read_watch.data = uring;
+	}
+	else
+	{
+		server.sink.send = socket_send;
+		server.sink.ctx = &sock;
+
+		ev_io_init(&read_watch, req_cb, sock, EV_READ);
+	}
 
-	/* Extract message type from options */
-	uint8_t *options = DHCP_MSG_F_OPTIONS(recv_buffer);
-	struct dhcp_opt current_option;
-
-	enum dhcp_msg_type msg_type = 0;
-
-	while (dhcp_opt_next(&options, &current_option, (uint8_t*)(recv_buffer + recvd)))
-		if (current_option.code == 53)
-			msg_type = (enum dhcp_msg_type)current_option.data[0];
-
-	struct dhcp_msg msg = {
-		.data = recv_buffer,
-		.end = recv_buffer + recvd,
-		.length = recvd,
-		.type = msg_type,
-		.ciaddr.s_addr = ntohl(*DHCP_MSG_F_CIADDR(recv_buffer)),
-		.yiaddr.s_addr = ntohl(*DHCP_MSG_F_YIADDR(recv_buffer)),
-		.siaddr.s_addr = ntohl(*DHCP_MSG_F_SIADDR(recv_buffer)),
-		.giaddr.s_addr = ntohl(*DHCP_MSG_F_GIADDR(recv_buffer)),
-		.source = (struct sockaddr *)&srcaddr,
-		.sid = (struct sockaddr_in *)&server_id
+	ev_io_start(loop, &read_watch);
+}
+
+/**
+ * Stop reading the socket, requests wait in it. The ring hands what it
+ * received to the server first.
+ */
+static void engine_stop(struct ev_loop *loop)
+{
+	ev_io_stop(loop, &read_watch);
+
+	if (uring != NULL)
+	{
+		uring_poll(uring, uring_req_cb, loop);
+		uring_destroy(uring);
+		uring = NULL;
+
+		server.sink.send = socket_send;
+		server.sink.ctx = &sock;
+	}
+}
+
+/**
+ * Set up replication as configured
+ *
+ * @param[in] listen_sock Socket to follow a primary on, -1 to open one with
+ *                        -standby, or to be the primary if nobody listens
+ * @param[in] handed Whether the socket was handed off, then -1 means the
+ *                   server we took over from took over from its primary
+ */
+static void replica_start(struct ev_loop *loop, int listen_sock, bool handed)
+{
+	struct sockaddr_in listen_addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(cfg.replica_port),
+		.sin_addr = cfg.standby_listen
 	};
+	struct sockaddr_in peer = {
+		.sin_family = AF_INET,
+		.sin_port = htons(cfg.replica_port),
+		.sin_addr = cfg.replica
+	};
+
+	if (!cfg.standby && listen_sock >= 0)
+	{
+		close(listen_sock);
+		listen_sock = -1;
+	}
+
+	if (cfg.standby && listen_sock < 0 && !handed &&
+			(listen_sock = replica_listen(&listen_addr)) < 0)
+		dhcpd_error(1, errno, "Could not listen for the primary on %s:%d",
+			inet_ntoa(cfg.standby_listen), cfg.replica_port);
+
+	replica = replica_create(loop, &server, listen_sock,
+		cfg.replica.s_addr != INADDR_ANY ? &peer : NULL, takeover, NULL);
+
+	if (replica == NULL)
+		dhcpd_error(1, errno, "Could not set up replication");
+
+	if (control != NULL)
+		control->replica = replica;
+}
+
+/**
+ * Pass the sockets to a successor
+ */
+static void handoff_sockets(void *ctx, struct handoff_fds *fds)
+{
+	(void)ctx;
+
+	fds->udp = sock;
+
+	if (replica != NULL && replica->standby)
+		fds->standby = replica->listen_sock;
+
+	if (prefilter != NULL)
+	{
+		fds->xdp[0] = prefilter->prog;
+		fds->xdp[1] = prefilter->link;
+		fds->xdp[2] = prefilter->counters;
+		fds->xdp[3] = prefilter->clients;
+	}
+}
+
+/**
+ * Stop serving while a successor loads our leases
+ */
+static void handoff_stop(void *ctx)
+{
+	struct ev_loop *loop = ctx;
 
-	memcpy(&msg.chaddr, DHCP_MSG_F_CHADDR(recv_buffer), sizeof(msg.chaddr));
+	engine_stop(loop);
 
-	switch (msg_type)
+	if (replica != NULL)
 	{
-		case DHCPDISCOVER:
-			discover_cb(EV_A_ w, &msg);
-			break;
+		if (replica->standby)
+			standby_sock = dup(replica->listen_sock);
 
-		case DHCPREQUEST:
-			request_cb(EV_A_ w, &msg);
-			break;
+		replica_destroy(replica);
+		replica = NULL;
 
-		case DHCPRELEASE:
-			release_cb(EV_A_ w, &msg);
-			break;
+		if (control != NULL)
+			control->replica = NULL;
+	}
+}
 
-		case DHCPDECLINE:
-			decline_cb(EV_A_ w, &msg);
-			break;
+/**
+ * Serve again after the successor failed
+ */
+static void handoff_resume(void *ctx)
+{
+	struct ev_loop *loop = ctx;
 
-		case DHCPINFORM:
-			inform_cb(EV_A_ w, &msg);
-			break;
+	engine_start(loop);
 
-		default:
-			fprintf(stderr, BROKEN_SOFTWARE_NOTIFICATION);
-			break;
+	if (cfg.standby || cfg.replica.s_addr != INADDR_ANY)
+	{
+		replica_start(loop, standby_sock, true);
+		standby_sock = -1;
 	}
 }
 
+/**
+ * Handle SIGUSR1 and print counters of the server, the prefilter, the
+ * dynamic updates, the event stream and the replication
+ */
+static void stats_cb(EV_P_ ev_signal *w, int revents)
+{
+	(void)EV_A;
+	(void)w;
+	(void)revents;
+
+	fprintf(stderr, "received %" PRIu64 " invalid %" PRIu64 " retransmitted %" PRIu64
+		" balanced %" PRIu64 " standby %" PRIu64 "\n",
+		stats_received, stats_invalid,
+		server.dedup != NULL ? server.dedup->hits : 0, stats_balanced,
+		stats_standby);
+
+	uint64_t counters[PREFILTER_COUNTERS];
+
+	if (prefilter != NULL && prefilter_read(prefilter, counters))
+		fprintf(stderr, "xdp passed %" PRIu64 " runt %" PRIu64 " op %" PRIu64
+			" cookie %" PRIu64 " rate %" PRIu64 "\n",
+			counters[PREFILTER_PASSED], counters[PREFILTER_RUNT],
+			counters[PREFILTER_OP], counters[PREFILTER_COOKIE],
+			counters[PREFILTER_RATE]);
+
+	if (ddns != NULL)
+		fprintf(stderr, "ddns queued %" PRIu64 " coalesced %" PRIu64 " dropped %" PRIu64
+			" sent %" PRIu64 " acked %" PRIu64 " failed %" PRIu64 "\n",
+			ddns->stats.queued, ddns->stats.coalesced, ddns->stats.dropped,
+			ddns->stats.sent, ddns->stats.acked, ddns->stats.failed);
+
+	if (events != NULL)
+		fprintf(stderr, "events published %" PRIu64 " lost %" PRIu64 " subscribers %zu\n",
+			events->published, events->lost, events->subscribers_cnt);
+
+	if (replica != NULL)
+		fprintf(stderr, "replica records %" PRIu64 " commits %" PRIu64 " behind %" PRIu32
+			" snapshots %" PRIu64 " applied %" PRIu64 "\n",
+			replica->stats.records, replica->stats.commits, replica->seq - replica->acked,
+			replica->stats.snapshots, replica->stats.applied);
+}
+
 int main(int argc, char **argv)
 {
 	struct argv argv_cfg = ARGV_EMPTY;
@@ -311,7 +521,7 @@ int main(int argc, char **argv)
 		exit(0);
 	}
 
-	if (argv_cfg.help || argv_cfg.interface == NULL)
+	if (argv_cfg.help || (argv_cfg.interface == NULL && argv_cfg.listen == NULL))
 	{
 		printf(USAGE, argv_cfg.arg0);
 		exit(0);
@@ -320,6 +530,45 @@ int main(int argc, char **argv)
 	if (!config_fill(&cfg, &argv_cfg))
 		dhcpd_error(1, 0, cfg.error);
 
+	struct handoff_fds handed = HANDOFF_FDS_EMPTY;
+	int handoff_conn = -1;
+
+	/* Take the sockets of the server running there, if there is one */
+	if (cfg.handoff != NULL)
+	{
+		handoff_conn = handoff_connect(cfg.handoff, &handed);
+
+		if (handoff_conn < 0 && errno != ENOENT && errno != ECONNREFUSED)
+			dhcpd_error(1, errno, "Could not take over from %s", cfg.handoff);
+	}
+
+	/* A filter handed off stays attached, it is dropped without -xdp */
+	if (handed.xdp[0] >= 0 && cfg.xdp == CONFIG_XDP_OFF)
+	{
+		for (size_t i = 0; i < ARRAY_LEN(handed.xdp); ++i)
+			if (handed.xdp[i] >= 0)
+				close(handed.xdp[i]);
+	}
+	else if (handed.xdp[0] >= 0)
+	{
+		if ((prefilter = prefilter_adopt(handed.xdp)) == NULL)
+			dhcpd_error(1, errno, "Could not take over XDP prefilter");
+	}
+	/* Loading the prefilter needs privileges we are about to drop */
+	else if (cfg.xdp != CONFIG_XDP_OFF)
+	{
+		unsigned ifindex = if_nametoindex(argv_cfg.interface);
+
+		if (ifindex == 0)
+			dhcpd_error(1, errno, argv_cfg.interface);
+
+		prefilter = prefilter_attach(ifindex, cfg.port, cfg.xdp_rate,
+			cfg.xdp == CONFIG_XDP_GENERIC);
+
+		if (prefilter == NULL)
+			dhcpd_error(1, errno, "Could not attach XDP prefilter to %s", argv_cfg.interface);
+	}
+
 	if (argv_cfg.user != NULL)
 	{
 #ifdef __linux__
@@ -364,83 +613,215 @@ int main(int argc, char **argv)
 #endif
 	}
 
-	/* Prepare dummy IP Pool */
-	pool = pool_create(8);
-
-	struct pool_entry entry;
-	uint32_t ip;
-
-	IPRANGE_FOREACH(cfg.iprange[0], cfg.iprange[1], ip) {
-		entry.address.s_addr = htonl(ip);
+	if (!server_init(&server, &cfg))
+		dhcpd_error(1, errno, "Could not allocate address pool and leases");
 
-		pool_add(pool, &entry);
-	}
-
-	/* Set client IP address */
-	broadcast.sin_port = htons(68);
 	/* Clear IO buffers */
 	memset(send_buffer, 0, ARRAY_LEN(send_buffer));
 	memset(recv_buffer, 0, ARRAY_LEN(recv_buffer));
 
-	if (if_nametoindex(argv_cfg.interface) == 0)
+	if (argv_cfg.interface != NULL && if_nametoindex(argv_cfg.interface) == 0)
 		dhcpd_error(1, errno, argv_cfg.interface);
 
 	if (argv_cfg.debug)
 		debug = true;
 
-	int sock;
-	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
-		dhcpd_error(1, errno, "Could not create socket");
-
 	struct sockaddr_in bind_addr = {
 		.sin_family = AF_INET,
-		.sin_port = htons(67),
-		.sin_addr = {INADDR_ANY}
+		.sin_port = htons(cfg.port),
+		.sin_addr = cfg.listen
 	};
 
 	struct ifaddrs *ifaddrs, *ifa;
 
-	if (getifaddrs(&ifaddrs) == -1)
-		dhcpd_error(1, errno, "Could not get interface information");
-
-	for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next)
+	if (argv_cfg.interface != NULL)
 	{
-		if (ifa->ifa_addr == NULL)
-			continue;
+		if (getifaddrs(&ifaddrs) == -1)
+			dhcpd_error(1, errno, "Could not get interface information");
 
-		if (ifa->ifa_addr->sa_family == AF_INET &&
-				strcmp(ifa->ifa_name, argv_cfg.interface) == 0)
+		for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next)
 		{
-			struct sockaddr_in *ifa_addr_in = (struct sockaddr_in *)ifa->ifa_addr;
-			server_id = *ifa_addr_in;
-			break;
+			if (ifa->ifa_addr == NULL)
+				continue;
+
+			if (ifa->ifa_addr->sa_family == AF_INET &&
+					strcmp(ifa->ifa_name, argv_cfg.interface) == 0)
+			{
+				struct sockaddr_in *ifa_addr_in = (struct sockaddr_in *)ifa->ifa_addr;
+				server.id = *ifa_addr_in;
+				break;
+			}
 		}
+
+		freeifaddrs(ifaddrs);
 	}
 
-	freeifaddrs(ifaddrs);
+	/* Without an interface, e.g. on loopback or in a network namespace,
+	 * we identify with the address we listen on
+	 */
+	if (cfg.listen.s_addr != INADDR_ANY)
+		server.id.sin_addr = cfg.listen;
+
+	if (server.id.sin_addr.s_addr == INADDR_ANY)
+		dhcpd_error(1, 0, "Could not determine server identifier, use -listen IP");
+
+	/* The socket handed off is bound and set up already */
+	if (handed.udp >= 0)
+	{
+		sock = handed.udp;
+	}
+	else
+	{
+		if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+			dhcpd_error(1, errno, "Could not create socket");
 
-	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (int[]){1}, sizeof(int)) != 0)
-		dhcpd_error(1, errno, "Could not set socket to reuse address");
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (int[]){1}, sizeof(int)) != 0)
+			dhcpd_error(1, errno, "Could not set socket to reuse address");
 
-	if (bind(sock, (const struct sockaddr *)&bind_addr, sizeof(struct sockaddr_in)) < 0)
-		dhcpd_error(1, errno, "Could not bind to 0.0.0.0:67");
+		if (bind(sock, (const struct sockaddr *)&bind_addr, sizeof(struct sockaddr_in)) < 0)
+			dhcpd_error(1, errno, "Could not bind to %s:%d",
+				inet_ntoa(cfg.listen), cfg.port);
 
-	if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (int[]){1}, sizeof(int)) != 0)
-		dhcpd_error(1, errno, "Could not set broadcast socket option");
+		if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (int[]){1}, sizeof(int)) != 0)
+			dhcpd_error(1, errno, "Could not set broadcast socket option");
 #ifdef __linux__
-	if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, argv_cfg.interface, strlen(argv_cfg.interface)) != 0)
-		dhcpd_error(1, errno, "Could not bind to device %s", argv_cfg.interface);
+		if (argv_cfg.interface != NULL &&
+				setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, argv_cfg.interface, strlen(argv_cfg.interface)) != 0)
+			dhcpd_error(1, errno, "Could not bind to device %s", argv_cfg.interface);
 #endif
+	}
+
+	/* The server we take over from stops reading now, should we fail from
+	 * here on it reads again once we are gone
+	 */
+	if (handoff_conn >= 0 && !handoff_load(handoff_conn, &server))
+		dhcpd_error(1, errno, "Could not load the leases of %s", cfg.handoff);
 
 	struct ev_loop *loop = EV_DEFAULT;
 
-	ev_io read_watch;
+	engine_start(loop);
 
-	ev_io_init(&read_watch, req_cb, sock, EV_READ);
-	ev_io_start(loop, &read_watch);
+	struct probe *probe = NULL;
+
+	if (cfg.probe > 0)
+	{
+		probe = probe_create(loop, cfg.probe, cfg.probe_timeout / 1000., probe_done, loop);
+
+		if (probe == NULL)
+			dhcpd_error(1, errno, "Could not open socket for probes");
+
+		server.prober.start = probe_send;
+		server.prober.ctx = probe;
+	}
+
+	if (cfg.ddns.s_addr != INADDR_ANY)
+	{
+		struct sockaddr_in ns = {
+			.sin_family = AF_INET,
+			.sin_port = htons(cfg.ddns_port),
+			.sin_addr = cfg.ddns
+		};
+
+		ddns = ddns_create(loop, &ns, cfg.ddns_zone, cfg.ddns_reverse_zone);
+
+		if (ddns == NULL)
+			dhcpd_error(1, errno, "Could not open socket for dynamic updates");
+
+		server.listener.event = lease_event;
+	}
+
+	if (cfg.standby || cfg.replica.s_addr != INADDR_ANY)
+	{
+		replica_start(loop, handed.standby, handoff_conn >= 0);
+		server.listener.event = lease_event;
+	}
+	else if (handed.standby >= 0)
+	{
+		close(handed.standby);
+	}
+
+	if (cfg.control != NULL)
+	{
+		if ((events = events_create(loop)) == NULL)
+			dhcpd_error(1, errno, "Could not allocate event stream");
+
+		if ((control = control_create(loop, cfg.control, &server, events, replica)) == NULL)
+			dhcpd_error(1, errno, "Could not create control socket %s", cfg.control);
+
+		server.listener.event = lease_event;
+	}
+
+	ev_timer expire_watch;
+
+	ev_timer_init(&expire_watch, expire_cb, LEASE_SWEEP_INTERVAL, LEASE_SWEEP_INTERVAL);
+	ev_timer_start(loop, &expire_watch);
+
+	ev_timer pending_watch;
+	ev_prepare pending_prepare;
+
+	ev_init(&pending_watch, timeout_cb);
+	ev_prepare_init(&pending_prepare, pending_prepare_cb);
+	pending_prepare.data = &pending_watch;
+	ev_prepare_start(loop, &pending_prepare);
+
+	ev_signal stats_watch;
+
+	ev_signal_init(&stats_watch, stats_cb, SIGUSR1);
+	ev_signal_start(loop, &stats_watch);
+
+	struct handoff *handoff = NULL;
+
+	if (cfg.handoff != NULL)
+	{
+		struct handoff_hooks hooks = {
+			.sockets = handoff_sockets,
+			.stop = handoff_stop,
+			.resume = handoff_resume,
+			.ctx = loop
+		};
+
+		if ((handoff = handoff_create(loop, cfg.handoff, &server, &hooks)) == NULL)
+			dhcpd_error(1, errno, "Could not create handoff socket %s", cfg.handoff);
+	}
+
+	/* The server we took over from exits, unless it took too long to get
+	 * here and it reads again
+	 */
+	if (handoff_conn >= 0 && !handoff_serving(handoff_conn))
+		dhcpd_error(1, errno, "Could not take over from %s, it serves again", cfg.handoff);
 
 	ev_run(loop, 0);
 
+	if (handoff != NULL)
+		handoff_destroy(handoff);
+
+	if (control != NULL)
+		control_destroy(control);
+
+	if (replica != NULL)
+		replica_destroy(replica);
+
+	if (events != NULL)
+		events_destroy(events);
+
+	if (ddns != NULL)
+		ddns_destroy(ddns);
+
+	if (probe != NULL)
+		probe_destroy(probe);
+
+	if (uring != NULL)
+		uring_destroy(uring);
+
+	if (standby_sock >= 0)
+		close(standby_sock);
+
+	close(sock);
+
+	if (prefilter != NULL)
+		prefilter_detach(prefilter);
+
+	server_free(&server);
 	config_free(&cfg);
 	argv_free(&argv_cfg);
 
@@ -0,0 +1,258 @@
+/* Offline replay of captured DHCP traffic
+ *
+ * The requests of a pcap capture are fed to the message handlers in the
+ * order and at the times they were captured, with the capture timestamps
+ * as clock. The outcome only depends on the capture and the options, so the
+ * replies written by two builds can be compared byte by byte, and the time
+ * it takes is a benchmark at a real traffic mix.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dhcp.h"
+#include "argv.h"
+#include "error.h"
+#include "config.h"
+#include "server.h"
+#include "pcap.h"
+
+#ifndef LEASE_SWEEP_INTERVAL
+#define LEASE_SWEEP_INTERVAL 10.
+#endif
+
+struct config cfg = CONFIG_EMPTY;
+
+struct server server = SERVER_EMPTY;
+
+static const char USAGE[] =
+"%s [dhcpd options] -- CAPTURE [REPLIES]\n"
+"\tReplay the requests to -port (default 67) of the pcap file CAPTURE and\n"
+"\twrite the replies to the pcap file REPLIES. The server identifier is\n"
+"\tthe -listen address, or the source of the first reply in CAPTURE.\n";
+
+/* A captured request, its data is at off in the data of the replay */
+struct replay_msg
+{
+	double ts;
+	struct sockaddr_in src;
+	size_t off;
+	size_t len;
+};
+
+struct replay
+{
+	struct replay_msg *msgs;
+	size_t msgs_cnt;
+	size_t msgs_cap;
+
+	uint8_t *data;
+	size_t data_len;
+	size_t data_cap;
+
+	/* Replies are written here, if not NULL */
+	FILE *out;
+
+	uint64_t replies;
+	uint64_t types[DHCPINFORM + 1];
+	uint64_t dropped;
+};
+
+static uint64_t replay_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Sink of the server, writes the replies with the virtual time
+ */
+static bool replay_send(void *ctx, const uint8_t *buf, size_t len, const struct sockaddr_in *dest)
+{
+	struct replay *r = (struct replay *)ctx;
+	struct sockaddr_in src = server.id;
+
+	++r->replies;
+
+	if (r->out == NULL)
+		return true;
+
+	src.sin_port = htons(cfg.port);
+
+	return pcap_write_udp(r->out, server.now, &src, dest, buf, len);
+}
+
+/**
+ * Read all requests of a capture into memory, so reading it is not part of
+ * the replay
+ */
+static void replay_load(struct replay *r, const char *path)
+{
+	static struct pcap p;
+	struct pcap_udp udp;
+	int ret;
+
+	FILE *file = fopen(path, "rb");
+
+	if (file == NULL)
+		dhcpd_error(1, errno, "Could not open %s", path);
+
+	if (!pcap_open(&p, file))
+		dhcpd_error(1, 0, "%s: %s", path, p.error);
+
+	while ((ret = pcap_next_udp(&p, &udp)) > 0)
+	{
+		if (udp.len < DHCP_MSG_HDRLEN)
+			continue;
+
+		/* The first reply of a server tells who we are */
+		if (*DHCP_MSG_F_OP(udp.data) == 2) {
+			if (server.id.sin_addr.s_addr == INADDR_ANY && ntohs(udp.src.sin_port) == cfg.port)
+				server.id.sin_addr = udp.src.sin_addr;
+			continue;
+		}
+
+		if (ntohs(udp.dst.sin_port) != cfg.port)
+			continue;
+
+		if (r->msgs_cnt == r->msgs_cap) {
+			r->msgs_cap = r->msgs_cap ? r->msgs_cap * 2 : 1024;
+			r->msgs = realloc(r->msgs, r->msgs_cap * sizeof(struct replay_msg));
+		}
+
+		while (r->data_len + udp.len > r->data_cap) {
+			r->data_cap = r->data_cap ? r->data_cap * 2 : 1 << 20;
+			r->data = realloc(r->data, r->data_cap);
+		}
+
+		if (r->msgs == NULL || r->data == NULL)
+			dhcpd_error(1, errno, "Could not allocate capture");
+
+		r->msgs[r->msgs_cnt++] = (struct replay_msg){
+			.ts = udp.ts,
+			.src = udp.src,
+			.off = r->data_len,
+			.len = udp.len
+		};
+
+		memcpy(r->data + r->data_len, udp.data, udp.len);
+		r->data_len += udp.len;
+	}
+
+	if (ret < 0)
+		dhcpd_error(1, 0, "%s: %s", path, p.error);
+
+	fclose(file);
+}
+
+int main(int argc, char **argv)
+{
+	struct argv argv_cfg = ARGV_EMPTY;
+	int optc = 1;
+
+	/* dhcpd options up to --, our own after it */
+	while (optc < argc && strcmp(argv[optc], "--") != 0)
+		++optc;
+
+	if (!argv_parse(optc, argv, &argv_cfg))
+	{
+		if (argv_cfg.argerror == -1)
+			dhcpd_error(1, 0, "Unexpected argument list end");
+		else
+			dhcpd_error(1, 0, "Unexpected argument %s", argv_cfg.argv[argv_cfg.argerror]);
+	}
+
+	if (argv_cfg.help || optc + 1 >= argc)
+	{
+		printf(USAGE, argv_cfg.arg0);
+		exit(0);
+	}
+
+	if (!config_fill(&cfg, &argv_cfg))
+		dhcpd_error(1, 0, cfg.error);
+
+	if (!server_init(&server, &cfg))
+		dhcpd_error(1, errno, "Could not allocate address pool and leases");
+
+	struct replay r = {0};
+
+	server.id.sin_addr = cfg.listen;
+	server.sink.send = replay_send;
+	server.sink.ctx = &r;
+
+	replay_load(&r, argv[optc + 1]);
+
+	if (server.id.sin_addr.s_addr == INADDR_ANY)
+		dhcpd_error(1, 0, "No server identifier, use -listen IP or a capture with replies");
+
+	if (optc + 2 < argc)
+	{
+		r.out = fopen(argv[optc + 2], "wb");
+
+		if (r.out == NULL || !pcap_write_header(r.out))
+			dhcpd_error(1, errno, "Could not write %s", argv[optc + 2]);
+	}
+
+	ev_tstamp sweep = r.msgs_cnt > 0 ? r.msgs[0].ts + LEASE_SWEEP_INTERVAL : 0;
+	uint64_t start = replay_ns();
+
+	for (size_t i = 0; i < r.msgs_cnt; ++i)
+	{
+		struct replay_msg *m = &r.msgs[i];
+
+		/* Expire leases as often as the daemon would */
+		while (m->ts >= sweep) {
+			server_expire(&server, sweep);
+			sweep += LEASE_SWEEP_INTERVAL;
+		}
+
+		enum dhcp_msg_type type = server_handle(&server, r.data + m->off, m->len, &m->src, m->ts);
+
+		if (type > 0 && type <= DHCPINFORM)
+			++r.types[type];
+		else
+			++r.dropped;
+	}
+
+	uint64_t ns = replay_ns() - start;
+	double span = r.msgs_cnt > 0 ? r.msgs[r.msgs_cnt - 1].ts - r.msgs[0].ts : 0;
+
+	printf("requests %zu replies %llu dropped %llu\n"
+		"discover %llu request %llu decline %llu release %llu inform %llu\n"
+		"time %.3fs rate %.0f/s %.1fns/request, capture spans %.1fs\n",
+		r.msgs_cnt,
+		(unsigned long long)r.replies,
+		(unsigned long long)r.dropped,
+		(unsigned long long)r.types[DHCPDISCOVER],
+		(unsigned long long)r.types[DHCPREQUEST],
+		(unsigned long long)r.types[DHCPDECLINE],
+		(unsigned long long)r.types[DHCPRELEASE],
+		(unsigned long long)r.types[DHCPINFORM],
+		ns / 1e9,
+		ns > 0 ? r.msgs_cnt * 1e9 / ns : 0.,
+		r.msgs_cnt > 0 ? (double)ns / r.msgs_cnt : 0.,
+		span);
+
+	if (r.out != NULL && fclose(r.out) != 0)
+		dhcpd_error(1, errno, "Could not write %s", argv[optc + 2]);
+
+	free(r.msgs);
+	free(r.data);
+
+	server_free(&server);
+	config_free(&cfg);
+	argv_free(&argv_cfg);
+
+	return 0;
+}
@@ -4,6 +4,8 @@
 #include <net/if.h>
 #include <errno.h>
 #include <time.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include <arpa/inet.h>
 
@@ -265,6 +267,7 @@ static inline bool config_fill(struct config *cfg, struct argv *argv)
 }
 
 #define SEND_BUF_LEN 4096
+#define RECV_BUF_LEN 4096
 
 uint8_t send_buffer[SEND_BUF_LEN];
 
@@ -273,6 +276,37 @@ struct config cfg = CONFIG_EMPTY;
 /* Stress definitions */
 static void stress_inval_lenmsgs(int sock);
 static void stress_request_all(int sock);
+static void stress_dora(int sock);
+
+/**
+ * Create a socket bound to a local address and the interface
+ */
+static int stress_socket(const struct sockaddr_in *local)
+{
+	int sock;
+	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		dhcpd_error(1, errno, "Could not create socket");
+
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (int[]){1}, sizeof(int)) != 0)
+		dhcpd_error(1, errno, "Could not set socket to reuse address");
+	if (bind(sock, (const struct sockaddr *)local, sizeof(struct sockaddr_in)) < 0)
+		dhcpd_error(1, errno, "Could not bind to %s:%d",
+			inet_ntop(AF_INET, &local->sin_addr, ((char[INET_ADDRSTRLEN]){0}), INET_ADDRSTRLEN),
+			ntohs(local->sin_port));
+	if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (int[]){1}, sizeof(int)) != 0)
+		dhcpd_error(1, errno, "Could not set broadcast socket option");
+	/* Bursts of replies to many clients would otherwise be dropped here
+	 * instead of at the server. Best effort, the kernel caps it.
+	 */
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (int[]){4 << 20}, sizeof(int));
+#ifdef __linux__
+	if (cfg.argv->interface != NULL &&
+			setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, cfg.argv->interface, strlen(cfg.argv->interface)) != 0)
+		dhcpd_error(1, errno, "Could not bind to device %s", cfg.argv->interface);
+#endif
+
+	return sock;
+}
 
 int main(int argc, char **argv)
 {
@@ -295,11 +329,15 @@ int main(int argc, char **argv)
 			"id  function              description\n"
 			"1   inval_lenmsgs         Send messages which are longer than the trans-\n"
 			"                          mitted byte coud\n"
-			"2   request_all           Send DHCPREQUESTs for any possible IPv4 address\n");
+			"2   request_all           Send DHCPREQUESTs for any possible IPv4 address\n"
+			"3   dora                  Run full DISCOVER/OFFER/REQUEST/ACK exchanges of\n"
+			"                          virtual clients and measure completed exchanges,\n"
+			"                          mixed with renewals, churn, informs, relayed and\n"
+			"                          rapid commit exchanges by weight\n");
 		exit(0);
 	}
 
-	if (argv_cfg.help || argv_cfg.interface == NULL || argv_cfg.stress == NULL)
+	if (argv_cfg.help || argv_cfg.stress == NULL)
 	{
 		printf("%s [-help] [-stresses] [-sleep TIME] [-seed SEED] [-type INT]\n"
 			"\t[-stress NAME] [-interface IF] [-remote IP PORT] [-local IP PORT]\n"
@@ -311,23 +349,10 @@ int main(int argc, char **argv)
 	cfg.remote.sin_port = htons(cfg.remote.sin_port);
 	cfg.local.sin_port = htons(cfg.local.sin_port);
 
-	if (if_nametoindex(cfg.argv->interface) == 0)
+	if (cfg.argv->interface != NULL && if_nametoindex(cfg.argv->interface) == 0)
 		dhcpd_error(1, errno, cfg.argv->interface);
 
-	int sock;
-	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
-		dhcpd_error(1, errno, "Could not create socket");
-
-	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (int[]){1}, sizeof(int)) != 0)
-		dhcpd_error(1, errno, "Could not set socket to reuse address");
-	if (bind(sock, (const struct sockaddr *)&cfg.local, sizeof(struct sockaddr_in)) < 0)
-		dhcpd_error(1, errno, "Could not bind to 0.0.0.0:67");
-	if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (int[]){1}, sizeof(int)) != 0)
-		dhcpd_error(1, errno, "Could not set broadcast socket option");
-#ifdef __linux__
-	if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, cfg.argv->interface, strlen(cfg.argv->interface)) != 0)
-		dhcpd_error(1, errno, "Could not bind to device %s", cfg.argv->interface);
-#endif
+	int sock = stress_socket(&cfg.local);
 
 	switch (cfg.stress)
 	{
@@ -337,6 +362,9 @@ int main(int argc, char **argv)
 		case 2:
 			stress_request_all(sock);
 			break;
+		case 3:
+			stress_dora(sock);
+			break;
 	}
 
 	exit(0);
@@ -432,3 +460,842 @@ static void stress_inval_lenmsgs(int sock)
 	}
 }
 
+
+/* Closed-loop stress: every virtual client runs complete exchanges with the
+ * server, and only starts the next one after the last one completed or timed
+ * out. Clients are split between threads, each with its own socket, and the
+ * thread is encoded into the xid, so a thread can tell its replies from those
+ * of the others when replies are broadcast. The xid also holds the client and
+ * the generation of its exchange, so every exchange has a new one: a late
+ * reply to an earlier exchange is dropped, and the server's cache of replies
+ * to retransmissions never answers for the handlers.
+ *
+ * Which exchange a client runs next is drawn from the weighted profiles
+ * given as NAME=WEIGHT sub-arguments. Profiles which need a lease (renew,
+ * rebind, churn, inform) run a DORA first if the client has none yet, so the
+ * known client population builds up by itself.
+ */
+
+#define STRESS_TIMEOUT 1.
+/* Bits of the xid left for the generation at least, see stress_xid */
+#define STRESS_GEN_BITS 4
+#define STRESS_HIST_LEN 640
+#define STRESS_NO_RELAY 0xFFFF
+
+enum stress_kind
+{
+	/* DISCOVER, OFFER, REQUEST, ACK */
+	STRESS_K_DORA = 0,
+	/* REQUEST with ciaddr unicast to the server, ACK */
+	STRESS_K_RENEW,
+	/* REQUEST with ciaddr broadcast, ACK */
+	STRESS_K_REBIND,
+	/* RELEASE, new hardware address, DORA */
+	STRESS_K_CHURN,
+	/* INFORM with ciaddr, ACK */
+	STRESS_K_INFORM,
+	/* DORA through one of many relay agent addresses */
+	STRESS_K_RELAY,
+	/* DISCOVER with Rapid Commit, ACK */
+	STRESS_K_RAPID,
+	STRESS_K_CNT
+};
+
+static const char *stress_kinds[STRESS_K_CNT] = {
+	"dora", "renew", "rebind", "churn", "inform", "relay", "rapid"
+};
+
+struct stress_profile
+{
+	uint32_t weights[STRESS_K_CNT];
+	uint32_t total;
+
+	/* Every burst seconds all bound clients renew or rebind at once */
+	double burst;
+
+	/* Relay agent addresses, host byte order */
+	uint32_t giaddr;
+	uint32_t giaddrs;
+};
+
+static struct stress_profile profile = {
+	.weights = {0},
+	.total = 0,
+	.burst = 0,
+	.giaddr = 0x7F000101,
+	.giaddrs = 16
+};
+
+enum stress_state
+{
+	STRESS_IDLE = 0,
+	STRESS_DISCOVERING,
+	STRESS_REQUESTING,
+	STRESS_INFORMING
+};
+
+struct stress_client
+{
+	uint8_t chaddr[6];
+	uint8_t state;
+	/* Bumped per exchange, so stale in-flight entries can be told apart */
+	uint8_t gen;
+	uint8_t kind;
+	bool bound;
+	/* Relay socket of a relayed exchange, STRESS_NO_RELAY if direct */
+	uint16_t relay;
+	/* Leased address and server, network byte order */
+	uint32_t address;
+	uint32_t server;
+	double start;
+};
+
+struct stress_stats
+{
+	uint64_t started;
+	uint64_t completed;
+	uint64_t lost;
+	uint64_t naks;
+	/* Latency histogram in microseconds, see stress_hist_idx */
+	uint64_t hist[STRESS_HIST_LEN];
+};
+
+struct stress_inflight
+{
+	uint32_t client;
+	uint8_t gen;
+};
+
+struct stress_thread
+{
+	pthread_t thread;
+	uint32_t id;
+	int sock;
+	uint32_t rng;
+
+	/* Sockets bound to the relay agent addresses of this thread */
+	int *relay_socks;
+	uint32_t *relay_addrs;
+	uint32_t relays_cnt;
+
+	struct stress_client *clients;
+	uint32_t clients_cnt;
+	/* Bits of the client in the xid, the generation gets the rest of 24 */
+	uint32_t client_bits;
+
+	/* Ring of idle clients */
+	uint32_t *idle;
+	uint32_t idle_head;
+	uint32_t idle_cnt;
+
+	/* Ring of exchanges in the order they started, for timeouts */
+	struct stress_inflight *inflight;
+	uint32_t inflight_head;
+	uint32_t inflight_cnt;
+
+	/* Exchanges per second of this thread, 0 for as fast as possible */
+	double rate;
+	double warmup_end;
+	double end;
+	double next_burst;
+
+	struct stress_stats stats[STRESS_K_CNT];
+};
+
+static double stress_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * xorshift32, every thread draws from its own state derived from -seed
+ */
+static uint32_t stress_rand(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+/**
+ * Bucket of a latency: exact below 32us, then 16 buckets per power of two,
+ * which keeps the error of any percentile below 7%.
+ */
+static size_t stress_hist_idx(uint64_t us)
+{
+	if (us < 32)
+		return us;
+
+	int k = 63 - __builtin_clzll(us);
+	size_t idx = 32 + (k - 5) * 16 + ((us >> (k - 4)) & 15);
+
+	return idx < STRESS_HIST_LEN ? idx : STRESS_HIST_LEN - 1;
+}
+
+static uint64_t stress_hist_val(size_t idx)
+{
+	if (idx < 32)
+		return idx;
+
+	return (uint64_t)(16 + (idx - 32) % 16) << ((idx - 32) / 16 + 1);
+}
+
+static uint64_t stress_hist_pct(struct stress_stats *stats, double pct)
+{
+	uint64_t cnt = 0, want = stats->completed * pct;
+
+	for (size_t i = 0; i < STRESS_HIST_LEN; ++i)
+		if ((cnt += stats->hist[i]) > want)
+			return stress_hist_val(i);
+
+	return 0;
+}
+
+static void stress_stats_add(struct stress_stats *dst, const struct stress_stats *src)
+{
+	dst->started += src->started;
+	dst->completed += src->completed;
+	dst->lost += src->lost;
+	dst->naks += src->naks;
+
+	for (size_t i = 0; i < STRESS_HIST_LEN; ++i)
+		dst->hist[i] += src->hist[i];
+}
+
+/**
+ * Build a client message
+ *
+ * @param[out] buf Buffer of at least DHCP_MSG_LEN bytes
+ * @param[in] type Message type
+ * @param[in] xid Transaction id
+ * @param[in] chaddr Hardware address, 6 bytes
+ * @param[in] ciaddr Client address or 0, network byte order
+ * @param[in] reqaddr Requested address (50) or 0, network byte order
+ * @param[in] server Server identifier (54) or 0, network byte order
+ * @return Length of the message
+ */
+static size_t stress_msg(uint8_t *buf, enum dhcp_msg_type type, uint32_t xid,
+	const uint8_t *chaddr, uint32_t ciaddr, uint32_t reqaddr, uint32_t server)
+{
+	size_t send_len = DHCP_MSG_HDRLEN;
+	memset(buf, 0, DHCP_MSG_LEN);
+	*DHCP_MSG_F_OP(buf) = 1;
+	*DHCP_MSG_F_HTYPE(buf) = 1;
+	*DHCP_MSG_F_HLEN(buf) = 6;
+	*DHCP_MSG_F_XID(buf) = xid;
+	*DHCP_MSG_F_CIADDR(buf) = ciaddr;
+	ARRAY_COPY(DHCP_MSG_F_CHADDR(buf), chaddr, 6);
+	ARRAY_COPY(DHCP_MSG_F_MAGIC(buf), DHCP_MSG_MAGIC, 4);
+
+	uint8_t *options = DHCP_MSG_F_OPTIONS(buf);
+
+	options[0] = DHCP_OPT_MSGTYPE;
+	options[1] = 1;
+	options[2] = type;
+	DHCP_OPT_CONT(options, send_len);
+
+	if (reqaddr != 0) {
+		options[0] = DHCP_OPT_REQIPADDR;
+		options[1] = 4;
+		memcpy(options + 2, &reqaddr, 4);
+		DHCP_OPT_CONT(options, send_len);
+	}
+
+	if (server != 0) {
+		options[0] = DHCP_OPT_SERVERID;
+		options[1] = 4;
+		memcpy(options + 2, &server, 4);
+		DHCP_OPT_CONT(options, send_len);
+	}
+
+	options[0] = DHCP_OPT_PARAMLIST;
+	options[1] = 3;
+	options[2] = DHCP_OPT_NETMASK;
+	options[3] = DHCP_OPT_ROUTER;
+	options[4] = DHCP_OPT_DNS;
+	DHCP_OPT_CONT(options, send_len);
+
+	options[0] = DHCP_OPT_END;
+	DHCP_OPT_CONT(options, send_len);
+
+	return send_len;
+}
+
+/**
+ * Turn a client message into a relayed one, with giaddr and a relay agent
+ * information option carrying the relay number as circuit id
+ *
+ * @return New length of the message
+ */
+static size_t stress_msg_relay(uint8_t *buf, size_t len, uint32_t giaddr, uint16_t circuit)
+{
+	*DHCP_MSG_F_HOPS(buf) = 1;
+	*DHCP_MSG_F_GIADDR(buf) = giaddr;
+
+	/* Replace the END option */
+	buf[len - 1] = DHCP_OPT_RELAYINFO;
+	buf[len++] = 4;
+	buf[len++] = 1;
+	buf[len++] = 2;
+	buf[len++] = circuit >> 8;
+	buf[len++] = circuit & 0xFF;
+	buf[len++] = DHCP_OPT_END;
+
+	return len;
+}
+
+/**
+ * Add Rapid Commit (80) to a client message
+ *
+ * @return New length of the message
+ */
+static size_t stress_msg_rapid(uint8_t *buf, size_t len)
+{
+	/* Replace the END option */
+	buf[len - 1] = DHCP_OPT_RAPIDCOMMIT;
+	buf[len++] = 0;
+	buf[len++] = DHCP_OPT_END;
+
+	return len;
+}
+
+/**
+ * Parse a server message
+ *
+ * @param[out] type Message type
+ * @param[out] server Server identifier, network byte order
+ * @return Whether buf holds a server message
+ */
+static bool stress_reply(uint8_t *buf, size_t len,
+	enum dhcp_msg_type *type, uint32_t *server)
+{
+	if (len < DHCP_MSG_HDRLEN + 1 || *DHCP_MSG_F_OP(buf) != 2)
+		return false;
+
+	uint8_t *magic = DHCP_MSG_F_MAGIC(buf);
+	if (!DHCP_MSG_MAGIC_CHECK(magic))
+		return false;
+
+	uint8_t *options = DHCP_MSG_F_OPTIONS(buf);
+	struct dhcp_opt current_opt;
+
+	*type = 0;
+	*server = 0;
+
+	while (dhcp_opt_next(&options, &current_opt, buf + len))
+		if (current_opt.code == DHCP_OPT_MSGTYPE && current_opt.len == 1)
+			*type = (enum dhcp_msg_type)current_opt.data[0];
+		else if (current_opt.code == DHCP_OPT_SERVERID && current_opt.len == 4)
+			memcpy(server, current_opt.data, 4);
+
+	return *type != 0;
+}
+
+/**
+ * Send a client message, to the server if it is known, otherwise to the
+ * remote address. Relayed messages are sent from the relay socket.
+ */
+static void stress_send(struct stress_thread *t, struct stress_client *c,
+	uint8_t *buf, size_t len, uint32_t server)
+{
+	struct sockaddr_in dest = cfg.remote;
+	int sock = t->sock;
+
+	if (server != 0)
+		dest.sin_addr.s_addr = server;
+
+	if (c->relay != STRESS_NO_RELAY) {
+		len = stress_msg_relay(buf, len, t->relay_addrs[c->relay],
+			t->id << 8 | c->relay);
+		sock = t->relay_socks[c->relay];
+	}
+
+	sendto(sock, buf, len, MSG_DONTWAIT, (struct sockaddr *)&dest, sizeof dest);
+}
+
+static enum stress_kind stress_pick(struct stress_thread *t)
+{
+	uint32_t r = stress_rand(&t->rng) % profile.total;
+
+	for (enum stress_kind k = 0; k < STRESS_K_CNT; ++k)
+	{
+		if (r < profile.weights[k])
+			return k;
+
+		r -= profile.weights[k];
+	}
+
+	return STRESS_K_DORA;
+}
+
+/**
+ * Remember a started exchange for its timeout. Finished exchanges stay in
+ * the ring until they reach its head, so behind a slow exchange the ring can
+ * fill up with them. It holds twice as many entries as there are clients, so
+ * dropping the finished ones always makes room.
+ */
+static void stress_inflight_push(struct stress_thread *t, uint32_t i)
+{
+	uint32_t cap = 2 * t->clients_cnt;
+
+	if (t->inflight_cnt == cap)
+	{
+		uint32_t cnt = 0;
+
+		for (uint32_t n = 0; n < t->inflight_cnt; ++n)
+		{
+			struct stress_inflight f = t->inflight[(t->inflight_head + n) % cap];
+			struct stress_client *c = &t->clients[f.client];
+
+			if (c->gen == f.gen && c->state != STRESS_IDLE)
+				t->inflight[(t->inflight_head + cnt++) % cap] = f;
+		}
+
+		t->inflight_cnt = cnt;
+	}
+
+	t->inflight[(t->inflight_head + t->inflight_cnt++) % cap] =
+		(struct stress_inflight){ .client = i, .gen = t->clients[i].gen };
+}
+
+/**
+ * Transaction id of the exchange a client runs, in host byte order: the
+ * thread, the generation of the exchange and the client
+ */
+static uint32_t stress_xid(const struct stress_thread *t, uint32_t i)
+{
+	uint32_t gen = t->clients[i].gen & ((1U << (24 - t->client_bits)) - 1);
+
+	return t->id << 24 | gen << t->client_bits | i;
+}
+
+static void stress_start(struct stress_thread *t, uint32_t i,
+	enum stress_kind kind, double now)
+{
+	uint8_t buf[DHCP_MSG_LEN];
+	struct stress_client *c = &t->clients[i];
+	uint32_t xid;
+
+	if (!c->bound && kind != STRESS_K_RELAY && kind != STRESS_K_RAPID)
+		kind = STRESS_K_DORA;
+
+	if (kind == STRESS_K_RELAY && t->relays_cnt == 0)
+		kind = STRESS_K_DORA;
+
+	c->kind = kind;
+	c->start = now;
+	c->relay = STRESS_NO_RELAY;
+	++c->gen;
+
+	xid = htonl(stress_xid(t, i));
+
+	stress_inflight_push(t, i);
+
+	if (now >= t->warmup_end)
+		++t->stats[kind].started;
+
+	switch (kind)
+	{
+		case STRESS_K_RENEW:
+			c->state = STRESS_REQUESTING;
+			stress_send(t, c, buf, stress_msg(buf, DHCPREQUEST, xid,
+				c->chaddr, c->address, 0, 0), c->server);
+			return;
+
+		case STRESS_K_REBIND:
+			c->state = STRESS_REQUESTING;
+			stress_send(t, c, buf, stress_msg(buf, DHCPREQUEST, xid,
+				c->chaddr, c->address, 0, 0), 0);
+			return;
+
+		case STRESS_K_INFORM:
+			c->state = STRESS_INFORMING;
+			stress_send(t, c, buf, stress_msg(buf, DHCPINFORM, xid,
+				c->chaddr, c->address, 0, 0), 0);
+			return;
+
+		case STRESS_K_CHURN:
+			/* The client leaves and comes back with another hardware address,
+			 * the upper bits of the first byte keep it unique.
+			 */
+			stress_send(t, c, buf, stress_msg(buf, DHCPRELEASE, xid,
+				c->chaddr, c->address, 0, c->server), c->server);
+			c->bound = false;
+			c->chaddr[0] = (c->chaddr[0] + 4) | 0x02;
+			break;
+
+		case STRESS_K_RELAY:
+			c->relay = stress_rand(&t->rng) % t->relays_cnt;
+			break;
+
+		default:
+			break;
+	}
+
+	size_t len = stress_msg(buf, DHCPDISCOVER, xid, c->chaddr, 0, 0, 0);
+
+	if (kind == STRESS_K_RAPID)
+		len = stress_msg_rapid(buf, len);
+
+	c->state = STRESS_DISCOVERING;
+	stress_send(t, c, buf, len, 0);
+}
+
+static void stress_done(struct stress_thread *t, uint32_t i)
+{
+	t->clients[i].state = STRESS_IDLE;
+	t->idle[(t->idle_head + t->idle_cnt++) % t->clients_cnt] = i;
+}
+
+static void stress_recv(struct stress_thread *t, uint8_t *buf, size_t len, double now)
+{
+	enum dhcp_msg_type type;
+	uint32_t server;
+	uint32_t xid = ntohl(*DHCP_MSG_F_XID(buf));
+
+	if (!stress_reply(buf, len, &type, &server))
+		return;
+
+	uint32_t i = xid & ((1U << t->client_bits) - 1);
+
+	/* Replies to other threads, to clients we don't have, or late ones to
+	 * an earlier exchange
+	 */
+	if (xid >> 24 != t->id || i >= t->clients_cnt || xid != stress_xid(t, i))
+		return;
+
+	struct stress_client *c = &t->clients[i];
+	struct stress_stats *stats = &t->stats[c->kind];
+	bool measured = c->start >= t->warmup_end;
+
+	if (c->state == STRESS_DISCOVERING && type == DHCPOFFER)
+	{
+		uint8_t msg[DHCP_MSG_LEN];
+
+		c->state = STRESS_REQUESTING;
+		c->address = *DHCP_MSG_F_YIADDR(buf);
+		c->server = server;
+
+		stress_send(t, c, msg, stress_msg(msg, DHCPREQUEST,
+			htonl(xid), c->chaddr, 0, c->address, c->server), 0);
+	}
+	else if ((c->state == STRESS_REQUESTING || c->state == STRESS_INFORMING ||
+			(c->state == STRESS_DISCOVERING && c->kind == STRESS_K_RAPID)) &&
+			type == DHCPACK)
+	{
+		if (measured) {
+			++stats->completed;
+			++stats->hist[stress_hist_idx((now - c->start) * 1e6)];
+		}
+
+		if (c->state != STRESS_INFORMING) {
+			c->bound = true;
+			c->address = *DHCP_MSG_F_YIADDR(buf);
+			c->server = server ? server : c->server;
+		}
+
+		stress_done(t, i);
+	}
+	else if (c->state == STRESS_REQUESTING && type == DHCPNAK)
+	{
+		if (measured)
+			++stats->naks;
+
+		c->bound = false;
+		stress_done(t, i);
+	}
+}
+
+/**
+ * Drop finished exchanges from the in-flight ring and time out the ones
+ * which took too long. Exchanges time out in the order they started.
+ */
+static void stress_expire(struct stress_thread *t, double now)
+{
+	while (t->inflight_cnt > 0)
+	{
+		struct stress_inflight *f = &t->inflight[t->inflight_head];
+		struct stress_client *c = &t->clients[f->client];
+
+		if (c->gen == f->gen && c->state != STRESS_IDLE)
+		{
+			if (c->start + STRESS_TIMEOUT > now)
+				break;
+
+			if (c->start >= t->warmup_end)
+				++t->stats[c->kind].lost;
+
+			stress_done(t, f->client);
+		}
+
+		t->inflight_head = (t->inflight_head + 1) % (2 * t->clients_cnt);
+		--t->inflight_cnt;
+	}
+}
+
+/**
+ * Let every idle bound client renew or rebind at once, like after a
+ * partition of the network heals
+ */
+static void stress_burst(struct stress_thread *t, double now)
+{
+	uint32_t renew = profile.weights[STRESS_K_RENEW];
+	uint32_t rebind = profile.weights[STRESS_K_REBIND];
+
+	for (uint32_t n = t->idle_cnt; n > 0; --n)
+	{
+		uint32_t i = t->idle[t->idle_head];
+
+		t->idle_head = (t->idle_head + 1) % t->clients_cnt;
+		--t->idle_cnt;
+
+		if (!t->clients[i].bound) {
+			stress_done(t, i);
+			continue;
+		}
+
+		if (renew + rebind > 0 && stress_rand(&t->rng) % (renew + rebind) >= renew)
+			stress_start(t, i, STRESS_K_REBIND, now);
+		else
+			stress_start(t, i, STRESS_K_RENEW, now);
+	}
+}
+
+static void *stress_thread(void *arg)
+{
+	struct stress_thread *t = (struct stress_thread *)arg;
+	uint8_t buf[RECV_BUF_LEN];
+	double now = stress_now();
+	double next = now;
+
+	struct pollfd *fds = calloc(t->relays_cnt + 1, sizeof(struct pollfd));
+
+	fds[0] = (struct pollfd){ .fd = t->sock, .events = POLLIN };
+	for (uint32_t r = 0; r < t->relays_cnt; ++r)
+		fds[r + 1] = (struct pollfd){ .fd = t->relay_socks[r], .events = POLLIN };
+
+	while ((now = stress_now()) < t->end)
+	{
+		if (profile.burst > 0 && now >= t->next_burst) {
+			stress_burst(t, now);
+			t->next_burst += profile.burst;
+		}
+
+		while (t->idle_cnt > 0 && (t->rate == 0 || next <= now))
+		{
+			uint32_t i = t->idle[t->idle_head];
+
+			t->idle_head = (t->idle_head + 1) % t->clients_cnt;
+			--t->idle_cnt;
+
+			stress_start(t, i, stress_pick(t), now);
+
+			/* Don't catch up on starts missed while all clients were busy */
+			if (t->rate > 0)
+				next = next + 1 / t->rate < now ? now : next + 1 / t->rate;
+		}
+
+		int timeout = 10;
+
+		if (t->rate > 0 && t->idle_cnt > 0 && next > now)
+			timeout = (next - now) * 1000;
+
+		poll(fds, t->relays_cnt + 1, timeout);
+
+		for (uint32_t r = 0; r <= t->relays_cnt; ++r)
+		{
+			ssize_t recvd;
+
+			while ((recvd = recv(fds[r].fd, buf, sizeof buf, MSG_DONTWAIT)) > 0)
+				stress_recv(t, buf, recvd, stress_now());
+		}
+
+		stress_expire(t, stress_now());
+	}
+
+	free(fds);
+
+	return NULL;
+}
+
+/**
+ * Parse the NAME=VALUE sub-arguments after the positional ones
+ */
+static void stress_profile_parse(int argc, char **argv)
+{
+	for (int i = 0; i < argc; ++i)
+	{
+		char *val = strchr(argv[i], '=');
+		bool found = false;
+
+		if (val == NULL)
+			dhcpd_error(1, 0, "Invalid profile %s, expected NAME=VALUE", argv[i]);
+
+		*val++ = 0;
+
+		for (enum stress_kind k = 0; k < STRESS_K_CNT; ++k)
+			if (!strcmp(argv[i], stress_kinds[k])) {
+				profile.weights[k] = atoi(val);
+				found = true;
+			}
+
+		if (found)
+			continue;
+
+		if (!strcmp(argv[i], "burst"))
+			profile.burst = atof(val);
+		else if (!strcmp(argv[i], "giaddrs"))
+			profile.giaddrs = atoi(val);
+		else if (!strcmp(argv[i], "giaddr")) {
+			if (inet_pton(AF_INET, val, &profile.giaddr) != 1)
+				dhcpd_error(1, 0, "Invalid relay agent address: %s", val);
+			profile.giaddr = ntohl(profile.giaddr);
+		}
+		else
+			dhcpd_error(1, 0, "Unknown profile %s", argv[i]);
+	}
+
+	for (enum stress_kind k = 0; k < STRESS_K_CNT; ++k)
+		profile.total += profile.weights[k];
+
+	if (profile.total == 0) {
+		profile.weights[STRESS_K_DORA] = 1;
+		profile.total = 1;
+	}
+}
+
+static void stress_dora(int sock)
+{
+	if (cfg.argv->subargc < 2)
+		dhcpd_error(1, 0, "Usage: ... -- CLIENTS THREADS [RATE [WARMUP [DURATION]]] [NAME=VALUE]...\n"
+			"  NAME is a profile whose VALUE is its weight: %s, %s, %s, %s, %s, %s\n"
+			"  or one of burst=SECONDS giaddr=IP giaddrs=COUNT",
+			stress_kinds[0], stress_kinds[1], stress_kinds[2],
+			stress_kinds[3], stress_kinds[4], stress_kinds[5]);
+
+	int pos = 0;
+
+	while (pos < cfg.argv->subargc && pos < 5 && strchr(cfg.argv->subargv[pos], '=') == NULL)
+		++pos;
+
+	stress_profile_parse(cfg.argv->subargc - pos, cfg.argv->subargv + pos);
+
+	uint32_t clients = atoi(cfg.argv->subargv[0]);
+	uint32_t threads = atoi(cfg.argv->subargv[1]);
+	double rate = pos > 2 ? atof(cfg.argv->subargv[2]) : 0;
+	double warmup = pos > 3 ? atof(cfg.argv->subargv[3]) : 1;
+	double duration = pos > 4 ? atof(cfg.argv->subargv[4]) : 10;
+
+	if (threads == 0 || threads > 255 || clients < threads ||
+			clients / threads >= 1U << (24 - STRESS_GEN_BITS))
+		dhcpd_error(1, 0, "Invalid number of clients or threads");
+
+	if (profile.weights[STRESS_K_RELAY] > 0 && profile.giaddrs > 0xFFFF)
+		dhcpd_error(1, 0, "Invalid number of relay agent addresses");
+
+	struct stress_thread *t = calloc(threads, sizeof(struct stress_thread));
+	double start = stress_now();
+	uint32_t seed = cfg.seed;
+
+	for (uint32_t n = 0; n < threads; ++n)
+	{
+		t[n].id = n;
+		t[n].sock = n == 0 ? sock : stress_socket(&cfg.local);
+		t[n].rng = (seed ^ (n + 1) * 2654435761U) | 1;
+		t[n].clients_cnt = clients / threads + (n < clients % threads);
+		t[n].clients = calloc(t[n].clients_cnt, sizeof(struct stress_client));
+
+		while (1U << t[n].client_bits < t[n].clients_cnt)
+			++t[n].client_bits;
+
+		t[n].idle = calloc(t[n].clients_cnt, sizeof(uint32_t));
+		t[n].inflight = calloc(2 * t[n].clients_cnt, sizeof(struct stress_inflight));
+		t[n].rate = rate / threads;
+		t[n].warmup_end = start + warmup;
+		t[n].end = start + warmup + duration;
+		t[n].next_burst = start + profile.burst;
+
+		/* Relay agent addresses are dealt out to the threads, each one
+		 * listens on the server port of its addresses for the replies
+		 */
+		if (profile.weights[STRESS_K_RELAY] > 0)
+		{
+			t[n].relays_cnt = profile.giaddrs / threads + (n < profile.giaddrs % threads);
+			t[n].relay_socks = calloc(t[n].relays_cnt, sizeof(int));
+			t[n].relay_addrs = calloc(t[n].relays_cnt, sizeof(uint32_t));
+
+			for (uint32_t r = 0; r < t[n].relays_cnt; ++r)
+			{
+				struct sockaddr_in local = {
+					.sin_family = AF_INET,
+					.sin_port = cfg.remote.sin_port,
+					.sin_addr = { htonl(profile.giaddr + r * threads + n) }
+				};
+
+				t[n].relay_addrs[r] = local.sin_addr.s_addr;
+				t[n].relay_socks[r] = stress_socket(&local);
+			}
+		}
+
+		for (uint32_t i = 0; i < t[n].clients_cnt; ++i)
+		{
+			/* Locally administered unicast addresses, unique per thread and
+			 * client, and reproducible from the seed
+			 */
+			uint32_t val = seed ^ (n << 24 | i);
+
+			t[n].clients[i].chaddr[0] = 0x02;
+			t[n].clients[i].chaddr[1] = n;
+			memcpy(t[n].clients[i].chaddr + 2, &val, 4);
+
+			stress_done(&t[n], i);
+		}
+
+		if (pthread_create(&t[n].thread, NULL, stress_thread, &t[n]) != 0)
+			dhcpd_error(1, errno, "Could not create thread");
+	}
+
+	struct stress_stats total[STRESS_K_CNT + 1];
+
+	memset(total, 0, sizeof total);
+
+	for (uint32_t n = 0; n < threads; ++n)
+	{
+		pthread_join(t[n].thread, NULL);
+
+		for (enum stress_kind k = 0; k < STRESS_K_CNT; ++k) {
+			stress_stats_add(&total[k], &t[n].stats[k]);
+			stress_stats_add(&total[STRESS_K_CNT], &t[n].stats[k]);
+		}
+	}
+
+	/* Exchanges still in flight at the end are neither completed nor lost */
+	printf("clients %u threads %u duration %.1fs\n", clients, threads, duration);
+
+	for (size_t j = 0; j <= STRESS_K_CNT; ++j)
+	{
+		if (total[j].started == 0)
+			continue;
+
+		printf("%-6s started %llu completed %llu lost %llu (%.2f%%) nak %llu\n"
+			"       rate %.0f/s latency p50 %lluus p99 %lluus p999 %lluus\n",
+			j < STRESS_K_CNT ? stress_kinds[j] : "total",
+			(unsigned long long)total[j].started,
+			(unsigned long long)total[j].completed,
+			(unsigned long long)total[j].lost,
+			100. * total[j].lost / total[j].started,
+			(unsigned long long)total[j].naks,
+			total[j].completed / duration,
+			(unsigned long long)stress_hist_pct(&total[j], .5),
+			(unsigned long long)stress_hist_pct(&total[j], .99),
+			(unsigned long long)stress_hist_pct(&total[j], .999));
+	}
+}
@@ -0,0 +1,338 @@
+#include "events.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+static const char *const events_names[] = {
+	[EVENTS_GAP] = "gap",
+	[EVENTS_BOUND] = "bound",
+	[EVENTS_RENEWED] = "renewed",
+	[EVENTS_RELEASED] = "released",
+	[EVENTS_EXPIRED] = "expired"
+};
+
+static void events_close(struct events_subscriber *sub)
+{
+	struct events *ev = sub->events;
+	struct events_subscriber **link = &ev->subscribers;
+
+	while (*link != sub)
+		link = &(*link)->next;
+
+	*link = sub->next;
+	--ev->subscribers_cnt;
+
+	ev_io_stop(ev->loop, &sub->watch);
+	close(sub->fd);
+	free(sub);
+}
+
+/**
+ * Watch the socket of a subscriber for writability as well, or not
+ */
+static void events_want_write(struct events_subscriber *sub, bool write)
+{
+	int want = EV_READ | (write ? EV_WRITE : 0);
+
+	if ((sub->watch.events & (EV_READ | EV_WRITE)) == want)
+		return;
+
+	ev_io_stop(sub->events->loop, &sub->watch);
+	ev_io_set(&sub->watch, sub->fd, want);
+	ev_io_start(sub->events->loop, &sub->watch);
+}
+
+static size_t events_put_hex(char *out, const uint8_t *data, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		out[2 * i] = hex[data[i] >> 4];
+		out[2 * i + 1] = hex[data[i] & 0x0f];
+	}
+
+	return 2 * len;
+}
+
+/**
+ * Format a record as a line of JSON
+ *
+ * @return Length of the line, or 0 if it does not fit
+ */
+static size_t events_format_json(const struct events_record *r, uint64_t lost,
+	char *out, size_t size)
+{
+	char address[INET_ADDRSTRLEN];
+	char client[2 * EVENTS_CLIENT_MAXLEN + 1];
+	int len;
+
+	if (r->type == EVENTS_GAP) {
+		len = snprintf(out, size, "{\"seq\":%" PRIu64 ",\"time\":%.3f,\"event\":\"gap\","
+			"\"lost\":%" PRIu64 "}\n", r->seq, r->time, lost);
+	} else {
+		inet_ntop(AF_INET, &r->address, address, sizeof address);
+		client[events_put_hex(client, r->client, r->client_len)] = 0;
+
+		len = snprintf(out, size, "{\"seq\":%" PRIu64 ",\"time\":%.3f,\"event\":\"%s\","
+			"\"address\":\"%s\",\"client\":\"%s\",\"hostname\":\"%.*s\",\"expires\":%.0f}\n",
+			r->seq, r->time, events_names[r->type], address, client,
+			r->hostname_len, (const char *)r->hostname, r->expires);
+	}
+
+	return len > 0 && (size_t)len < size ? (size_t)len : 0;
+}
+
+/**
+ * Format a record in binary, see events.h
+ *
+ * @return Length of the record, or 0 if it does not fit
+ */
+static size_t events_format_binary(const struct events_record *r, uint64_t lost,
+	uint8_t *out, size_t size)
+{
+	size_t len = 24 + r->client_len + r->hostname_len;
+
+	if (len > size)
+		return 0;
+
+	uint32_t seq_hi = htonl(r->seq >> 32);
+	uint32_t seq_lo = htonl(r->seq & 0xffffffff);
+	uint32_t time = htonl((uint32_t)r->time);
+	uint32_t expires = htonl(r->type == EVENTS_GAP ? (uint32_t)lost : (uint32_t)r->expires);
+
+	out[0] = r->type;
+	out[1] = r->client_len;
+	out[2] = r->hostname_len;
+	out[3] = 0;
+	memcpy(out + 4, &seq_hi, 4);
+	memcpy(out + 8, &seq_lo, 4);
+	memcpy(out + 12, &time, 4);
+	memcpy(out + 16, &expires, 4);
+	memcpy(out + 20, &r->address.s_addr, 4);
+	memcpy(out + 24, r->client, r->client_len);
+	memcpy(out + 24 + r->client_len, r->hostname, r->hostname_len);
+
+	return len;
+}
+
+static size_t events_format(const struct events_subscriber *sub,
+	const struct events_record *r, uint64_t lost, uint8_t *out, size_t size)
+{
+	if (sub->binary)
+		return events_format_binary(r, lost, out, size);
+
+	return events_format_json(r, lost, (char *)out, size);
+}
+
+/**
+ * Fill the buffer of a subscriber from its cursor
+ */
+static void events_fill(struct events_subscriber *sub)
+{
+	struct events *ev = sub->events;
+	uint64_t oldest = ev->head > EVENTS_RING ? ev->head - EVENTS_RING : 1;
+
+	sub->off = 0;
+	sub->len = 0;
+
+	if (sub->cursor < oldest) {
+		struct events_record gap = {
+			.seq = oldest,
+			.time = ev_now(ev->loop),
+			.type = EVENTS_GAP
+		};
+		uint64_t lost = oldest - sub->cursor;
+
+		sub->len = events_format(sub, &gap, lost, sub->buf, sizeof sub->buf);
+		sub->cursor = oldest;
+		ev->lost += lost;
+	}
+
+	while (sub->cursor < ev->head)
+	{
+		const struct events_record *r = &ev->ring[sub->cursor & (EVENTS_RING - 1)];
+		size_t len = events_format(sub, r, 0, sub->buf + sub->len, sizeof sub->buf - sub->len);
+
+		if (len == 0)
+			break;
+
+		sub->len += len;
+		++sub->cursor;
+	}
+}
+
+/**
+ * Write to a subscriber until it is up to date or its socket is full, and
+ * watch for it to drain in that case
+ */
+static void events_write(struct events_subscriber *sub)
+{
+	for (;;)
+	{
+		if (sub->off == sub->len)
+			events_fill(sub);
+
+		if (sub->len == 0) {
+			events_want_write(sub, false);
+			return;
+		}
+
+		ssize_t len = send(sub->fd, sub->buf + sub->off, sub->len - sub->off,
+			MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				events_want_write(sub, true);
+			else
+				events_close(sub);
+
+			return;
+		}
+
+		sub->off += len;
+	}
+}
+
+static void events_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)EV_A;
+
+	struct events_subscriber *sub = w->data;
+
+	if (revents & EV_READ) {
+		uint8_t buf[256];
+		ssize_t len = recv(sub->fd, buf, sizeof buf, MSG_DONTWAIT);
+
+		/* Subscribers have nothing to say, they can only hang up */
+		if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+			events_close(sub);
+			return;
+		}
+	}
+
+	if (revents & EV_WRITE)
+		events_write(sub);
+}
+
+static void events_flush_cb(EV_P_ ev_timer *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	struct events *ev = w->data;
+	struct events_subscriber *sub = ev->subscribers;
+
+	while (sub != NULL)
+	{
+		struct events_subscriber *next = sub->next;
+
+		/* The others wait for their socket to drain */
+		if (!(sub->watch.events & EV_WRITE))
+			events_write(sub);
+
+		sub = next;
+	}
+}
+
+struct events *events_create(struct ev_loop *loop)
+{
+	struct events *ev = calloc(1, sizeof(struct events));
+
+	if (ev == NULL)
+		return NULL;
+
+	ev->loop = loop;
+	ev->head = 1;
+
+	ev_init(&ev->flush_watch, events_flush_cb);
+	ev->flush_watch.data = ev;
+
+	return ev;
+}
+
+void events_destroy(struct events *ev)
+{
+	while (ev->subscribers != NULL)
+		events_close(ev->subscribers);
+
+	ev_timer_stop(ev->loop, &ev->flush_watch);
+
+	free(ev);
+}
+
+void events_publish(struct events *ev, const struct server_event *e)
+{
+	static const uint8_t types[] = {
+		[SERVER_EVENT_BOUND] = EVENTS_BOUND,
+		[SERVER_EVENT_RENEWED] = EVENTS_RENEWED,
+		[SERVER_EVENT_RELEASED] = EVENTS_RELEASED,
+		[SERVER_EVENT_EXPIRED] = EVENTS_EXPIRED
+	};
+
+	struct events_record *r = &ev->ring[ev->head & (EVENTS_RING - 1)];
+
+	r->seq = ev->head++;
+	r->time = ev_now(ev->loop);
+	r->expires = e->expires;
+	r->address = e->address;
+	r->type = types[e->type];
+
+	r->client_len = 0;
+	r->hostname_len = 0;
+
+	if (e->client != NULL) {
+		r->client_len = e->client_len < EVENTS_CLIENT_MAXLEN ? e->client_len : EVENTS_CLIENT_MAXLEN;
+		memcpy(r->client, e->client, r->client_len);
+	}
+
+	if (e->hostname != NULL) {
+		r->hostname_len = e->hostname_len;
+		memcpy(r->hostname, e->hostname, r->hostname_len);
+	}
+
+	++ev->published;
+
+	if (ev->subscribers != NULL && !ev_is_active(&ev->flush_watch)) {
+		ev_timer_set(&ev->flush_watch, EVENTS_DELAY, 0);
+		ev_timer_start(ev->loop, &ev->flush_watch);
+	}
+}
+
+bool events_subscribe(struct events *ev, int fd, bool binary, bool replay)
+{
+	struct events_subscriber *sub = NULL;
+
+	if (ev->subscribers_cnt < EVENTS_SUBSCRIBERS)
+		sub = calloc(1, sizeof(struct events_subscriber));
+
+	if (sub == NULL) {
+		close(fd);
+		return false;
+	}
+
+	sub->events = ev;
+	sub->fd = fd;
+	sub->binary = binary;
+	sub->cursor = ev->head;
+
+	if (replay)
+		sub->cursor = ev->head > EVENTS_RING ? ev->head - EVENTS_RING : 1;
+
+	sub->next = ev->subscribers;
+	ev->subscribers = sub;
+	++ev->subscribers_cnt;
+
+	ev_io_init(&sub->watch, events_cb, fd, EV_READ | (sub->cursor < ev->head ? EV_WRITE : 0));
+	sub->watch.data = sub;
+	ev_io_start(ev->loop, &sub->watch);
+
+	return true;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+#include <ev.h>
+
+#include "server.h"
+
+/* A stream of lease events for subscribers on stream sockets, e.g. for
+ * monitoring or a captive portal.
+ *
+ * Events go into a ring of the latest EVENTS_RING of them, numbered in
+ * order. Every subscriber has a cursor into the ring. Subscribers are
+ * written to EVENTS_DELAY after an event, with all events since, and
+ * whenever a full socket drains, so publishing an event costs the same
+ * no matter how many subscribers there are or how slow they read. A
+ * subscriber which falls behind by more than the ring holds loses the
+ * oldest events, and gets a gap marker with their number instead.
+ *
+ * Events are JSON objects, one per line:
+ *
+ *     {"seq":1,"time":1700000000.123,"event":"bound","address":"10.0.0.10",
+ *      "client":"01020000000001","hostname":"laptop","expires":1700003600}
+ *     {"seq":2,"time":1700000000.456,"event":"gap","lost":17}
+ *
+ * or binary records: a 24 byte header of type, client key length, host
+ * name length, a zero byte, the 64 bit sequence number, time, expiry and
+ * address as 32 bit numbers, all in network byte order, followed by the
+ * client key and the host name. The expiry of a gap is the number of lost
+ * events.
+ */
+
+/* Events kept for subscribers, a power of two */
+#define EVENTS_RING 4096
+/* Subscribers at most */
+#define EVENTS_SUBSCRIBERS 64
+
+/* Seconds events are collected before they are written */
+#define EVENTS_DELAY 0.01
+
+/* Longer client keys are cut */
+#define EVENTS_CLIENT_MAXLEN 64
+
+enum events_type
+{
+	EVENTS_GAP,
+	EVENTS_BOUND,
+	EVENTS_RENEWED,
+	EVENTS_RELEASED,
+	EVENTS_EXPIRED
+};
+
+struct events_record
+{
+	uint64_t seq;
+	ev_tstamp time;
+	ev_tstamp expires;
+	struct in_addr address;
+	uint8_t type;
+	uint8_t client_len;
+	uint8_t hostname_len;
+	uint8_t client[EVENTS_CLIENT_MAXLEN];
+	uint8_t hostname[63];
+};
+
+struct events_subscriber
+{
+	struct events *events;
+	int fd;
+	bool binary;
+	/* Sequence number of the next event to send */
+	uint64_t cursor;
+
+	ev_io watch;
+
+	/* Formatted events not written yet */
+	uint8_t buf[16384];
+	size_t off;
+	size_t len;
+
+	struct events_subscriber *next;
+};
+
+struct events
+{
+	struct ev_loop *loop;
+
+	struct events_record ring[EVENTS_RING];
+	/* Sequence number of the next event, the first is 1 */
+	uint64_t head;
+
+	struct events_subscriber *subscribers;
+	size_t subscribers_cnt;
+	ev_timer flush_watch;
+
+	/* Events published, and lost by subscribers in gaps */
+	uint64_t published;
+	uint64_t lost;
+};
+
+extern struct events *events_create(struct ev_loop *loop);
+
+/**
+ * Close all subscribers and free the stream
+ */
+extern void events_destroy(struct events *ev);
+
+/**
+ * Put an event into the ring and wake up the subscribers
+ *
+ * @param[in] ev Stream
+ * @param[in] e Event of the server
+ */
+extern void events_publish(struct events *ev, const struct server_event *e);
+
+/**
+ * Add a subscriber
+ *
+ * @param[in] ev Stream
+ * @param[in] fd Connected stream socket, owned by the stream afterwards
+ * @param[in] binary Whether to send binary records instead of JSON
+ * @param[in] replay Whether to start with the events still in the ring
+ *                   instead of the next one
+ * @return Whether it was added, false if there are too many, in which case
+ *         fd is closed
+ */
+extern bool events_subscribe(struct events *ev, int fd, bool binary, bool replay);
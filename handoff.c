@@ -0,0 +1,685 @@
+#include "handoff.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "error.h"
+
+/* Seconds a successor waits for each answer of the server, and the server
+ * for a successor it stopped for to serve
+ */
+#define HANDOFF_TIMEOUT 10
+
+/* Buffer the state is written through */
+#define HANDOFF_BUF_LEN 65536
+
+/**
+ * Send a message with descriptors
+ */
+static bool handoff_send_fds(int conn, const struct handoff_msg *m,
+	const int *fds, size_t cnt)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(struct handoff_fds))];
+	} control;
+	struct iovec iov = { .iov_base = (void *)m, .iov_len = sizeof *m };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = CMSG_SPACE(cnt * sizeof(int))
+	};
+
+	memset(&control, 0, sizeof control);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(cnt * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, cnt * sizeof(int));
+
+	return sendmsg(conn, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof *m;
+}
+
+/**
+ * Receive a message with descriptors
+ *
+ * @param[out] fds Descriptors received
+ * @return Number of descriptors, or -1 with errno set
+ */
+static int handoff_recv_fds(int conn, struct handoff_msg *m, int *fds, size_t max)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(struct handoff_fds))];
+	} control;
+	struct iovec iov = { .iov_base = m, .iov_len = sizeof *m };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof control.buf
+	};
+
+	ssize_t len = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+
+	if (len < 0)
+		return -1;
+
+	int cnt = 0;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			int fd;
+
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof fd);
+
+			if ((size_t)cnt < max)
+				fds[cnt++] = fd;
+			else
+				close(fd);
+		}
+	}
+
+	if (len != sizeof *m || m->magic != HANDOFF_MAGIC) {
+		for (int i = 0; i < cnt; ++i)
+			close(fds[i]);
+
+		errno = len == 0 ? ECONNRESET : EPROTO;
+		return -1;
+	}
+
+	return cnt;
+}
+
+int handoff_connect(const char *path, struct handoff_fds *fds)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	struct timeval timeout = { .tv_sec = HANDOFF_TIMEOUT };
+
+	if (conn < 0)
+		return -1;
+
+	if (connect(conn, (const struct sockaddr *)&addr, sizeof addr) < 0 ||
+			setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout) < 0 ||
+			send(conn, "handoff\n", 8, MSG_NOSIGNAL) != 8) {
+		int err = errno;
+
+		close(conn);
+		errno = err;
+
+		return -1;
+	}
+
+	struct handoff_msg m;
+	int received[sizeof(struct handoff_fds) / sizeof(int)];
+	int cnt = handoff_recv_fds(conn, &m, received, sizeof received / sizeof(int));
+
+	/* The flags tell how many descriptors to expect, once there are any */
+	if (cnt >= 0 && cnt != 1 + !!(m.flags & HANDOFF_F_STANDBY) +
+			3 * !!(m.flags & HANDOFF_F_XDP) + !!(m.flags & HANDOFF_F_XDP_CLIENTS)) {
+		for (int i = 0; i < cnt; ++i)
+			close(received[i]);
+
+		cnt = -1;
+		errno = EPROTO;
+	}
+
+	if (cnt < 0) {
+		int err = errno;
+
+		close(conn);
+		errno = err;
+
+		return -1;
+	}
+
+	*fds = (struct handoff_fds)HANDOFF_FDS_EMPTY;
+
+	int i = 0;
+
+	fds->udp = received[i++];
+
+	if (m.flags & HANDOFF_F_STANDBY)
+		fds->standby = received[i++];
+
+	if (m.flags & HANDOFF_F_XDP) {
+		fds->xdp[0] = received[i++];
+		fds->xdp[1] = received[i++];
+		fds->xdp[2] = received[i++];
+	}
+
+	if (m.flags & HANDOFF_F_XDP_CLIENTS)
+		fds->xdp[3] = received[i++];
+
+	return conn;
+}
+
+/**
+ * Apply a record of the state
+ */
+static void handoff_apply(struct server *s, const struct handoff_record *r,
+	const uint8_t *data)
+{
+	struct lease_table *tab = s->leases;
+	struct lease *l = &tab->a[r->rec];
+
+	if (r->key_len > 0) {
+		struct ckey key;
+
+		/* The client cannot be told apart anymore, its address stays
+		 * out of use until the lease would have run out
+		 */
+		if (!ckey_put(&key, s->clientids, data, r->key_len)) {
+			l->state = LEASE_DECLINED;
+			l->expires = r->expires;
+			pool_take(s->pool, lease_address(tab, l));
+			return;
+		}
+
+		lease_assign(tab, l, &key);
+	}
+
+	data += r->key_len;
+
+	l->state = r->state;
+	l->expires = r->expires;
+	lease_set_hostname(tab, l, r->hostname_len > 0 ?
+		intern_put(s->hostnames, data, r->hostname_len) : 0);
+
+	data += r->hostname_len;
+
+	lease_set_relay(tab, l, r->relay_len > 0 ? intern_put(s->relays, data, r->relay_len) : 0);
+
+	if (r->pinned)
+		lease_pin(tab, l);
+
+	pool_take(s->pool, lease_address(tab, l));
+}
+
+bool handoff_load(int conn, struct server *s)
+{
+	if (send(conn, "ready\n", 6, MSG_NOSIGNAL) != 6)
+		return false;
+
+	struct handoff_msg m;
+	int fd;
+
+	if (handoff_recv_fds(conn, &m, &fd, 1) != 1) {
+		if (errno == 0)
+			errno = EPROTO;
+
+		return false;
+	}
+
+	struct stat st;
+	const uint8_t *state = MAP_FAILED;
+
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct handoff_header))
+		state = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (state == MAP_FAILED) {
+		errno = EPROTO;
+		return false;
+	}
+
+	struct lease_table *tab = s->leases;
+	struct handoff_header hdr;
+	size_t off = sizeof hdr;
+	bool valid;
+
+	memcpy(&hdr, state, sizeof hdr);
+
+	valid = hdr.magic == HANDOFF_MAGIC && hdr.base == tab->base && hdr.size == tab->size;
+
+	for (uint32_t i = 0; valid && i < hdr.records; ++i)
+	{
+		struct handoff_record r;
+
+		if (off + sizeof r > (size_t)st.st_size) {
+			valid = false;
+			break;
+		}
+
+		memcpy(&r, state + off, sizeof r);
+		off += sizeof r;
+
+		size_t len = r.key_len + r.hostname_len + r.relay_len;
+
+		if (r.rec >= tab->size || off + len > (size_t)st.st_size) {
+			valid = false;
+			break;
+		}
+
+		handoff_apply(s, &r, state + off);
+		off += len;
+	}
+
+	if (valid && hdr.next < s->pool->size)
+		s->pool->next = hdr.next;
+
+	munmap((void *)state, st.st_size);
+
+	if (!valid)
+		errno = EPROTO;
+
+	return valid;
+}
+
+bool handoff_serving(int conn)
+{
+	bool ok = send(conn, "serving\n", 8, MSG_NOSIGNAL) == 8;
+	int err = errno;
+
+	close(conn);
+	errno = err;
+
+	return ok;
+}
+
+/**
+ * Drop the successor, and read again if we stopped for it
+ */
+static void handoff_drop(struct handoff *h)
+{
+	ev_io_stop(h->loop, &h->conn_watch);
+	ev_timer_stop(h->loop, &h->stop_watch);
+	close(h->conn);
+
+	h->conn = -1;
+	h->line_len = 0;
+
+	if (h->stopped) {
+		dhcpd_error(0, 0, "Successor failed, serving again");
+		h->stopped = false;
+		h->hooks.resume(h->hooks.ctx);
+	}
+}
+
+/**
+ * Write everything in the buffer to the state
+ */
+static bool handoff_flush(int fd, const uint8_t *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t written = write(fd, buf, len);
+
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		buf += written;
+		len -= written;
+	}
+
+	return true;
+}
+
+/**
+ * Write the state of the leases in use, and of free addresses pinned to a
+ * relay agent circuit. Addresses being probed count as free.
+ */
+static bool handoff_write(struct handoff *h, int fd)
+{
+	struct server *s = h->server;
+	struct lease_table *tab = s->leases;
+	struct handoff_header hdr = {
+		.magic = HANDOFF_MAGIC,
+		.base = tab->base,
+		.size = tab->size,
+		.next = s->pool->next,
+		.records = 0
+	};
+	uint8_t *buf = malloc(HANDOFF_BUF_LEN);
+	size_t len = sizeof hdr;
+
+	if (buf == NULL)
+		return false;
+
+	for (uint32_t i = 0; i < tab->size; ++i)
+	{
+		struct lease *l = &tab->a[i];
+		bool pinned = lease_is_pinned(tab, l);
+
+		if (l->state == LEASE_PROBING || (l->state == LEASE_FREE && !pinned))
+			continue;
+
+		const uint8_t *key = NULL;
+		const uint8_t *hostname = NULL;
+		const uint8_t *relay = NULL;
+		size_t key_len = 0;
+		size_t hostname_len = 0;
+		size_t relay_len = 0;
+
+		/* A key whose bytes are unknown cannot be rebuilt, its client starts over */
+		if (l->indexed && (key = ckey_get(&l->key, s->clientids, &key_len)) == NULL)
+			continue;
+
+		hostname = intern_get(s->hostnames, l->hostname, &hostname_len);
+		relay = intern_get(s->relays, l->relay, &relay_len);
+
+		if (hostname == NULL)
+			hostname_len = 0;
+		if (relay == NULL)
+			relay_len = 0;
+
+		struct handoff_record r = {
+			.expires = l->expires,
+			.rec = i,
+			.state = l->state,
+			.key_len = key_len,
+			.hostname_len = hostname_len,
+			.relay_len = relay_len,
+			.pinned = pinned
+		};
+
+		if (len + sizeof r + key_len + hostname_len + relay_len > HANDOFF_BUF_LEN) {
+			if (!handoff_flush(fd, buf, len)) {
+				free(buf);
+				return false;
+			}
+
+			len = 0;
+		}
+
+		memcpy(buf + len, &r, sizeof r);
+		len += sizeof r;
+
+		if (key_len > 0)
+			memcpy(buf + len, key, key_len);
+		if (hostname_len > 0)
+			memcpy(buf + len + key_len, hostname, hostname_len);
+		if (relay_len > 0)
+			memcpy(buf + len + key_len + hostname_len, relay, relay_len);
+
+		len += key_len + hostname_len + relay_len;
+		++hdr.records;
+	}
+
+	bool ok = handoff_flush(fd, buf, len) &&
+		pwrite(fd, &hdr, sizeof hdr, 0) == sizeof hdr;
+
+	free(buf);
+
+	return ok;
+}
+
+/**
+ * Pass the sockets to the successor
+ */
+static bool handoff_sockets(struct handoff *h)
+{
+	struct handoff_fds fds = HANDOFF_FDS_EMPTY;
+	struct handoff_msg m = { .magic = HANDOFF_MAGIC, .flags = 0 };
+	int list[sizeof fds / sizeof(int)];
+	size_t cnt = 0;
+
+	h->hooks.sockets(h->hooks.ctx, &fds);
+
+	list[cnt++] = fds.udp;
+
+	if (fds.standby >= 0) {
+		m.flags |= HANDOFF_F_STANDBY;
+		list[cnt++] = fds.standby;
+	}
+
+	if (fds.xdp[0] >= 0) {
+		m.flags |= HANDOFF_F_XDP;
+		list[cnt++] = fds.xdp[0];
+		list[cnt++] = fds.xdp[1];
+		list[cnt++] = fds.xdp[2];
+	}
+
+	if (fds.xdp[3] >= 0) {
+		m.flags |= HANDOFF_F_XDP_CLIENTS;
+		list[cnt++] = fds.xdp[3];
+	}
+
+	return handoff_send_fds(h->conn, &m, list, cnt);
+}
+
+/**
+ * Stop reading and pass the state to the successor
+ */
+static bool handoff_state(struct handoff *h)
+{
+	struct handoff_msg m = { .magic = HANDOFF_MAGIC, .flags = 0 };
+
+	h->stopped = true;
+	h->hooks.stop(h->hooks.ctx);
+
+	ev_timer_set(&h->stop_watch, HANDOFF_TIMEOUT, 0);
+	ev_timer_start(h->loop, &h->stop_watch);
+
+	int fd = memfd_create("dhcpd-handoff", MFD_CLOEXEC);
+
+	if (fd < 0)
+		return false;
+
+	bool ok = handoff_write(h, fd) && handoff_send_fds(h->conn, &m, &fd, 1);
+
+	close(fd);
+
+	return ok;
+}
+
+/**
+ * Handle a line of the successor
+ *
+ * @return Whether the connection is still open
+ */
+static bool handoff_command(struct handoff *h, const char *line)
+{
+	bool ok;
+
+	if (strcmp(line, "handoff") == 0) {
+		ok = handoff_sockets(h);
+	} else if (strcmp(line, "ready") == 0) {
+		ok = handoff_state(h);
+	} else if (strcmp(line, "serving") == 0 && h->stopped) {
+		dhcpd_error(0, 0, "Handed off to successor");
+
+		ev_io_stop(h->loop, &h->conn_watch);
+		ev_timer_stop(h->loop, &h->stop_watch);
+		close(h->conn);
+		h->conn = -1;
+
+		ev_break(h->loop, EVBREAK_ALL);
+
+		return false;
+	} else {
+		ok = false;
+	}
+
+	if (!ok)
+		handoff_drop(h);
+
+	return ok;
+}
+
+static void handoff_read_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	struct handoff *h = w->data;
+	ssize_t len = recv(h->conn, h->line + h->line_len,
+		sizeof h->line - h->line_len, MSG_DONTWAIT);
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (len <= 0) {
+		handoff_drop(h);
+		return;
+	}
+
+	h->line_len += len;
+
+	char *nl;
+
+	while ((nl = memchr(h->line, '\n', h->line_len)) != NULL)
+	{
+		size_t used = nl + 1 - h->line;
+
+		*nl = 0;
+
+		if (!handoff_command(h, h->line))
+			return;
+
+		memmove(h->line, h->line + used, h->line_len - used);
+		h->line_len -= used;
+	}
+
+	if (h->line_len == sizeof h->line)
+		handoff_drop(h);
+}
+
+static void handoff_stop_cb(EV_P_ ev_timer *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	struct handoff *h = w->data;
+
+	dhcpd_error(0, 0, "Successor did not serve within %d seconds", HANDOFF_TIMEOUT);
+	handoff_drop(h);
+}
+
+static void handoff_accept_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)revents;
+
+	struct handoff *h = w->data;
+	int fd;
+
+	while ((fd = accept4(h->sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		/* One successor at a time */
+		if (h->conn >= 0) {
+			close(fd);
+			continue;
+		}
+
+		h->conn = fd;
+		h->line_len = 0;
+
+		ev_io_set(&h->conn_watch, fd, EV_READ);
+		ev_io_start(EV_A_ &h->conn_watch);
+	}
+}
+
+struct handoff *handoff_create(struct ev_loop *loop, const char *path,
+	struct server *server, const struct handoff_hooks *hooks)
+{
+	struct handoff *h = calloc(1, sizeof(struct handoff));
+
+	if (h == NULL)
+		return NULL;
+
+	if (strlen(path) >= sizeof h->addr.sun_path) {
+		free(h);
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	h->addr.sun_family = AF_UNIX;
+	strcpy(h->addr.sun_path, path);
+
+	h->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	struct stat st;
+
+	/* The socket of the server we took over from, or of a crashed one */
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	/* The sockets and leases are for the user of the server only, before
+	 * anybody can connect
+	 */
+	if (h->sock < 0 ||
+			bind(h->sock, (const struct sockaddr *)&h->addr, sizeof h->addr) < 0 ||
+			chmod(path, 0600) < 0 ||
+			listen(h->sock, 1) < 0 ||
+			stat(path, &st) < 0) {
+		int err = errno;
+
+		if (h->sock >= 0)
+			close(h->sock);
+
+		free(h);
+		errno = err;
+
+		return NULL;
+	}
+
+	h->loop = loop;
+	h->server = server;
+	h->hooks = *hooks;
+	h->dev = st.st_dev;
+	h->ino = st.st_ino;
+	h->conn = -1;
+
+	ev_init(&h->conn_watch, handoff_read_cb);
+	h->conn_watch.data = h;
+
+	ev_init(&h->stop_watch, handoff_stop_cb);
+	h->stop_watch.data = h;
+
+	ev_io_init(&h->accept_watch, handoff_accept_cb, h->sock, EV_READ);
+	h->accept_watch.data = h;
+	ev_io_start(loop, &h->accept_watch);
+
+	return h;
+}
+
+void handoff_destroy(struct handoff *h)
+{
+	struct stat st;
+
+	if (h->conn >= 0) {
+		ev_io_stop(h->loop, &h->conn_watch);
+		close(h->conn);
+	}
+
+	ev_timer_stop(h->loop, &h->stop_watch);
+
+	ev_io_stop(h->loop, &h->accept_watch);
+	close(h->sock);
+
+	if (stat(h->addr.sun_path, &st) == 0 && st.st_dev == h->dev && st.st_ino == h->ino)
+		unlink(h->addr.sun_path);
+
+	free(h);
+}
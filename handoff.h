@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include <ev.h>
+
+#include "server.h"
+
+/* Upgrades without downtime: a server started with -handoff PATH takes
+ * over from the server listening at PATH, if there is one, and listens
+ * there itself for the next one.
+ *
+ * The successor connects and asks for the sockets. It gets the bound UDP
+ * socket, the socket a standby accepts its primary on and the descriptors
+ * of the XDP filter, whichever the server has, over SCM_RIGHTS, so nothing
+ * is bound twice and the filter stays attached. It sets up with them and
+ * says it is ready. The server stops reading then, writes its leases,
+ * offers, pinned addresses and allocator cursor into a memfd and passes
+ * that. The successor loads it, starts everything else and says it is
+ * serving, and the server exits. Requests which come in meanwhile wait in
+ * the socket both of them hold. Should the successor fail or hang before it
+ * serves, the server reads again.
+ *
+ * Addresses being probed, retransmission replies and queued dynamic
+ * updates are not handed off, the clients retransmit. Subscribers of lease
+ * events have to reconnect.
+ */
+
+/* Version of the state, a successor only takes it in the same format */
+#define HANDOFF_MAGIC 0x64680001
+
+/* Sent by the server with the descriptors passed along */
+struct handoff_msg
+{
+	uint32_t magic;
+	/* HANDOFF_F_* of the descriptors which follow the UDP socket */
+	uint32_t flags;
+};
+
+/* The socket a standby accepts its primary on */
+#define HANDOFF_F_STANDBY 0x01
+/* Program, link and counters of the XDP filter */
+#define HANDOFF_F_XDP 0x02
+/* The rate limit map of the XDP filter */
+#define HANDOFF_F_XDP_CLIENTS 0x04
+
+/* Descriptors handed off, -1 for those not there */
+struct handoff_fds
+{
+	int udp;
+	int standby;
+	/* As passed to prefilter_adopt */
+	int xdp[4];
+};
+
+#define HANDOFF_FDS_EMPTY {\
+		.udp = -1,\
+		.standby = -1,\
+		.xdp = { -1, -1, -1, -1 }\
+	}
+
+/* Start of the state */
+struct handoff_header
+{
+	uint32_t magic;
+	uint32_t base;
+	uint32_t size;
+	/* Where the pool continues searching */
+	uint32_t next;
+	uint32_t records;
+};
+
+/* A record of the state, followed by the client key, the host name and
+ * the relay agent information
+ */
+struct handoff_record
+{
+	ev_tstamp expires;
+	uint32_t rec;
+	uint8_t state;
+	uint8_t key_len;
+	uint8_t hostname_len;
+	uint8_t relay_len;
+	bool pinned;
+};
+
+/* Gives the server's resources up for a successor and takes them back */
+struct handoff_hooks
+{
+	/* Fill in the descriptors to pass */
+	void (*sockets)(void *ctx, struct handoff_fds *fds);
+	/* Stop reading the socket and let go of the standby socket */
+	void (*stop)(void *ctx);
+	/* The successor failed, read again */
+	void (*resume)(void *ctx);
+	void *ctx;
+};
+
+struct handoff
+{
+	struct ev_loop *loop;
+	struct server *server;
+	struct handoff_hooks hooks;
+
+	int sock;
+	struct sockaddr_un addr;
+	/* The socket file we created, it is only removed if still there */
+	dev_t dev;
+	ino_t ino;
+	ev_io accept_watch;
+
+	/* A successor, -1 for none */
+	int conn;
+	ev_io conn_watch;
+	char line[64];
+	size_t line_len;
+	/* Whether we stopped reading for it */
+	bool stopped;
+	/* Reads again if it does not serve in time */
+	ev_timer stop_watch;
+};
+
+/**
+ * Ask the server at path for its sockets
+ *
+ * @param[in] path Path of its handoff socket
+ * @param[out] fds Descriptors received
+ * @return Connection to the server for handoff_load, or -1 with errno set,
+ *         ENOENT or ECONNREFUSED if nobody is there
+ */
+extern int handoff_connect(const char *path, struct handoff_fds *fds);
+
+/**
+ * Tell the server we are ready and load its state once it stopped reading
+ *
+ * @param[in] conn Connection of handoff_connect
+ * @param[in] s Server just initialized, with the same address range
+ * @return Whether the state was loaded, otherwise errno is set and the
+ *         server reads again once the connection is closed
+ */
+extern bool handoff_load(int conn, struct server *s);
+
+/**
+ * Tell the server we are serving, which makes it exit, and close the
+ * connection
+ *
+ * @return Whether the server was told, otherwise it gave up waiting and
+ *         reads again, errno is set
+ */
+extern bool handoff_serving(int conn);
+
+/**
+ * Listen for a successor
+ *
+ * @param[in] loop Event loop, broken once the successor serves
+ * @param[in] path Path of the socket, a stale one is replaced
+ * @param[in] server Server whose state is handed off
+ * @param[in] hooks Give the sockets up and back
+ * @return The listener, or NULL with errno set
+ */
+extern struct handoff *handoff_create(struct ev_loop *loop, const char *path,
+	struct server *server, const struct handoff_hooks *hooks);
+
+/**
+ * Close the connections and remove the socket, unless a successor took the
+ * path over
+ */
+extern void handoff_destroy(struct handoff *h);
@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "intern.h"
+
+struct intern *intern_create(uint32_t limit)
+{
+	struct intern *in;
+	uint32_t slots = 16;
+
+	if (limit > INTERN_MAX)
+		limit = INTERN_MAX;
+
+	/* Keep the index at most half full */
+	while (slots < 2 * limit)
+		slots <<= 1;
+
+	in = (struct intern*)calloc(1, sizeof(struct intern));
+	if (in == NULL)
+		return NULL;
+
+	in->slots = (struct intern_entry*)calloc(slots, sizeof(struct intern_entry));
+	in->mask = slots - 1;
+	in->strs = (uint8_t**)calloc(limit + 1, sizeof(uint8_t*));
+	in->lens = (uint8_t*)calloc(limit + 1, sizeof(uint8_t));
+	in->refs = (uint32_t*)calloc(limit + 1, sizeof(uint32_t));
+	in->unused = (uint16_t*)calloc(limit > 0 ? limit : 1, sizeof(uint16_t));
+	in->limit = limit;
+
+	if (in->slots == NULL || in->strs == NULL || in->lens == NULL ||
+			in->refs == NULL || in->unused == NULL) {
+		intern_destroy(in);
+		return NULL;
+	}
+
+	return in;
+}
+
+void intern_destroy(struct intern *in)
+{
+	assert(in != NULL);
+
+	for (uint32_t i = 1; i <= in->cnt; ++i)
+		free(in->strs[i]);
+
+	free(in->strs);
+	free(in->lens);
+	free(in->refs);
+	free(in->unused);
+	free(in->slots);
+	free(in);
+}
+
+/**
+ * Find the slot of a string, which is either the slot holding it or the
+ * empty slot where it would be inserted
+ */
+static struct intern_entry *intern_slot(struct intern *in, uint32_t hash,
+	const uint8_t *data, size_t len)
+{
+	for (uint32_t i = hash & in->mask; ; i = (i + 1) & in->mask)
+	{
+		struct intern_entry *e = &in->slots[i];
+
+		if (e->id == 0)
+			return e;
+
+		if (e->hash == hash && in->lens[e->id] == len &&
+				memcmp(in->strs[e->id], data, len) == 0)
+			return e;
+	}
+}
+
+uint16_t intern_find(struct intern *in, const uint8_t *data, size_t len)
+{
+	if (len > 255)
+		return 0;
+
+	return intern_slot(in, intern_hash(data, len), data, len)->id;
+}
+
+uint16_t intern_put(struct intern *in, const uint8_t *data, size_t len)
+{
+	if (len > 255)
+		return 0;
+
+	uint32_t hash = intern_hash(data, len);
+	struct intern_entry *e = intern_slot(in, hash, data, len);
+
+	if (e->id != 0)
+		return e->id;
+
+	if (in->unused_cnt == 0 && in->cnt >= in->limit)
+		return 0;
+
+	uint8_t *str = (uint8_t*)malloc(len > 0 ? len : 1);
+	if (str == NULL)
+		return 0;
+
+	memcpy(str, data, len);
+
+	e->hash = hash;
+	e->id = in->unused_cnt > 0 ? in->unused[--in->unused_cnt] : ++in->cnt;
+	in->strs[e->id] = str;
+	in->lens[e->id] = len;
+	in->refs[e->id] = 0;
+
+	return e->id;
+}
+
+void intern_drop(struct intern *in, uint16_t id)
+{
+	if (id == 0 || in->refs[id] == 0 || --in->refs[id] > 0)
+		return;
+
+	uint32_t i = intern_hash(in->strs[id], in->lens[id]) & in->mask;
+
+	while (in->slots[i].id != id)
+		i = (i + 1) & in->mask;
+
+	/* Shift following entries back, so lookups never need tombstones */
+	for (uint32_t j = i; ; )
+	{
+		j = (j + 1) & in->mask;
+
+		if (in->slots[j].id == 0)
+			break;
+
+		uint32_t home = in->slots[j].hash & in->mask;
+
+		if ((j > i && (home <= i || home > j)) ||
+				(j < i && (home <= i && home > j)))
+		{
+			in->slots[i] = in->slots[j];
+			i = j;
+		}
+	}
+
+	in->slots[i].id = 0;
+
+	free(in->strs[id]);
+	in->strs[id] = NULL;
+	in->unused[in->unused_cnt++] = id;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Interning maps byte strings to small ids, so records which refer to a
+ * string stay fixed-size. Equal strings get the same id. Records holding an
+ * id count it, and once the last one dropped it the string is removed and
+ * its id reused, so a table fed from packets does not fill up with strings
+ * nothing refers to anymore. A string which is never held stays until the
+ * table is destroyed. Id 0 means "none".
+ */
+
+#ifndef INTERN_MAX
+#define INTERN_MAX 65535
+#endif
+
+struct intern_entry
+{
+	uint32_t hash;
+	uint16_t id;
+};
+
+struct intern
+{
+	/* Open addressing index, mask + 1 slots */
+	struct intern_entry *slots;
+	uint32_t mask;
+
+	/* Strings by id, strs[0] is unused, NULL for a removed one */
+	uint8_t **strs;
+	uint8_t *lens;
+	/* Holders by id */
+	uint32_t *refs;
+	uint32_t cnt;
+	uint32_t limit;
+
+	/* Ids of removed strings, to be reused */
+	uint16_t *unused;
+	uint32_t unused_cnt;
+};
+
+/**
+ * FNV-1a hash of a byte string
+ */
+static inline uint32_t intern_hash(const uint8_t *data, size_t len)
+{
+	uint32_t h = 2166136261U;
+
+	for (size_t i = 0; i < len; ++i)
+		h = (h ^ data[i]) * 16777619U;
+
+	return h;
+}
+
+/**
+ * Create a table for up to limit strings of at most 255 bytes
+ */
+extern struct intern *intern_create(uint32_t limit);
+extern void intern_destroy(struct intern *in);
+
+/**
+ * Find or add a string
+ *
+ * @return Id of the string, or 0 if it is too long or the table is full
+ */
+extern uint16_t intern_put(struct intern *in, const uint8_t *data, size_t len);
+
+/**
+ * Count a holder of an id, nothing for id 0
+ */
+static inline void intern_hold(struct intern *in, uint16_t id)
+{
+	if (id != 0)
+		++in->refs[id];
+}
+
+/**
+ * Drop a holder of an id and remove the string once nothing holds it
+ */
+extern void intern_drop(struct intern *in, uint16_t id);
+
+/**
+ * Find a string without adding it
+ *
+ * @return Id of the string, or 0 if it is unknown
+ */
+extern uint16_t intern_find(struct intern *in, const uint8_t *data, size_t len);
+
+/**
+ * Get the string of an id
+ *
+ * @param[out] len Length of the string
+ * @return The string, or NULL for an unknown id
+ */
+static inline const uint8_t *intern_get(struct intern *in, uint16_t id, size_t *len)
+{
+	if (id == 0 || id > in->cnt || in->strs[id] == NULL)
+		return NULL;
+
+	*len = in->lens[id];
+
+	return in->strs[id];
+}
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lease.h"
+#include "intern.h"
+
+struct lease_table *lease_table_create(struct in_addr first, struct in_addr last) {
+	struct lease_table *tab;
+	uint32_t slots = 16;
+
+	tab = (struct lease_table*)calloc(1, sizeof(struct lease_table));
+
+	tab->base = ntohl(first.s_addr);
+	tab->size = ntohl(last.s_addr) >= tab->base ? ntohl(last.s_addr) - tab->base + 1 : 0;
+	tab->a = (struct lease*)calloc(tab->size ? tab->size : 1, sizeof(struct lease));
+
+	/* Keep the index at most half full */
+	while (slots < 2 * tab->size)
+		slots <<= 1;
+
+	tab->idx = (struct lease_index*)calloc(slots, sizeof(struct lease_index));
+	tab->mask = slots - 1;
+
+	return tab;
+}
+
+void lease_table_destroy(struct lease_table *tab) {
+	assert(tab != NULL);
+
+	free(tab->pins);
+	free(tab->idx);
+	free(tab->a);
+	free(tab);
+}
+
+struct lease *lease_find(struct lease_table *tab, const struct ckey *key) {
+	for (uint32_t i = key->hash & tab->mask; tab->idx[i].rec != 0; i = (i + 1) & tab->mask)
+		if (tab->idx[i].hash == key->hash &&
+				ckey_eq(&tab->a[tab->idx[i].rec - 1].key, key))
+			return &tab->a[tab->idx[i].rec - 1];
+
+	return NULL;
+}
+
+struct lease *lease_at(struct lease_table *tab, struct in_addr address) {
+	uint32_t off = ntohl(address.s_addr) - tab->base;
+
+	if (off >= tab->size)
+		return NULL;
+
+	return &tab->a[off];
+}
+
+static void lease_index_del(struct lease_table *tab, struct lease *lease) {
+	uint32_t rec = (uint32_t)(lease - tab->a) + 1;
+	uint32_t i = lease->key.hash & tab->mask;
+
+	while (tab->idx[i].rec != rec)
+		i = (i + 1) & tab->mask;
+
+	/* Shift following entries back, so lookups never need tombstones */
+	for (uint32_t j = i; ; )
+	{
+		j = (j + 1) & tab->mask;
+
+		if (tab->idx[j].rec == 0)
+			break;
+
+		uint32_t home = tab->idx[j].hash & tab->mask;
+
+		if ((j > i && (home <= i || home > j)) ||
+				(j < i && (home <= i && home > j)))
+		{
+			tab->idx[i] = tab->idx[j];
+			i = j;
+		}
+	}
+
+	tab->idx[i].rec = 0;
+	lease->indexed = false;
+}
+
+void lease_assign(struct lease_table *tab, struct lease *lease, const struct ckey *key) {
+	if (lease->indexed) {
+		if (ckey_eq(&lease->key, key))
+			return;
+
+		lease_index_del(tab, lease);
+	}
+
+	if (tab->clientids != NULL) {
+		intern_hold(tab->clientids, ckey_id(key));
+		intern_drop(tab->clientids, ckey_id(&lease->key));
+	}
+
+	lease->key = *key;
+
+	uint32_t i = key->hash & tab->mask;
+
+	while (tab->idx[i].rec != 0)
+		i = (i + 1) & tab->mask;
+
+	tab->idx[i].hash = key->hash;
+	tab->idx[i].rec = (uint32_t)(lease - tab->a) + 1;
+	lease->indexed = true;
+}
+
+void lease_unassign(struct lease_table *tab, struct lease *lease) {
+	if (lease->indexed)
+		lease_index_del(tab, lease);
+
+	if (tab->clientids != NULL)
+		intern_drop(tab->clientids, ckey_id(&lease->key));
+
+	memset(&lease->key, 0, sizeof lease->key);
+
+	lease->state = LEASE_FREE;
+	lease->expires = 0;
+	lease_set_hostname(tab, lease, 0);
+}
+
+void lease_set_relay(struct lease_table *tab, struct lease *lease, uint16_t relay) {
+	uint16_t old = lease->relay;
+
+	if (old != relay && old != 0 && tab->pins != NULL &&
+			tab->pins[old] == (uint32_t)(lease - tab->a) + 1)
+		tab->pins[old] = 0;
+
+	lease->relay = relay;
+
+	/* The new id first, it may be the old one */
+	if (tab->relays != NULL) {
+		intern_hold(tab->relays, relay);
+		intern_drop(tab->relays, old);
+	}
+}
+
+void lease_set_hostname(struct lease_table *tab, struct lease *lease, uint16_t hostname) {
+	uint16_t old = lease->hostname;
+
+	lease->hostname = hostname;
+
+	if (tab->hostnames != NULL) {
+		intern_hold(tab->hostnames, hostname);
+		intern_drop(tab->hostnames, old);
+	}
+}
+
+void lease_pin(struct lease_table *tab, struct lease *lease) {
+	if (lease->relay == 0)
+		return;
+
+	if (tab->pins == NULL)
+		tab->pins = (uint32_t*)calloc(INTERN_MAX + 1, sizeof(uint32_t));
+
+	tab->pins[lease->relay] = (uint32_t)(lease - tab->a) + 1;
+}
+
+struct lease *lease_pinned(struct lease_table *tab, uint16_t relay) {
+	if (tab->pins == NULL || relay == 0 || tab->pins[relay] == 0)
+		return NULL;
+
+	/* The client on the pinned address may have moved to another circuit */
+	if (tab->a[tab->pins[relay] - 1].relay != relay)
+		return NULL;
+
+	return &tab->a[tab->pins[relay] - 1];
+}
+
+size_t lease_expire(struct lease_table *tab, ev_tstamp now,
+	void (*cb)(struct lease_table *, struct lease *, void *), void *ctx) {
+	size_t cnt = 0;
+
+	for (uint32_t i = 0; i < tab->size; ++i)
+	{
+		struct lease *lease = &tab->a[i];
+
+		if (lease->state == LEASE_FREE || lease->expires > now)
+			continue;
+
+		if (cb != NULL)
+			cb(tab, lease, ctx);
+
+		lease_unassign(tab, lease);
+		++cnt;
+	}
+
+	return cnt;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <ev.h>
+
+#include "ckey.h"
+
+/* The lease table has one fixed-size record per address of the range, so a
+ * lease is found by its address with a subtraction. Records are found by
+ * client through an open addressing index which holds record numbers and
+ * hashes only, so probing does not touch the records themselves.
+ */
+
+#ifndef LEASE_OFFER_TIMEOUT
+#define LEASE_OFFER_TIMEOUT 60
+#endif
+
+enum lease_state
+{
+	LEASE_FREE = 0,
+	LEASE_OFFERED,
+	LEASE_BOUND,
+	LEASE_DECLINED,
+	/* Taken for a client, but the address is being checked for use */
+	LEASE_PROBING
+};
+
+struct lease
+{
+	struct ckey key;
+	ev_tstamp expires;
+	/* Interned relay agent information, 0 if none */
+	uint16_t relay;
+	/* Interned host name of a bound lease, 0 if none */
+	uint16_t hostname;
+	uint8_t state;
+	/* Whether the record is in the client index */
+	bool indexed;
+};
+
+struct lease_index
+{
+	uint32_t hash;
+	/* Record number + 1, 0 for an empty slot */
+	uint32_t rec;
+};
+
+struct lease_table
+{
+	uint32_t base; // first address, host byte order
+	uint32_t size;
+	struct lease *a;
+
+	struct lease_index *idx;
+	uint32_t mask;
+
+	/* Record number + 1 by relay id, for per-port address pinning */
+	uint32_t *pins;
+
+	/* Tables the client keys, relay and host name ids of the records are
+	 * held in, NULL if they are not interned
+	 */
+	struct intern *clientids;
+	struct intern *relays;
+	struct intern *hostnames;
+};
+
+struct lease_table *lease_table_create(struct in_addr first, struct in_addr last);
+void lease_table_destroy(struct lease_table *tab);
+
+// May return NULL if the client has no lease
+struct lease *lease_find(struct lease_table *tab, const struct ckey *key);
+
+// May return NULL if the address is outside of the table
+struct lease *lease_at(struct lease_table *tab, struct in_addr address);
+
+static inline struct in_addr lease_address(struct lease_table *tab, struct lease *lease)
+{
+	return (struct in_addr){ htonl(tab->base + (uint32_t)(lease - tab->a)) };
+}
+
+/**
+ * Hand a record to a client, a previous owner loses it. A key longer than
+ * CKEY_INLINE has to be interned.
+ */
+void lease_assign(struct lease_table *tab, struct lease *lease, const struct ckey *key);
+
+/**
+ * Take a record from its client and mark it free
+ */
+void lease_unassign(struct lease_table *tab, struct lease *lease);
+
+/**
+ * Change the relay id of a record, an address pinned to the old one is no
+ * longer
+ */
+void lease_set_relay(struct lease_table *tab, struct lease *lease, uint16_t relay);
+
+/**
+ * Change the host name id of a record
+ */
+void lease_set_hostname(struct lease_table *tab, struct lease *lease, uint16_t hostname);
+
+/**
+ * Pin the address of a record to its relay id
+ */
+void lease_pin(struct lease_table *tab, struct lease *lease);
+
+// May return NULL if nothing is pinned to the relay id
+struct lease *lease_pinned(struct lease_table *tab, uint16_t relay);
+
+static inline bool lease_is_pinned(struct lease_table *tab, struct lease *lease)
+{
+	return tab->pins != NULL && lease->relay != 0 &&
+		tab->pins[lease->relay] == (uint32_t)(lease - tab->a) + 1;
+}
+
+/**
+ * Free all records which expired before now and call cb for each of them,
+ * before it is freed
+ *
+ * @return Number of expired records
+ */
+size_t lease_expire(struct lease_table *tab, ev_tstamp now,
+	void (*cb)(struct lease_table *, struct lease *, void *), void *ctx);
@@ -2,115 +2,190 @@
 
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 
 #include "error.h"
 
-struct sockaddr_in server_id;
-struct sockaddr_in broadcast = {
-	.sin_family = AF_INET,
-	.sin_addr = {INADDR_BROADCAST},
-};
+/**
+ * Largest reply the client accepts. The maximum message size (57) counts the
+ * IP and UDP header, and a client has to accept DHCP_MSG_LEN bytes anyway.
+ */
+static size_t reply_limit(struct dhcp_msg *m)
+{
+	size_t limit = DHCP_MSG_LEN;
 
-bool send_offer(int socket, struct dhcp_msg *m, struct dhcp_lease *l) {
-	uint8_t *buf = malloc(DHCP_MSG_LEN);
-	if(!buf) {
-		dhcpd_error(ENOMEM, 1, "Could not send DHCPOFFER");
-		return false;
-	}
+	if (m->maxsize > DHCP_MSG_LEN + 28)
+		limit = m->maxsize - 28;
+
+	if (limit > DHCP_MSG_MAXLEN)
+		limit = DHCP_MSG_MAXLEN;
 
+	return limit;
+}
+
+/**
+ * Build a reply of the given type into buf
+ *
+ * The per-reply options come first, then the options of the scope, in the
+ * order of the Parameter Request List of the client.
+ *
+ * @param[out] buf Buffer of at least DHCP_MSG_MAXLEN bytes
+ * @param[in] m Message to reply to
+ * @param[in] type Type of the reply
+ * @param[in] s Scope whose options are added, or NULL
+ * @param[in] l Lease offered to the client, or NULL
+ * @return Length of the reply
+ */
+static size_t reply_build(uint8_t *buf, struct dhcp_msg *m,
+	enum dhcp_msg_type type, struct scope *s, struct dhcp_lease *l)
+{
 	size_t send_len = 0;
 	uint8_t *options = NULL;
 
-	dhcp_msg_reply(buf, &options, &send_len, m, DHCPOFFER);
+	dhcp_msg_reply(buf, &options, &send_len, m, type);
 
-	ARRAY_COPY(DHCP_MSG_F_YIADDR(buf), &l->address, 4);
+	*DHCP_MSG_F_FLAGS(buf) = *DHCP_MSG_F_FLAGS(m->data);
+	*DHCP_MSG_F_GIADDR(buf) = *DHCP_MSG_F_GIADDR(m->data);
 
-	dhcp_opt_insert_val(buf, DHCP_MSG_LEN, &send_len, &options, DHCP_OPT_SERVERID, uint32_t, m->sid->sin_addr.s_addr);
+	dhcp_opt_insert_val(buf, DHCP_MSG_MAXLEN, &send_len, &options, DHCP_OPT_SERVERID, uint32_t, m->sid->sin_addr.s_addr);
 
-	options = dhcp_opt_add_lease(options, &send_len, l);
+	/* A DHCPACK to a DHCPDISCOVER is a rapid commit and says so */
+	if (type == DHCPACK && m->type == DHCPDISCOVER)
+		dhcp_opt_insert(buf, DHCP_MSG_MAXLEN, &send_len, &options, DHCP_OPT_RAPIDCOMMIT, 0, NULL);
 
-	*options = DHCP_OPT_END;
-	DHCP_OPT_CONT(options, send_len);
+	if (l != NULL) {
+		ARRAY_COPY(DHCP_MSG_F_YIADDR(buf), &l->address, 4);
 
-//	if (debug)
-//		msg_debug(&((struct dhcp_msg){.data = send_buffer, .length = send_len }), 1);
+		if (l->leasetime > 0)
+			dhcp_opt_insert_val(buf, DHCP_MSG_MAXLEN, &send_len, &options, DHCP_OPT_LEASETIME, uint32_t, htonl(l->leasetime));
 
-	int err = sendto(socket, buf, send_len, MSG_DONTWAIT,
-			(struct sockaddr *)&broadcast, sizeof broadcast);
+		if (l->renewal > 0)
+			dhcp_opt_insert_val(buf, DHCP_MSG_MAXLEN, &send_len, &options, DHCP_OPT_RENEWALTIME, uint32_t, htonl(l->renewal));
 
-	if (err < 0) {
-		dhcpd_error(errno, 1, "Could not send DHCPOFFER");
-		return false;
+		if (l->rebinding > 0)
+			dhcp_opt_insert_val(buf, DHCP_MSG_MAXLEN, &send_len, &options, DHCP_OPT_REBINDTIME, uint32_t, htonl(l->rebinding));
 	}
 
-	free(buf);
+	size_t limit = reply_limit(m);
 
-	return true;
-}
+	if (m->relay != NULL)
+		limit -= m->relay_len + 2;
 
-bool send_ack(int socket, struct dhcp_msg *m, struct dhcp_lease *l) {
-	uint8_t *buf = malloc(DHCP_MSG_LEN);
-	if(!buf) {
-		dhcpd_error(ENOMEM, 1, "Could not send DHCPOFFER");
-		return false;
+	if (s != NULL) {
+		send_len = dhcp_opt_encode(buf, send_len, limit, &s->opts, m->prl, m->prl_len);
+	} else {
+		*options = DHCP_OPT_END;
+		DHCP_OPT_CONT(options, send_len);
 	}
 
-	size_t send_len = 0;
-	uint8_t *options = NULL;
-
-	// ACK
-	dhcp_msg_reply(buf, &options, &send_len, m, DHCPACK);
-
-	ARRAY_COPY(DHCP_MSG_F_YIADDR(buf), &l->address, 4);
-
-	dhcp_opt_insert_val(buf, DHCP_MSG_LEN, &send_len, &options, DHCP_OPT_SERVERID, uint32_t, m->sid->sin_addr.s_addr);
+	/* The relay agent information is echoed unchanged as the last option,
+	 * see RFC 3046 section 2.2.
+	 */
+	if (m->relay != NULL) {
+		send_len--;
+		buf[send_len++] = DHCP_OPT_RELAYINFO;
+		buf[send_len++] = m->relay_len;
+		memcpy(buf + send_len, m->relay, m->relay_len);
+		send_len += m->relay_len;
+		buf[send_len++] = DHCP_OPT_END;
+	}
 
-	options = dhcp_opt_add_lease(options, &send_len, l);
+	return send_len;
+}
 
-	*options = DHCP_OPT_END;
-	DHCP_OPT_CONT(options, send_len);
+/**
+ * Destination of a reply. Relayed messages go back to the relay agent, in
+ * unicast mode anything else is sent back to where it came from. Otherwise
+ * a client which has an address in ciaddr, e.g. a renewing one, gets
+ * replies unicast to it, except for a DHCPNAK, and everything else is
+ * broadcast, see RFC 2131 section 4.1.
+ */
+static struct sockaddr_in reply_dest(struct packet_sink *sink, struct dhcp_msg *m,
+	enum dhcp_msg_type type)
+{
+	struct sockaddr_in dest = sink->broadcast;
+
+	if (*DHCP_MSG_F_GIADDR(m->data) != 0) {
+		dest.sin_addr.s_addr = *DHCP_MSG_F_GIADDR(m->data);
+		dest.sin_port = htons(sink->relay_port);
+	} else if (sink->unicast) {
+		dest = *(struct sockaddr_in *)m->source;
+	} else if (*DHCP_MSG_F_CIADDR(m->data) != 0 && type != DHCPNAK) {
+		dest.sin_addr.s_addr = *DHCP_MSG_F_CIADDR(m->data);
+	}
 
-//	if (debug)
-//		msg_debug(&((struct dhcp_msg){.data = buf, .length = send_len }), 1);
-	int err = sendto(socket, buf, send_len, MSG_DONTWAIT,
-			(struct sockaddr *)&broadcast, sizeof broadcast);
+	return dest;
+}
 
-	if (err < 0) {
-		dhcpd_error(0, 1, "Could not send DHCPACK");
+/**
+ * Hand a reply to the sink and keep it for retransmissions
+ */
+static bool reply_send(struct packet_sink *sink, const uint8_t *buf, size_t len,
+	const struct sockaddr_in *dest, const char *what)
+{
+	if (!sink->send(sink->ctx, buf, len, dest)) {
+		dhcpd_error(0, errno, "Could not send %s", what);
 		return false;
 	}
 
-	free(buf);
+	if (sink->capture != NULL)
+		dedup_store(sink->capture, buf, len, dest);
 
 	return true;
 }
 
-bool send_nak(int socket, struct dhcp_msg *m) {
-	uint8_t *buf = malloc(DHCP_MSG_LEN);
-	if(!buf) {
-		dhcpd_error(ENOMEM, 1, "Could not send DHCPOFFER");
-		return false;
-	}
+bool send_offer(struct packet_sink *sink, struct dhcp_msg *m, struct scope *s, struct dhcp_lease *l) {
+	uint8_t buf[DHCP_MSG_MAXLEN];
+	size_t send_len = reply_build(buf, m, DHCPOFFER, s, l);
 
-	size_t send_len = 0;
-	uint8_t *options = NULL;
+//	if (debug)
+//		msg_debug(&((struct dhcp_msg){.data = send_buffer, .length = send_len }), 1);
 
-	dhcp_msg_reply(buf, &options, &send_len, m, DHCPNAK);
+	struct sockaddr_in dest = reply_dest(sink, m, DHCPOFFER);
 
-	options[0] = DHCP_OPT_END;
-	DHCP_OPT_CONT(options, send_len);
+	return reply_send(sink, buf, send_len, &dest, "DHCPOFFER");
+}
+
+bool send_ack(struct packet_sink *sink, struct dhcp_msg *m, struct scope *s, struct dhcp_lease *l) {
+	uint8_t buf[DHCP_MSG_MAXLEN];
+	size_t send_len = reply_build(buf, m, DHCPACK, s, l);
 
 //	if (debug)
 //		msg_debug(&((struct dhcp_msg){.data = buf, .length = send_len }), 1);
-	int err = sendto(socket, buf, send_len, MSG_DONTWAIT,
-			(struct sockaddr *)&broadcast, sizeof broadcast);
+	struct sockaddr_in dest = reply_dest(sink, m, DHCPACK);
 
-	if (err < 0) {
-		dhcpd_error(0, 1, "Could not send DHCPNAK");
-		return false;
-	}
+	return reply_send(sink, buf, send_len, &dest, "DHCPACK");
+}
 
-	free(buf);
+bool send_nak(struct packet_sink *sink, struct dhcp_msg *m) {
+	uint8_t buf[DHCP_MSG_MAXLEN];
+	size_t send_len = reply_build(buf, m, DHCPNAK, NULL, NULL);
 
-	return true;
+//	if (debug)
+//		msg_debug(&((struct dhcp_msg){.data = buf, .length = send_len }), 1);
+	struct sockaddr_in dest = reply_dest(sink, m, DHCPNAK);
+
+	return reply_send(sink, buf, send_len, &dest, "DHCPNAK");
+}
+
+bool send_inform(struct packet_sink *sink, struct dhcp_msg *m, struct scope *s) {
+	uint8_t buf[DHCP_MSG_MAXLEN];
+
+	/* The reply to a DHCPINFORM is a DHCPACK without yiaddr and lease time,
+	 * see draft-ietf-dhc-dhcpinform-clarify. It never touches a lease.
+	 */
+	size_t send_len = reply_build(buf, m, DHCPACK, s, NULL);
+
+	*DHCP_MSG_F_CIADDR(buf) = *DHCP_MSG_F_CIADDR(m->data);
+
+	/* The client already has an address. Some clients leave ciaddr empty,
+	 * then the source address of the request is used.
+	 */
+	struct sockaddr_in dest = reply_dest(sink, m, DHCPACK);
+
+	if (*DHCP_MSG_F_GIADDR(m->data) == 0 && !sink->unicast && *DHCP_MSG_F_CIADDR(m->data) == 0 &&
+			((struct sockaddr_in *)m->source)->sin_addr.s_addr != INADDR_ANY)
+		dest.sin_addr = ((struct sockaddr_in *)m->source)->sin_addr;
+
+	return reply_send(sink, buf, send_len, &dest, "DHCPACK");
 }
@@ -3,10 +3,43 @@
 #include <netinet/in.h>
 
 #include "dhcp.h"
+#include "scope.h"
+#include "dedup.h"
 
-extern struct sockaddr_in server_id;
-extern struct sockaddr_in broadcast;
+/* Where replies go. The daemon sends them on its socket, the benchmark
+ * keeps them in memory.
+ */
+struct packet_sink
+{
+	/* Deliver a reply, returns false and sets errno on failure */
+	bool (*send)(void *ctx, const uint8_t *buf, size_t len, const struct sockaddr_in *dest);
+	void *ctx;
 
-bool send_offer(int socket, struct dhcp_msg *m, struct dhcp_lease *l);
-bool send_ack(int socket, struct dhcp_msg *m, struct dhcp_lease *l);
-bool send_nak(int socket, struct dhcp_msg *m);
+	/* Destination of replies which are not relayed */
+	struct sockaddr_in broadcast;
+	/* Port relay agents receive replies on, host byte order */
+	uint16_t relay_port;
+	/* Reply to the source of a message instead of broadcasting */
+	bool unicast;
+
+	/* If not NULL, a reply which was sent is also kept here */
+	struct dedup *capture;
+};
+
+#define PACKET_SINK_EMPTY {\
+		.send = NULL,\
+		.ctx = NULL,\
+		.broadcast = {\
+			.sin_family = AF_INET,\
+			.sin_addr = {INADDR_BROADCAST},\
+			.sin_port = 0\
+		},\
+		.relay_port = 67,\
+		.unicast = false,\
+		.capture = NULL\
+	}
+
+bool send_offer(struct packet_sink *sink, struct dhcp_msg *m, struct scope *s, struct dhcp_lease *l);
+bool send_ack(struct packet_sink *sink, struct dhcp_msg *m, struct scope *s, struct dhcp_lease *l);
+bool send_nak(struct packet_sink *sink, struct dhcp_msg *m);
+bool send_inform(struct packet_sink *sink, struct dhcp_msg *m, struct scope *s);
@@ -0,0 +1,263 @@
+#include "pcap.h"
+
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#define PCAP_MAGIC      0xA1B2C3D4
+#define PCAP_MAGIC_NSEC 0xA1B23C4D
+
+#define PCAP_LINK_NULL     0
+#define PCAP_LINK_ETHERNET 1
+#define PCAP_LINK_RAW      101
+#define PCAP_LINK_SLL      113
+#define PCAP_LINK_IPV4     228
+#define PCAP_LINK_SLL2     276
+
+#define PCAP_ETHERTYPE_IPV4 0x0800
+#define PCAP_ETHERTYPE_VLAN 0x8100
+#define PCAP_ETHERTYPE_QINQ 0x88A8
+
+static uint32_t pcap_u32(struct pcap *p, const uint8_t *b)
+{
+	uint32_t v;
+
+	memcpy(&v, b, 4);
+
+	return p->swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t pcap_be16(const uint8_t *b)
+{
+	return b[0] << 8 | b[1];
+}
+
+bool pcap_open(struct pcap *p, FILE *file)
+{
+	uint8_t hdr[24];
+
+	p->file = file;
+	p->error = NULL;
+	p->swap = false;
+
+	if (fread(hdr, 1, sizeof hdr, file) != sizeof hdr) {
+		p->error = "Capture too short";
+		return false;
+	}
+
+	uint32_t magic = pcap_u32(p, hdr);
+
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC) {
+		p->swap = true;
+		magic = pcap_u32(p, hdr);
+	}
+
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC) {
+		p->error = "Not a pcap capture (pcapng is not supported)";
+		return false;
+	}
+
+	p->nsec = magic == PCAP_MAGIC_NSEC;
+	p->linktype = pcap_u32(p, hdr + 20) & 0xFFFF;
+
+	switch (p->linktype)
+	{
+		case PCAP_LINK_NULL:
+		case PCAP_LINK_ETHERNET:
+		case PCAP_LINK_RAW:
+		case PCAP_LINK_SLL:
+		case PCAP_LINK_IPV4:
+		case PCAP_LINK_SLL2:
+			return true;
+
+		default:
+			p->error = "Unsupported link type";
+			return false;
+	}
+}
+
+/**
+ * Find the IPv4 header of a frame
+ *
+ * @return Offset of the IPv4 header, or 0 if the frame holds no IPv4
+ */
+static size_t pcap_ipv4(struct pcap *p, const uint8_t *b, size_t len)
+{
+	size_t off = 0;
+	uint16_t type = PCAP_ETHERTYPE_IPV4;
+
+	switch (p->linktype)
+	{
+		case PCAP_LINK_NULL:
+			/* Address family in host byte order of the capturing host */
+			if (len < 4 || pcap_u32(p, b) != AF_INET)
+				return 0;
+			return 4;
+
+		case PCAP_LINK_ETHERNET:
+			if (len < 14)
+				return 0;
+
+			type = pcap_be16(b + 12);
+			off = 14;
+
+			while ((type == PCAP_ETHERTYPE_VLAN || type == PCAP_ETHERTYPE_QINQ) && off + 4 <= len) {
+				type = pcap_be16(b + off + 2);
+				off += 4;
+			}
+			break;
+
+		case PCAP_LINK_SLL:
+			if (len < 16)
+				return 0;
+
+			type = pcap_be16(b + 14);
+			off = 16;
+			break;
+
+		case PCAP_LINK_SLL2:
+			if (len < 20)
+				return 0;
+
+			type = pcap_be16(b);
+			off = 20;
+			break;
+	}
+
+	return type == PCAP_ETHERTYPE_IPV4 && off < len ? off : 0;
+}
+
+int pcap_next_udp(struct pcap *p, struct pcap_udp *out)
+{
+	uint8_t rec[16];
+
+	while (fread(rec, 1, sizeof rec, p->file) == sizeof rec)
+	{
+		uint32_t sec = pcap_u32(p, rec);
+		uint32_t frac = pcap_u32(p, rec + 4);
+		uint32_t caplen = pcap_u32(p, rec + 8);
+
+		if (caplen > PCAP_SNAPLEN) {
+			p->error = "Record larger than the snapshot length";
+			return -1;
+		}
+
+		if (fread(p->buf, 1, caplen, p->file) != caplen) {
+			p->error = "Capture truncated";
+			return -1;
+		}
+
+		size_t off = 0;
+
+		if (p->linktype != PCAP_LINK_RAW && p->linktype != PCAP_LINK_IPV4)
+			if ((off = pcap_ipv4(p, p->buf, caplen)) == 0)
+				continue;
+
+		uint8_t *ip = p->buf + off;
+		size_t len = caplen - off;
+
+		if (len < 20 || ip[0] >> 4 != 4 || ip[9] != IPPROTO_UDP)
+			continue;
+
+		size_t ihl = (ip[0] & 0x0F) * 4;
+		size_t total = pcap_be16(ip + 2);
+
+		/* Fragments are left out, DHCP messages fit into a single packet */
+		if ((pcap_be16(ip + 6) & 0x3FFF) != 0)
+			continue;
+
+		if (ihl < 20 || total < ihl + 8 || total > len)
+			continue;
+
+		uint8_t *udp = ip + ihl;
+		size_t udp_len = pcap_be16(udp + 4);
+
+		if (udp_len < 8 || ihl + udp_len > total)
+			continue;
+
+		out->ts = sec + frac / (p->nsec ? 1e9 : 1e6);
+
+		out->src = (struct sockaddr_in){ .sin_family = AF_INET };
+		memcpy(&out->src.sin_addr, ip + 12, 4);
+		memcpy(&out->src.sin_port, udp, 2);
+
+		out->dst = (struct sockaddr_in){ .sin_family = AF_INET };
+		memcpy(&out->dst.sin_addr, ip + 16, 4);
+		memcpy(&out->dst.sin_port, udp + 2, 2);
+
+		out->data = udp + 8;
+		out->len = udp_len - 8;
+
+		return 1;
+	}
+
+	if (!feof(p->file)) {
+		p->error = "Could not read capture";
+		return -1;
+	}
+
+	return 0;
+}
+
+bool pcap_write_header(FILE *file)
+{
+	uint32_t hdr[6] = {
+		PCAP_MAGIC,
+		/* Version 2.4 */
+		2 | 4 << 16,
+		0,
+		0,
+		PCAP_SNAPLEN,
+		PCAP_LINK_RAW
+	};
+
+	return fwrite(hdr, sizeof hdr, 1, file) == 1;
+}
+
+bool pcap_write_udp(FILE *file, double ts, const struct sockaddr_in *src,
+	const struct sockaddr_in *dst, const uint8_t *data, size_t len)
+{
+	uint8_t hdr[28] = {0};
+	size_t total = sizeof hdr + len;
+
+	if (total > PCAP_SNAPLEN)
+		return false;
+
+	uint32_t sec = ts;
+	uint32_t rec[4] = {
+		sec,
+		(uint32_t)((ts - sec) * 1e6),
+		total,
+		total
+	};
+
+	/* IPv4 header, don't fragment, TTL 64 */
+	hdr[0] = 0x45;
+	hdr[2] = total >> 8;
+	hdr[3] = total;
+	hdr[6] = 0x40;
+	hdr[8] = 64;
+	hdr[9] = IPPROTO_UDP;
+	memcpy(hdr + 12, &src->sin_addr, 4);
+	memcpy(hdr + 16, &dst->sin_addr, 4);
+
+	uint32_t sum = 0;
+
+	for (size_t i = 0; i < 20; i += 2)
+		sum += pcap_be16(hdr + i);
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	hdr[10] = ~sum >> 8;
+	hdr[11] = ~sum;
+
+	/* UDP header, no checksum */
+	memcpy(hdr + 20, &src->sin_port, 2);
+	memcpy(hdr + 22, &dst->sin_port, 2);
+	hdr[24] = (len + 8) >> 8;
+	hdr[25] = len + 8;
+
+	return fwrite(rec, sizeof rec, 1, file) == 1 &&
+		fwrite(hdr, sizeof hdr, 1, file) == 1 &&
+		fwrite(data, len, 1, file) == 1;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <netinet/in.h>
+
+/* Reader and writer of classic pcap files, reduced to what replaying DHCP
+ * needs: IPv4 UDP datagrams. The reader understands Ethernet (with VLAN
+ * tags), Linux cooked capture v1 and v2, BSD loopback and raw IPv4, in
+ * either byte order and with micro- or nanosecond timestamps. The writer
+ * always writes raw IPv4 records.
+ */
+
+#ifndef PCAP_SNAPLEN
+#define PCAP_SNAPLEN 65535
+#endif
+
+struct pcap
+{
+	FILE *file;
+	const char *error;
+
+	/* File was written on a host of the other byte order */
+	bool swap;
+	/* Timestamps are in nanoseconds instead of microseconds */
+	bool nsec;
+	uint32_t linktype;
+
+	uint8_t buf[PCAP_SNAPLEN];
+};
+
+/* A UDP datagram of a capture. data points into the buffer of the reader
+ * and is only valid until the next record is read.
+ */
+struct pcap_udp
+{
+	double ts;
+
+	struct sockaddr_in src;
+	struct sockaddr_in dst;
+
+	uint8_t *data;
+	size_t len;
+};
+
+/**
+ * Read the file header of a capture
+ *
+ * @param[out] p Reader
+ * @param[in] file Capture, positioned at its start
+ * @return Whether this is a capture of a supported link type, otherwise
+ *         p->error tells why not
+ */
+extern bool pcap_open(struct pcap *p, FILE *file);
+
+/**
+ * Read up to the next record holding an unfragmented IPv4 UDP datagram,
+ * any other record is skipped
+ *
+ * @return 1 if out holds a datagram, 0 at the end of the capture and -1 if
+ *         the capture is truncated or corrupt, with p->error set
+ */
+extern int pcap_next_udp(struct pcap *p, struct pcap_udp *out);
+
+/**
+ * Write the file header of a raw IPv4 capture
+ */
+extern bool pcap_write_header(FILE *file);
+
+/**
+ * Write a UDP datagram as a raw IPv4 record
+ *
+ * @param[in] file Capture started with pcap_write_header
+ * @param[in] ts Time of the record
+ * @param[in] src Source address and port
+ * @param[in] dst Destination address and port
+ * @param[in] data Payload
+ * @param[in] len Length of the payload
+ */
+extern bool pcap_write_udp(FILE *file, double ts, const struct sockaddr_in *src,
+	const struct sockaddr_in *dst, const uint8_t *data, size_t len);
@@ -0,0 +1,193 @@
+#include "pending.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PENDING_SLOT(handle) ((handle) & (PENDING_MAX - 1))
+
+struct pending *pending_create(uint32_t size)
+{
+	if (size == 0 || size > PENDING_MAX)
+		return NULL;
+
+	struct pending *t = calloc(1, sizeof(struct pending));
+
+	if (t == NULL)
+		return NULL;
+
+	t->entries = malloc(size * sizeof(struct pending_entry));
+	t->free = malloc(size * sizeof(uint32_t));
+	t->heap = malloc(size * sizeof(uint32_t));
+
+	if (t->entries == NULL || t->free == NULL || t->heap == NULL) {
+		pending_destroy(t);
+		return NULL;
+	}
+
+	t->size = size;
+
+	for (uint32_t i = 0; i < size; ++i)
+	{
+		t->entries[i].handle = i;
+		t->entries[i].heap = UINT32_MAX;
+		t->free[t->free_cnt++] = size - 1 - i;
+	}
+
+	return t;
+}
+
+void pending_destroy(struct pending *t)
+{
+	free(t->entries);
+	free(t->free);
+	free(t->heap);
+	free(t);
+}
+
+static void pending_place(struct pending *t, uint32_t pos, uint32_t slot)
+{
+	t->heap[pos] = slot;
+	t->entries[slot].heap = pos;
+}
+
+static void pending_up(struct pending *t, uint32_t pos)
+{
+	uint32_t slot = t->heap[pos];
+	ev_tstamp deadline = t->entries[slot].deadline;
+
+	while (pos > 0)
+	{
+		uint32_t parent = (pos - 1) / 2;
+
+		if (t->entries[t->heap[parent]].deadline <= deadline)
+			break;
+
+		pending_place(t, pos, t->heap[parent]);
+		pos = parent;
+	}
+
+	pending_place(t, pos, slot);
+}
+
+static void pending_down(struct pending *t, uint32_t pos)
+{
+	uint32_t slot = t->heap[pos];
+	ev_tstamp deadline = t->entries[slot].deadline;
+
+	for (;;)
+	{
+		uint32_t child = 2 * pos + 1;
+
+		if (child >= t->heap_cnt)
+			break;
+
+		if (child + 1 < t->heap_cnt &&
+				t->entries[t->heap[child + 1]].deadline < t->entries[t->heap[child]].deadline)
+			++child;
+
+		if (deadline <= t->entries[t->heap[child]].deadline)
+			break;
+
+		pending_place(t, pos, t->heap[child]);
+		pos = child;
+	}
+
+	pending_place(t, pos, slot);
+}
+
+struct pending_entry *pending_add(struct pending *t,
+	const struct dhcp_msg *msg, ev_tstamp deadline, pending_cb resume,
+	void *ctx)
+{
+	if (t->free_cnt == 0 || msg->length > DHCP_MSG_MAXLEN)
+		return NULL;
+
+	uint32_t slot = t->free[--t->free_cnt];
+	struct pending_entry *e = &t->entries[slot];
+
+	e->handle += PENDING_MAX;
+	e->deadline = deadline;
+	e->resume = resume;
+	e->ctx = ctx;
+	e->key = msg->key;
+	e->type = msg->type;
+	e->address.s_addr = INADDR_ANY;
+	memcpy(&e->source, msg->source, sizeof e->source);
+	e->len = msg->length;
+	memcpy(e->data, msg->data, msg->length);
+
+	pending_place(t, t->heap_cnt++, slot);
+	pending_up(t, e->heap);
+
+	return e;
+}
+
+/**
+ * Take an entry out of the heap, the last one fills its place
+ */
+static void pending_unlink(struct pending *t, struct pending_entry *e)
+{
+	uint32_t pos = e->heap;
+	uint32_t last = t->heap[--t->heap_cnt];
+
+	if (pos < t->heap_cnt) {
+		pending_place(t, pos, last);
+		pending_up(t, pos);
+		pending_down(t, t->entries[last].heap);
+	}
+
+	e->heap = UINT32_MAX;
+}
+
+void pending_remove(struct pending *t, struct pending_entry *e)
+{
+	if (e->heap == UINT32_MAX)
+		return;
+
+	pending_unlink(t, e);
+	t->free[t->free_cnt++] = PENDING_SLOT(e->handle);
+}
+
+/**
+ * Resume an entry and free it afterwards, so the request can't be
+ * suspended over itself
+ */
+static void pending_finish(struct pending *t, struct pending_entry *e,
+	bool timeout, uint32_t result)
+{
+	pending_unlink(t, e);
+
+	e->resume(e->ctx, e, timeout, result);
+
+	t->free[t->free_cnt++] = PENDING_SLOT(e->handle);
+}
+
+bool pending_resume(struct pending *t, uint32_t handle, uint32_t result)
+{
+	uint32_t slot = PENDING_SLOT(handle);
+
+	if (slot >= t->size)
+		return false;
+
+	struct pending_entry *e = &t->entries[slot];
+
+	if (e->handle != handle || e->heap == UINT32_MAX)
+		return false;
+
+	pending_finish(t, e, false, result);
+
+	return true;
+}
+
+size_t pending_expire(struct pending *t, ev_tstamp now)
+{
+	size_t cnt = 0;
+
+	while (t->heap_cnt > 0 && t->entries[t->heap[0]].deadline <= now)
+	{
+		pending_finish(t, &t->entries[t->heap[0]], true, 0);
+		++cnt;
+	}
+
+	return cnt;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+#include <ev.h>
+
+#include "ckey.h"
+#include "dhcp.h"
+
+/* Requests whose handling waits for something else, e.g. the probe of an
+ * address or a lookup elsewhere. The handler copies what it needs to
+ * continue into an entry and returns; the result later resumes it through
+ * the callback of the entry, or, if none comes in time, the callback is
+ * told that the entry timed out. Other clients are served meanwhile.
+ *
+ * Entries come from a slab allocated up front, so a flood can't make the
+ * table grow, it just fills up. Deadlines are kept in one binary heap, so
+ * the owner needs a single timer for the earliest one. An entry is named by
+ * a handle which changes every time its slot is reused, so a late result
+ * for an entry which timed out is recognized and ignored.
+ */
+
+/* Entries at most, handles keep the slot in 16 bits */
+#define PENDING_MAX 65536
+
+struct pending_entry;
+
+/**
+ * Continue a request
+ *
+ * @param[in] ctx Context the entry was added with
+ * @param[in] e Entry, freed after the call
+ * @param[in] timeout Whether the deadline passed without a result
+ * @param[in] result Result passed to pending_resume, 0 on timeout
+ */
+typedef void (*pending_cb)(void *ctx, struct pending_entry *e, bool timeout,
+	uint32_t result);
+
+struct pending_entry
+{
+	uint32_t handle;
+	/* Position in the heap, UINT32_MAX if free */
+	uint32_t heap;
+	ev_tstamp deadline;
+
+	pending_cb resume;
+	void *ctx;
+
+	/* What a handler needs to continue: the parsed key and type, a value
+	 * of its choice and the request itself, to build the reply from
+	 */
+	struct ckey key;
+	enum dhcp_msg_type type;
+	struct in_addr address;
+	struct sockaddr_in source;
+	uint16_t len;
+	uint8_t data[DHCP_MSG_MAXLEN];
+};
+
+struct pending
+{
+	struct pending_entry *entries;
+	uint32_t size;
+
+	/* Stack of free slots */
+	uint32_t *free;
+	uint32_t free_cnt;
+
+	/* Slots by deadline, the earliest first */
+	uint32_t *heap;
+	uint32_t heap_cnt;
+};
+
+/**
+ * Create a table
+ *
+ * @param[in] size Number of entries, at most PENDING_MAX
+ * @return The table, or NULL if it could not be allocated
+ */
+extern struct pending *pending_create(uint32_t size);
+
+extern void pending_destroy(struct pending *t);
+
+/**
+ * Suspend a request
+ *
+ * @param[in] t Table
+ * @param[in] msg Request, copied with its key, type and source
+ * @param[in] deadline When the entry times out
+ * @param[in] resume Called with the result or on timeout
+ * @param[in] ctx Passed to resume
+ * @return The entry, or NULL if the table is full or the request longer
+ *         than an entry holds
+ */
+extern struct pending_entry *pending_add(struct pending *t,
+	const struct dhcp_msg *msg, ev_tstamp deadline, pending_cb resume,
+	void *ctx);
+
+/**
+ * Free an entry without resuming it, e.g. if what it waits for could not
+ * be started
+ */
+extern void pending_remove(struct pending *t, struct pending_entry *e);
+
+/**
+ * Resume the request of a handle with a result
+ *
+ * @return Whether the handle named a waiting entry, false if it timed out
+ *         or was resumed before
+ */
+extern bool pending_resume(struct pending *t, uint32_t handle, uint32_t result);
+
+/**
+ * Resume all entries whose deadline is not after now as timed out
+ *
+ * @return Number of entries which timed out
+ */
+extern size_t pending_expire(struct pending *t, ev_tstamp now);
+
+/**
+ * Earliest deadline, to set the timer of the owner to
+ *
+ * @return Whether any entry is waiting
+ */
+static inline bool pending_next(const struct pending *t, ev_tstamp *deadline)
+{
+	if (t->heap_cnt == 0)
+		return false;
+
+	*deadline = t->entries[t->heap[0]].deadline;
+
+	return true;
+}
+
+static inline uint32_t pending_count(const struct pending *t)
+{
+	return t->heap_cnt;
+}
@@ -3,12 +3,14 @@
 
 #include "pool.h"
 
-struct pool *pool_create(uint32_t size) {
+struct pool *pool_create(struct in_addr first, struct in_addr last) {
 	struct pool *pool;
 
 	pool = (struct pool*)calloc(1, sizeof(struct pool));
 
-	pool_resize(pool, size);
+	pool->base = ntohl(first.s_addr);
+	pool->size = ntohl(last.s_addr) >= pool->base ? ntohl(last.s_addr) - pool->base + 1 : 0;
+	pool->bits = (uint64_t*)calloc(pool->size / 64 + 1, sizeof(uint64_t));
 
 	return pool;
 }
@@ -16,37 +18,78 @@ struct pool *pool_create(uint32_t size) {
 void pool_destroy(struct pool *pool) {
 	assert(pool != NULL);
 
-	free(pool->a);
+	free(pool->bits);
 	free(pool);
 }
 
-struct pool_entry *pool_get(struct pool *pool) {
-	struct pool_entry *entry;
+/**
+ * Find the next free address at or after off, wrapping around at the end of
+ * the range. Bits beyond the range are never set.
+ */
+static uint32_t pool_next(struct pool *pool, uint32_t off) {
+	uint32_t words = pool->size / 64 + 1;
+	uint32_t w = off / 64;
+	uint64_t m = pool->bits[w] & (~0ULL << (off % 64));
+
+	for (uint32_t n = 0; n <= words; ++n)
+	{
+		if (m)
+			return w * 64 + __builtin_ctzll(m);
+
+		w = (w + 1) % words;
+		m = pool->bits[w];
+	}
+
+	/* Only reached with an empty pool, which callers rule out */
+	return 0;
+}
+
+static void pool_clear(struct pool *pool, uint32_t off, struct in_addr *address) {
+	pool->bits[off / 64] &= ~(1ULL << (off % 64));
+	--pool->free;
 
-	if (pool->size == 0)
-		return NULL;
+	address->s_addr = htonl(pool->base + off);
+}
+
+bool pool_get(struct pool *pool, struct in_addr *address) {
+	if (pool->free == 0)
+		return false;
 
-	entry = (struct pool_entry*)malloc(sizeof(struct pool_entry));
-	*entry = pool->a[--pool->size];
+	uint32_t off = pool_next(pool, pool->next);
 
-	return entry;
+	pool->next = off + 1 < pool->size ? off + 1 : 0;
+
+	pool_clear(pool, off, address);
+
+	return true;
 }
 
-bool pool_add(struct pool *pool, struct pool_entry *entry) {
-	if (pool->limit < pool->size + 1)
+bool pool_get_hash(struct pool *pool, uint32_t hash, struct in_addr *address) {
+	if (pool->free == 0)
 		return false;
 
-	pool->a[pool->size++] = *entry;
+	pool_clear(pool, pool_next(pool, hash % pool->size), address);
 
 	return true;
 }
 
-void pool_resize(struct pool *pool, uint32_t limit) {
-  pool->a = (struct pool_entry*)realloc(pool->a,
-			sizeof(struct pool_entry) * limit);
+bool pool_take(struct pool *pool, struct in_addr address) {
+	if (!pool_is_free(pool, address))
+		return false;
 
-	pool->limit = limit;
+	pool_clear(pool, ntohl(address.s_addr) - pool->base, &address);
 
-	if (pool->size > pool->limit)
-		pool->size = pool->limit;
+	return true;
+}
+
+bool pool_add(struct pool *pool, struct in_addr address) {
+	uint32_t off = ntohl(address.s_addr) - pool->base;
+
+	if (off >= pool->size || (pool->bits[off / 64] & (1ULL << (off % 64))))
+		return false;
+
+	pool->bits[off / 64] |= 1ULL << (off % 64);
+	++pool->free;
+
+	return true;
 }
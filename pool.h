@@ -3,27 +3,40 @@
 #include <arpa/inet.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <ev.h>
-
-struct pool_entry {
-  ev_tstamp acquired_at;
-  bool own;
-  struct in_addr address;
-};
-
 
+/* The pool is a bitmap of the free addresses of a range, one bit per
+ * address. Finding a free address is a scan for the next set bit, which
+ * looks at 64 addresses at a time.
+ */
 struct pool {
-  uint32_t limit; // current array size
-  uint32_t size; // index of last entry
-  struct pool_entry *a;
+  uint32_t base; // first address, host byte order
+  uint32_t size; // number of addresses in the range
+  uint32_t free; // number of free addresses
+  uint32_t next; // where pool_get continues searching
+  uint64_t *bits;
 };
 
-struct pool *pool_create(uint32_t size);
+struct pool *pool_create(struct in_addr first, struct in_addr last);
 void pool_destroy(struct pool *pool);
 
-// May return NULL if empty
-struct pool_entry *pool_get(struct pool *pool);
+// Returns false if empty
+bool pool_get(struct pool *pool, struct in_addr *address);
+
+/**
+ * Take the free address derived from hash
+ *
+ * The same hash always yields the same address as long as it is free, if it
+ * is not the next free address after it is taken.
+ */
+bool pool_get_hash(struct pool *pool, uint32_t hash, struct in_addr *address);
+
+// Returns false if the address is not free
+bool pool_take(struct pool *pool, struct in_addr address);
+
+static inline bool pool_is_free(struct pool *pool, struct in_addr address) {
+	uint32_t off = ntohl(address.s_addr) - pool->base;
 
-bool pool_add(struct pool *pool, struct pool_entry *entry);
+	return off < pool->size && (pool->bits[off / 64] & (1ULL << (off % 64)));
+}
 
-void pool_resize(struct pool *pool, uint32_t limit);
+bool pool_add(struct pool *pool, struct in_addr address);
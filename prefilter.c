@@ -0,0 +1,464 @@
+#include "prefilter.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+
+#include "dhcp.h"
+#include "error.h"
+
+#ifdef __linux__
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+
+/* Offsets into an untagged IPv4 frame without IP options */
+#define PF_ETH_TYPE 12
+#define PF_IP 14
+#define PF_IP_FRAG (PF_IP + 6)
+#define PF_IP_PROTO (PF_IP + 9)
+#define PF_UDP_DPORT (PF_IP + 22)
+#define PF_BOOTP (PF_IP + 28)
+#define PF_BOOTP_CHADDR (PF_BOOTP + 28)
+#define PF_BOOTP_MAGIC (PF_BOOTP + 236)
+#define PF_BOOTP_END (PF_BOOTP + DHCP_MSG_HDRLEN)
+
+#define PF_BOOTREQUEST 1
+#define PF_MAGIC 0x63825363
+
+#define PF_WINDOW_NS 1000000000
+
+/* Stack of the program: key and value of the client map, counter index */
+#define PF_STACK_KEY -8
+#define PF_STACK_VALUE -24
+#define PF_STACK_INDEX -32
+
+enum pf_label
+{
+	PF_L_PASS_OTHER,
+	PF_L_PASS,
+	PF_L_DROP,
+	PF_L_COUNT,
+	PF_L_DONE,
+	PF_L_NEW_CLIENT,
+	PF_L_RESET,
+
+	PF_LABELS
+};
+
+#define PF_MAX_INSNS 128
+
+/* A program being assembled, jumps name a label and are resolved at the
+ * end
+ */
+struct pf_asm
+{
+	struct bpf_insn insns[PF_MAX_INSNS];
+	int8_t jump_label[PF_MAX_INSNS];
+	int labels[PF_LABELS];
+	unsigned len;
+};
+
+#define PF_INSN(c, d, s, o, i) ((struct bpf_insn){ \
+		.code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+
+#define PF_MOV_IMM(d, i) PF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define PF_MOV_REG(d, s) PF_INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define PF_ADD_IMM(d, i) PF_INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define PF_SUB_REG(d, s) PF_INSN(BPF_ALU64 | BPF_SUB | BPF_X, d, s, 0, 0)
+#define PF_AND_IMM(d, i) PF_INSN(BPF_ALU64 | BPF_AND | BPF_K, d, 0, 0, i)
+#define PF_LDX(size, d, s, o) PF_INSN(BPF_LDX | (size) | BPF_MEM, d, s, o, 0)
+#define PF_STX(size, d, s, o) PF_INSN(BPF_STX | (size) | BPF_MEM, d, s, o, 0)
+#define PF_ST(size, d, o, i) PF_INSN(BPF_ST | (size) | BPF_MEM, d, 0, o, i)
+#define PF_ATOMIC_ADD(d, s, o) PF_INSN(BPF_STX | BPF_DW | BPF_ATOMIC, d, s, o, BPF_ADD)
+#define PF_CALL(f) PF_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define PF_EXIT() PF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+static void pf_emit(struct pf_asm *a, struct bpf_insn insn)
+{
+	if (a->len < PF_MAX_INSNS) {
+		a->jump_label[a->len] = -1;
+		a->insns[a->len] = insn;
+	}
+
+	++a->len;
+}
+
+/**
+ * Conditional jump, class BPF_JMP or BPF_JMP32, compared with an immediate
+ * or, for BPF_X, a register
+ */
+static void pf_jump(struct pf_asm *a, uint8_t code, uint8_t dst, uint8_t src,
+	int32_t imm, enum pf_label label)
+{
+	unsigned i = a->len;
+
+	pf_emit(a, PF_INSN(code, dst, src, 0, imm));
+
+	if (i < PF_MAX_INSNS)
+		a->jump_label[i] = label;
+}
+
+static void pf_goto(struct pf_asm *a, enum pf_label label)
+{
+	pf_jump(a, BPF_JMP | BPF_JA, 0, 0, 0, label);
+}
+
+static void pf_label(struct pf_asm *a, enum pf_label label)
+{
+	a->labels[label] = a->len;
+}
+
+/**
+ * 64 bit immediate load of a map descriptor, two instructions
+ */
+static void pf_ld_map(struct pf_asm *a, uint8_t dst, int fd)
+{
+	pf_emit(a, PF_INSN(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd));
+	pf_emit(a, PF_INSN(0, 0, 0, 0, 0));
+}
+
+static bool pf_resolve(struct pf_asm *a)
+{
+	if (a->len > PF_MAX_INSNS)
+		return false;
+
+	for (unsigned i = 0; i < a->len; ++i)
+		if (a->jump_label[i] >= 0)
+			a->insns[i].off = a->labels[a->jump_label[i]] - (int)(i + 1);
+
+	return true;
+}
+
+/**
+ * Assemble the program, see prefilter.h. Registers: r6 data, r7 counter of
+ * the verdict, r8 time, r9 verdict.
+ */
+static bool pf_assemble(struct pf_asm *a, const struct prefilter *p,
+	uint16_t port, uint32_t rate)
+{
+	memset(a, 0, sizeof *a);
+
+	pf_emit(a, PF_LDX(BPF_W, BPF_REG_6, BPF_REG_1, offsetof(struct xdp_md, data)));
+	pf_emit(a, PF_LDX(BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end)));
+
+	/* Anything but UDP to the server port in an untagged, unfragmented
+	 * IPv4 frame without options is left to the stack
+	 */
+	pf_emit(a, PF_MOV_REG(BPF_REG_4, BPF_REG_6));
+	pf_emit(a, PF_ADD_IMM(BPF_REG_4, PF_BOOTP));
+	pf_jump(a, BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, PF_L_PASS_OTHER);
+
+	pf_emit(a, PF_LDX(BPF_H, BPF_REG_5, BPF_REG_6, PF_ETH_TYPE));
+	pf_jump(a, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, htons(0x0800), PF_L_PASS_OTHER);
+	pf_emit(a, PF_LDX(BPF_B, BPF_REG_5, BPF_REG_6, PF_IP));
+	pf_jump(a, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 0x45, PF_L_PASS_OTHER);
+	pf_emit(a, PF_LDX(BPF_B, BPF_REG_5, BPF_REG_6, PF_IP_PROTO));
+	pf_jump(a, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, IPPROTO_UDP, PF_L_PASS_OTHER);
+	pf_emit(a, PF_LDX(BPF_H, BPF_REG_5, BPF_REG_6, PF_IP_FRAG));
+	pf_emit(a, PF_AND_IMM(BPF_REG_5, htons(0x3fff)));
+	pf_jump(a, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 0, PF_L_PASS_OTHER);
+	pf_emit(a, PF_LDX(BPF_H, BPF_REG_5, BPF_REG_6, PF_UDP_DPORT));
+	pf_jump(a, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, htons(port), PF_L_PASS_OTHER);
+
+	/* A request to us, it has to look like one */
+	pf_emit(a, PF_MOV_IMM(BPF_REG_7, PREFILTER_RUNT));
+	pf_emit(a, PF_MOV_REG(BPF_REG_4, BPF_REG_6));
+	pf_emit(a, PF_ADD_IMM(BPF_REG_4, PF_BOOTP_END));
+	pf_jump(a, BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 0, PF_L_DROP);
+
+	pf_emit(a, PF_MOV_IMM(BPF_REG_7, PREFILTER_OP));
+	pf_emit(a, PF_LDX(BPF_B, BPF_REG_5, BPF_REG_6, PF_BOOTP));
+	pf_jump(a, BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, PF_BOOTREQUEST, PF_L_DROP);
+
+	pf_emit(a, PF_MOV_IMM(BPF_REG_7, PREFILTER_COOKIE));
+	pf_emit(a, PF_LDX(BPF_W, BPF_REG_5, BPF_REG_6, PF_BOOTP_MAGIC));
+	pf_jump(a, BPF_JMP32 | BPF_JNE | BPF_K, BPF_REG_5, 0,
+		(int32_t)htonl(PF_MAGIC), PF_L_DROP);
+
+	if (rate > 0) {
+		/* chaddr, padded to 8 bytes */
+		pf_emit(a, PF_LDX(BPF_W, BPF_REG_5, BPF_REG_6, PF_BOOTP_CHADDR));
+		pf_emit(a, PF_STX(BPF_W, BPF_REG_10, BPF_REG_5, PF_STACK_KEY));
+		pf_emit(a, PF_LDX(BPF_H, BPF_REG_5, BPF_REG_6, PF_BOOTP_CHADDR + 4));
+		pf_emit(a, PF_STX(BPF_H, BPF_REG_10, BPF_REG_5, PF_STACK_KEY + 4));
+		pf_emit(a, PF_ST(BPF_H, BPF_REG_10, PF_STACK_KEY + 6, 0));
+
+		pf_emit(a, PF_CALL(BPF_FUNC_ktime_get_ns));
+		pf_emit(a, PF_MOV_REG(BPF_REG_8, BPF_REG_0));
+
+		pf_ld_map(a, BPF_REG_1, p->clients);
+		pf_emit(a, PF_MOV_REG(BPF_REG_2, BPF_REG_10));
+		pf_emit(a, PF_ADD_IMM(BPF_REG_2, PF_STACK_KEY));
+		pf_emit(a, PF_CALL(BPF_FUNC_map_lookup_elem));
+		pf_jump(a, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 0, PF_L_NEW_CLIENT);
+
+		/* A fixed window per client, updates racing on other CPUs may
+		 * lose a request or two, which is fine for a limit
+		 */
+		pf_emit(a, PF_LDX(BPF_DW, BPF_REG_1, BPF_REG_0, 0));
+		pf_emit(a, PF_MOV_REG(BPF_REG_2, BPF_REG_8));
+		pf_emit(a, PF_SUB_REG(BPF_REG_2, BPF_REG_1));
+		pf_jump(a, BPF_JMP | BPF_JGT | BPF_K, BPF_REG_2, 0, PF_WINDOW_NS, PF_L_RESET);
+
+		pf_emit(a, PF_LDX(BPF_DW, BPF_REG_1, BPF_REG_0, 8));
+		pf_emit(a, PF_ADD_IMM(BPF_REG_1, 1));
+		pf_emit(a, PF_STX(BPF_DW, BPF_REG_0, BPF_REG_1, 8));
+		pf_emit(a, PF_MOV_IMM(BPF_REG_7, PREFILTER_RATE));
+		pf_jump(a, BPF_JMP | BPF_JGT | BPF_K, BPF_REG_1, 0,
+			rate > INT32_MAX ? INT32_MAX : (int32_t)rate, PF_L_DROP);
+		pf_goto(a, PF_L_PASS);
+
+		pf_label(a, PF_L_RESET);
+		pf_emit(a, PF_STX(BPF_DW, BPF_REG_0, BPF_REG_8, 0));
+		pf_emit(a, PF_ST(BPF_DW, BPF_REG_0, 8, 1));
+		pf_goto(a, PF_L_PASS);
+
+		pf_label(a, PF_L_NEW_CLIENT);
+		pf_emit(a, PF_STX(BPF_DW, BPF_REG_10, BPF_REG_8, PF_STACK_VALUE));
+		pf_emit(a, PF_ST(BPF_DW, BPF_REG_10, PF_STACK_VALUE + 8, 1));
+		pf_ld_map(a, BPF_REG_1, p->clients);
+		pf_emit(a, PF_MOV_REG(BPF_REG_2, BPF_REG_10));
+		pf_emit(a, PF_ADD_IMM(BPF_REG_2, PF_STACK_KEY));
+		pf_emit(a, PF_MOV_REG(BPF_REG_3, BPF_REG_10));
+		pf_emit(a, PF_ADD_IMM(BPF_REG_3, PF_STACK_VALUE));
+		pf_emit(a, PF_MOV_IMM(BPF_REG_4, BPF_ANY));
+		pf_emit(a, PF_CALL(BPF_FUNC_map_update_elem));
+	}
+
+	pf_label(a, PF_L_PASS);
+	pf_emit(a, PF_MOV_IMM(BPF_REG_7, PREFILTER_PASSED));
+	pf_emit(a, PF_MOV_IMM(BPF_REG_9, XDP_PASS));
+	pf_goto(a, PF_L_COUNT);
+
+	pf_label(a, PF_L_DROP);
+	pf_emit(a, PF_MOV_IMM(BPF_REG_9, XDP_DROP));
+
+	pf_label(a, PF_L_COUNT);
+	pf_emit(a, PF_STX(BPF_W, BPF_REG_10, BPF_REG_7, PF_STACK_INDEX));
+	pf_ld_map(a, BPF_REG_1, p->counters);
+	pf_emit(a, PF_MOV_REG(BPF_REG_2, BPF_REG_10));
+	pf_emit(a, PF_ADD_IMM(BPF_REG_2, PF_STACK_INDEX));
+	pf_emit(a, PF_CALL(BPF_FUNC_map_lookup_elem));
+	pf_jump(a, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 0, PF_L_DONE);
+	pf_emit(a, PF_MOV_IMM(BPF_REG_1, 1));
+	pf_emit(a, PF_ATOMIC_ADD(BPF_REG_0, BPF_REG_1, 0));
+
+	pf_label(a, PF_L_DONE);
+	pf_emit(a, PF_MOV_REG(BPF_REG_0, BPF_REG_9));
+	pf_emit(a, PF_EXIT());
+
+	pf_label(a, PF_L_PASS_OTHER);
+	pf_emit(a, PF_MOV_IMM(BPF_REG_0, XDP_PASS));
+	pf_emit(a, PF_EXIT());
+
+	return pf_resolve(a);
+}
+
+static int pf_bpf(enum bpf_cmd cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof *attr);
+}
+
+static int pf_map(enum bpf_map_type type, uint32_t key, uint32_t value,
+	uint32_t entries)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.map_type = type;
+	attr.key_size = key;
+	attr.value_size = value;
+	attr.max_entries = entries;
+
+	return pf_bpf(BPF_MAP_CREATE, &attr);
+}
+
+static int pf_load(const struct pf_asm *a)
+{
+	static char log[16384];
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t)a->insns;
+	attr.insn_cnt = a->len;
+	attr.license = (uintptr_t)"BSD";
+
+	int fd = pf_bpf(BPF_PROG_LOAD, &attr);
+
+	/* Again, to tell why the verifier refused it */
+	if (fd < 0 && errno == EACCES) {
+		attr.log_buf = (uintptr_t)log;
+		attr.log_size = sizeof log;
+		attr.log_level = 1;
+
+		if ((fd = pf_bpf(BPF_PROG_LOAD, &attr)) < 0) {
+			int err = errno;
+
+			dhcpd_error(0, 0, "%s", log);
+			errno = err;
+		}
+	}
+
+	return fd;
+}
+
+struct prefilter *prefilter_attach(int ifindex, uint16_t port,
+	uint32_t rate, bool generic)
+{
+	struct prefilter *p = malloc(sizeof(struct prefilter));
+
+	if (p == NULL)
+		return NULL;
+
+	*p = (struct prefilter){ .prog = -1, .link = -1, .counters = -1, .clients = -1 };
+
+	struct pf_asm *a = malloc(sizeof(struct pf_asm));
+
+	if (a == NULL)
+		goto fail;
+
+	p->counters = pf_map(BPF_MAP_TYPE_ARRAY, sizeof(uint32_t), sizeof(uint64_t),
+		PREFILTER_COUNTERS);
+
+	if (p->counters < 0)
+		goto fail;
+
+	if (rate > 0) {
+		p->clients = pf_map(BPF_MAP_TYPE_LRU_HASH, sizeof(uint64_t),
+			2 * sizeof(uint64_t), PREFILTER_CLIENTS);
+
+		if (p->clients < 0)
+			goto fail;
+	}
+
+	if (!pf_assemble(a, p, port, rate)) {
+		errno = E2BIG;
+		goto fail;
+	}
+
+	p->prog = pf_load(a);
+
+	if (p->prog < 0)
+		goto fail;
+
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.link_create.prog_fd = p->prog;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = generic ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE;
+
+	p->link = pf_bpf(BPF_LINK_CREATE, &attr);
+
+	if (p->link < 0)
+		goto fail;
+
+	free(a);
+
+	return p;
+
+fail:
+	{
+		int err = errno;
+
+		free(a);
+		prefilter_detach(p);
+		errno = err;
+	}
+
+	return NULL;
+}
+
+struct prefilter *prefilter_adopt(const int fds[4])
+{
+	struct prefilter *p = malloc(sizeof(struct prefilter));
+
+	if (p == NULL)
+		return NULL;
+
+	*p = (struct prefilter){ .prog = fds[0], .link = fds[1], .counters = fds[2], .clients = fds[3] };
+
+	return p;
+}
+
+void prefilter_detach(struct prefilter *p)
+{
+	/* Closing the last descriptor of the link detaches the program, a
+	 * process we handed off to keeps it
+	 */
+	if (p->link >= 0)
+		close(p->link);
+	if (p->prog >= 0)
+		close(p->prog);
+	if (p->clients >= 0)
+		close(p->clients);
+	if (p->counters >= 0)
+		close(p->counters);
+
+	free(p);
+}
+
+bool prefilter_read(struct prefilter *p, uint64_t counters[PREFILTER_COUNTERS])
+{
+	for (uint32_t i = 0; i < PREFILTER_COUNTERS; ++i)
+	{
+		union bpf_attr attr;
+
+		memset(&attr, 0, sizeof attr);
+		attr.map_fd = p->counters;
+		attr.key = (uintptr_t)&i;
+		attr.value = (uintptr_t)&counters[i];
+
+		if (pf_bpf(BPF_MAP_LOOKUP_ELEM, &attr) < 0)
+			return false;
+	}
+
+	return true;
+}
+
+#else
+
+struct prefilter *prefilter_attach(int ifindex, uint16_t port,
+	uint32_t rate, bool generic)
+{
+	(void)ifindex;
+	(void)port;
+	(void)rate;
+	(void)generic;
+
+	errno = ENOSYS;
+
+	return NULL;
+}
+
+struct prefilter *prefilter_adopt(const int fds[4])
+{
+	(void)fds;
+
+	errno = ENOSYS;
+
+	return NULL;
+}
+
+void prefilter_detach(struct prefilter *p)
+{
+	free(p);
+}
+
+bool prefilter_read(struct prefilter *p, uint64_t counters[PREFILTER_COUNTERS])
+{
+	(void)p;
+	(void)counters;
+
+	return false;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* XDP program in front of the server socket. Datagrams to the server port
+ * which can't be DHCP requests are dropped by the driver before the kernel
+ * allocates a socket buffer for them, let alone wakes the daemon:
+ *
+ *  - shorter than the BOOTP header and the magic cookie
+ *  - op other than BOOTREQUEST
+ *  - no magic cookie
+ *  - from a hardware address (chaddr) which sent more than the rate limit
+ *    within the last second
+ *
+ * The limit is kept per client in an LRU hash, so a flood of forged
+ * addresses only evicts clients which were quiet anyway. Everything else,
+ * including IPv4 with options and fragments, passes unchanged and is
+ * checked by the daemon as before.
+ *
+ * The program is assembled here and loaded with the bpf system call, so
+ * neither a BPF compiler nor libbpf is needed. It stays attached as long as
+ * the link is open, i.e. it goes away with the daemon.
+ */
+
+/* Clients the rate limit keeps track of */
+#ifndef PREFILTER_CLIENTS
+#define PREFILTER_CLIENTS 65536
+#endif
+
+enum prefilter_counter
+{
+	/* Let through to the socket */
+	PREFILTER_PASSED,
+	/* Dropped, see above */
+	PREFILTER_RUNT,
+	PREFILTER_OP,
+	PREFILTER_COOKIE,
+	PREFILTER_RATE,
+
+	PREFILTER_COUNTERS
+};
+
+struct prefilter
+{
+	int prog;
+	int link;
+
+	/* Array of PREFILTER_COUNTERS 64 bit counters */
+	int counters;
+	/* chaddr -> start of the window and requests in it */
+	int clients;
+};
+
+/**
+ * Load the program and attach it to an interface
+ *
+ * @param[in] ifindex Interface the server receives on
+ * @param[in] port UDP port of the server
+ * @param[in] rate Requests per second and hardware address, 0 for no limit
+ * @param[in] generic Attach in generic mode, which works with every driver
+ *                    but only saves the work above the driver
+ * @return The attached filter, or NULL with errno set. Needs CAP_BPF and
+ *         CAP_NET_ADMIN, but not afterwards.
+ */
+extern struct prefilter *prefilter_attach(int ifindex, uint16_t port,
+	uint32_t rate, bool generic);
+
+/**
+ * Take over a filter attached by another process, e.g. one handing off
+ * to us, whose descriptors it passed
+ *
+ * @param[in] fds Descriptors of the program, link, counters and clients
+ *                as in struct prefilter, owned by the filter afterwards
+ * @return The filter, or NULL with errno set
+ */
+extern struct prefilter *prefilter_adopt(const int fds[4]);
+
+extern void prefilter_detach(struct prefilter *p);
+
+/**
+ * Read the counters of the program
+ *
+ * @param[in] p Filter
+ * @param[out] counters Indexed by enum prefilter_counter
+ * @return Whether the counters could be read
+ */
+extern bool prefilter_read(struct prefilter *p,
+	uint64_t counters[PREFILTER_COUNTERS]);
@@ -0,0 +1,231 @@
+#include "probe.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+
+/* Echo request, the payload is unused */
+#define PROBE_LEN 16
+
+static uint16_t probe_checksum(const uint8_t *buf, size_t len)
+{
+	uint32_t sum = 0;
+
+	for (size_t i = 0; i + 1 < len; i += 2)
+		sum += (uint16_t)(buf[i] << 8 | buf[i + 1]);
+
+	if (len & 1)
+		sum += (uint16_t)(buf[len - 1] << 8);
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return htons(~sum & 0xffff);
+}
+
+/**
+ * Start the timer for the oldest outstanding probe, if any
+ */
+static void probe_arm(struct probe *p)
+{
+	while (p->head != p->tail && !p->slots[p->head & p->mask].active)
+		++p->head;
+
+	if (p->head == p->tail)
+		return;
+
+	ev_tstamp after = p->slots[p->head & p->mask].deadline - ev_now(p->loop);
+
+	/* A result callback may have started it already */
+	ev_timer_stop(p->loop, &p->timeout_watch);
+	ev_timer_set(&p->timeout_watch, after > 0 ? after : 0, 0);
+	ev_timer_start(p->loop, &p->timeout_watch);
+}
+
+static void probe_timeout_cb(EV_P_ ev_timer *w, int revents)
+{
+	(void)revents;
+
+	struct probe *p = w->data;
+	ev_tstamp now = ev_now(EV_A);
+
+	while (p->head != p->tail)
+	{
+		struct probe_slot *slot = &p->slots[p->head & p->mask];
+
+		if (slot->active && slot->deadline > now)
+			break;
+
+		++p->head;
+
+		/* Nobody answered, the address is free */
+		if (slot->active) {
+			slot->active = false;
+			p->done(p->ctx, slot->id, false);
+		}
+	}
+
+	probe_arm(p);
+}
+
+static void probe_read_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	struct probe *p = w->data;
+	uint8_t buf[512];
+	struct sockaddr_in src;
+	socklen_t srclen = sizeof src;
+	ssize_t len;
+
+	while ((len = recvfrom(p->sock, buf, sizeof buf, MSG_DONTWAIT,
+			(struct sockaddr *)&src, &srclen)) >= 0)
+	{
+		uint8_t *icmp = buf;
+
+		if (p->raw) {
+			size_t hlen = (buf[0] & 0x0f) * 4;
+
+			if ((size_t)len < hlen)
+				continue;
+
+			icmp += hlen;
+			len -= hlen;
+		}
+
+		if (len < 8 || icmp[0] != ICMP_ECHOREPLY)
+			continue;
+
+		uint16_t ident, seq;
+
+		memcpy(&ident, icmp + 4, 2);
+		memcpy(&seq, icmp + 6, 2);
+
+		/* A ping socket sets its own identifier and only gets its replies */
+		if (p->raw && ntohs(ident) != p->ident)
+			continue;
+
+		/* The sequence number is the ring position, truncated */
+		uint32_t pos = p->tail - (uint16_t)(p->tail - ntohs(seq));
+
+		if (pos - p->head >= p->tail - p->head)
+			continue;
+
+		struct probe_slot *slot = &p->slots[pos & p->mask];
+
+		if (!slot->active || slot->address.s_addr != src.sin_addr.s_addr)
+			continue;
+
+		slot->active = false;
+		p->done(p->ctx, slot->id, true);
+	}
+}
+
+struct probe *probe_create(struct ev_loop *loop, uint32_t max,
+	ev_tstamp timeout, void (*done)(void *ctx, uint32_t id, bool in_use),
+	void *ctx)
+{
+	uint32_t size = 1;
+
+	while (size < max && size < 1u << 15)
+		size <<= 1;
+
+	struct probe *p = calloc(1, sizeof(struct probe));
+
+	if (p == NULL)
+		return NULL;
+
+	p->slots = calloc(size, sizeof(struct probe_slot));
+
+	if (p->slots == NULL) {
+		free(p);
+		return NULL;
+	}
+
+	p->sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_ICMP);
+
+	if (p->sock < 0) {
+		p->sock = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK, IPPROTO_ICMP);
+		p->raw = true;
+	}
+
+	if (p->sock < 0) {
+		int err = errno;
+
+		free(p->slots);
+		free(p);
+		errno = err;
+
+		return NULL;
+	}
+
+	p->loop = loop;
+	p->ident = getpid() & 0xffff;
+	p->timeout = timeout;
+	p->mask = size - 1;
+	p->done = done;
+	p->ctx = ctx;
+
+	ev_io_init(&p->read_watch, probe_read_cb, p->sock, EV_READ);
+	p->read_watch.data = p;
+	ev_io_start(loop, &p->read_watch);
+
+	ev_init(&p->timeout_watch, probe_timeout_cb);
+	p->timeout_watch.data = p;
+
+	return p;
+}
+
+void probe_destroy(struct probe *p)
+{
+	ev_io_stop(p->loop, &p->read_watch);
+	ev_timer_stop(p->loop, &p->timeout_watch);
+
+	close(p->sock);
+	free(p->slots);
+	free(p);
+}
+
+bool probe_start(struct probe *p, struct in_addr address, uint32_t id)
+{
+	if (p->tail - p->head > p->mask)
+		return false;
+
+	uint8_t echo[PROBE_LEN] = { ICMP_ECHO, 0 };
+	uint16_t ident = htons(p->ident);
+	uint16_t seq = htons(p->tail & 0xffff);
+
+	memcpy(echo + 4, &ident, 2);
+	memcpy(echo + 6, &seq, 2);
+
+	uint16_t sum = probe_checksum(echo, sizeof echo);
+
+	memcpy(echo + 2, &sum, 2);
+
+	struct sockaddr_in dest = {
+		.sin_family = AF_INET,
+		.sin_addr = address
+	};
+
+	if (sendto(p->sock, echo, sizeof echo, MSG_DONTWAIT,
+			(const struct sockaddr *)&dest, sizeof dest) < 0)
+		return false;
+
+	p->slots[p->tail & p->mask] = (struct probe_slot){
+		.address = address,
+		.id = id,
+		.deadline = ev_now(p->loop) + p->timeout,
+		.active = true
+	};
+
+	if (p->head == p->tail++)
+		probe_arm(p);
+
+	return true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <netinet/in.h>
+
+#include <ev.h>
+
+/* Conflict detection before an address is offered, see RFC 2131 section
+ * 2.2: an ICMP echo request goes to the address, and an echo reply within
+ * the timeout means somebody uses it already.
+ *
+ * Probes run on the event loop without blocking it. At most a fixed number
+ * are outstanding, and since they all have the same timeout they expire in
+ * the order they were started, so they sit in a ring and one timer for the
+ * oldest covers all of them. The sequence number of a probe is its ring
+ * position, which finds the probe of a reply without a search.
+ */
+
+struct probe_slot
+{
+	struct in_addr address;
+	/* Passed back with the result */
+	uint32_t id;
+	ev_tstamp deadline;
+	/* Still waiting for a reply */
+	bool active;
+};
+
+struct probe
+{
+	struct ev_loop *loop;
+	int sock;
+	/* Whether the socket is raw, i.e. receives IP headers and all echo
+	 * replies of the host
+	 */
+	bool raw;
+	uint16_t ident;
+
+	ev_io read_watch;
+	ev_timer timeout_watch;
+	ev_tstamp timeout;
+
+	struct probe_slot *slots;
+	uint32_t mask;
+	/* Ring positions of the oldest and the next probe */
+	uint32_t head;
+	uint32_t tail;
+
+	/* Called once per probe: whether the address answered */
+	void (*done)(void *ctx, uint32_t id, bool in_use);
+	void *ctx;
+};
+
+/**
+ * Open the socket and start watching it
+ *
+ * @param[in] loop Event loop
+ * @param[in] max Probes outstanding at most, rounded up to a power of two
+ * @param[in] timeout Seconds to wait for a reply
+ * @param[in] done Result callback
+ * @param[in] ctx Passed to done
+ * @return The prober, or NULL with errno set. An unprivileged ping socket
+ *         is used if the system allows one, else a raw socket, which needs
+ *         CAP_NET_RAW.
+ */
+extern struct probe *probe_create(struct ev_loop *loop, uint32_t max,
+	ev_tstamp timeout, void (*done)(void *ctx, uint32_t id, bool in_use),
+	void *ctx);
+
+extern void probe_destroy(struct probe *p);
+
+/**
+ * Send an echo request to an address
+ *
+ * @param[in] p Prober
+ * @param[in] address Address to probe, network byte order
+ * @param[in] id Passed to the result callback, which is not called before
+ *               this returns
+ * @return Whether the probe was started, false if too many are outstanding
+ *         or the request could not be sent
+ */
+extern bool probe_start(struct probe *p, struct in_addr address, uint32_t id);
+
+/**
+ * Number of probes outstanding
+ */
+static inline uint32_t probe_pending(const struct probe *p)
+{
+	return p->tail - p->head;
+}
@@ -0,0 +1,805 @@
+#include "replica.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "error.h"
+
+static void replica_put32(uint8_t *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, sizeof v);
+}
+
+static uint32_t replica_get32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof v);
+
+	return ntohl(v);
+}
+
+static void replica_connect(struct replica *r);
+
+/**
+ * Close the connection to the standby and try again later, the next one
+ * starts with a snapshot
+ *
+ * @param[in] err Error which broke the connection, 0 if it was ours
+ */
+static void replica_disconnect(struct replica *r, int err)
+{
+	if (r->connected)
+		dhcpd_error(0, err, "Lost standby %s", inet_ntoa(r->peer.sin_addr));
+
+	ev_io_stop(r->loop, &r->out_watch);
+	close(r->out_sock);
+
+	r->out_sock = -1;
+	r->connected = false;
+	r->out_off = 0;
+	r->out_len = 0;
+	r->ack_len = 0;
+
+	memset(r->marked, 0, (r->server->leases->size / 64 + 1) * sizeof(uint64_t));
+	r->dirty_cnt = 0;
+
+	ev_timer_set(&r->retry_watch, REPLICA_RETRY, 0);
+	ev_timer_start(r->loop, &r->retry_watch);
+}
+
+/**
+ * Watch the connection to the standby for writability as well, or not
+ */
+static void replica_want_write(struct replica *r, bool write)
+{
+	int want = EV_READ | (write ? EV_WRITE : 0);
+
+	if ((r->out_watch.events & (EV_READ | EV_WRITE)) == want)
+		return;
+
+	ev_io_stop(r->loop, &r->out_watch);
+	ev_io_set(&r->out_watch, r->out_sock, want);
+	ev_io_start(r->loop, &r->out_watch);
+}
+
+/**
+ * Make room for more frames
+ *
+ * @return Where to put len bytes, NULL if the standby is too far behind
+ */
+static uint8_t *replica_reserve(struct replica *r, size_t len)
+{
+	if (r->out_len + len <= r->out_size)
+		return r->out + r->out_len;
+
+	if (r->out_off > 0) {
+		memmove(r->out, r->out + r->out_off, r->out_len - r->out_off);
+		r->out_len -= r->out_off;
+		r->out_off = 0;
+	}
+
+	size_t size = r->out_size;
+
+	while (size < r->out_len + len)
+		size *= 2;
+
+	if (size > REPLICA_BUFFER)
+		return NULL;
+
+	if (size != r->out_size) {
+		uint8_t *out = realloc(r->out, size);
+
+		if (out == NULL)
+			return NULL;
+
+		r->out = out;
+		r->out_size = size;
+	}
+
+	return r->out + r->out_len;
+}
+
+/**
+ * Append a frame without payload
+ */
+static bool replica_put_frame(struct replica *r, enum replica_frame type,
+	const uint32_t *args, size_t args_cnt)
+{
+	uint8_t *p = replica_reserve(r, 4 + 4 * args_cnt);
+
+	if (p == NULL)
+		return false;
+
+	p[0] = type;
+	p[1] = 0;
+	p[2] = 0;
+	p[3] = 0;
+
+	for (size_t i = 0; i < args_cnt; ++i)
+		replica_put32(p + 4 + 4 * i, args[i]);
+
+	r->out_len += 4 + 4 * args_cnt;
+
+	return true;
+}
+
+/**
+ * Append the record of an address
+ *
+ * @param[in] i Record number of the address
+ */
+static bool replica_put_record(struct replica *r, uint32_t i)
+{
+	struct server *s = r->server;
+	struct lease *l = &s->leases->a[i];
+	ev_tstamp left = l->expires - ev_now(r->loop);
+
+	uint8_t state = LEASE_FREE;
+	const uint8_t *client = NULL;
+	size_t client_len = 0;
+	const uint8_t *hostname = NULL;
+	size_t hostname_len = 0;
+
+	if ((l->state == LEASE_BOUND || l->state == LEASE_DECLINED) && left > 0)
+		state = l->state;
+
+	if (state == LEASE_BOUND) {
+		client = ckey_get(&l->key, s->clientids, &client_len);
+		hostname = intern_get(s->hostnames, l->hostname, &hostname_len);
+
+		/* A key whose bytes are unknown means nothing to another server */
+		if (client == NULL)
+			state = LEASE_FREE;
+	}
+
+	if (state != LEASE_BOUND) {
+		client_len = 0;
+		hostname_len = 0;
+	}
+
+	uint8_t *p = replica_reserve(r, 12 + client_len + hostname_len);
+
+	if (p == NULL)
+		return false;
+
+	/* Rounded up, so the standby never expires a lease first */
+	uint32_t secs = state != LEASE_FREE ? (uint32_t)left : 0;
+
+	if (state != LEASE_FREE && secs < left)
+		++secs;
+
+	p[0] = REPLICA_RECORD;
+	p[1] = state;
+	p[2] = client_len;
+	p[3] = hostname_len;
+	replica_put32(p + 4, s->leases->base + i);
+	replica_put32(p + 8, secs);
+
+	if (client_len > 0)
+		memcpy(p + 12, client, client_len);
+	if (hostname_len > 0)
+		memcpy(p + 12 + client_len, hostname, hostname_len);
+
+	r->out_len += 12 + client_len + hostname_len;
+	++r->stats.records;
+
+	return true;
+}
+
+/**
+ * Append the changed addresses, the next part of the snapshot and a commit
+ *
+ * @return Whether it fit
+ */
+static bool replica_fill(struct replica *r)
+{
+	struct lease_table *tab = r->server->leases;
+
+	for (uint32_t i = 0; i < r->dirty_cnt; ++i)
+	{
+		uint32_t rec = r->dirty[i];
+
+		r->marked[rec / 64] &= ~(1ULL << (rec % 64));
+
+		if (!replica_put_record(r, rec))
+			return false;
+	}
+
+	r->dirty_cnt = 0;
+
+	while (r->snapshot && r->out_len - r->out_off < REPLICA_CHUNK)
+	{
+		if (r->cursor == tab->size) {
+			if (!replica_put_frame(r, REPLICA_SYNCED, NULL, 0))
+				return false;
+
+			r->snapshot = false;
+			break;
+		}
+
+		uint8_t state = tab->a[r->cursor].state;
+
+		if ((state == LEASE_BOUND || state == LEASE_DECLINED) &&
+				!replica_put_record(r, r->cursor))
+			return false;
+
+		++r->cursor;
+	}
+
+	uint32_t seq = r->seq + 1;
+
+	if (!replica_put_frame(r, REPLICA_COMMIT, &seq, 1))
+		return false;
+
+	r->seq = seq;
+	r->commit = false;
+	++r->stats.commits;
+
+	return true;
+}
+
+/**
+ * Write to the standby until everything is written or its socket is full
+ */
+static void replica_write(struct replica *r)
+{
+	while (r->out_off < r->out_len)
+	{
+		ssize_t len = send(r->out_sock, r->out + r->out_off, r->out_len - r->out_off,
+			MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+
+			replica_disconnect(r, errno);
+			return;
+		}
+
+		r->out_off += len;
+	}
+
+	if (r->out_off == r->out_len) {
+		r->out_off = 0;
+		r->out_len = 0;
+	}
+
+	/* The snapshot goes on as soon as the socket has room */
+	replica_want_write(r, r->out_off < r->out_len || r->snapshot);
+}
+
+/**
+ * Start the stream on a new connection with a snapshot
+ */
+static void replica_connected(struct replica *r)
+{
+	struct lease_table *tab = r->server->leases;
+	uint32_t hello[] = { tab->base, tab->size };
+
+	r->connected = true;
+	r->cursor = 0;
+	r->snapshot = true;
+	r->commit = true;
+	++r->stats.snapshots;
+
+	dhcpd_error(0, 0, "Streaming leases to standby %s", inet_ntoa(r->peer.sin_addr));
+
+	if (!replica_put_frame(r, REPLICA_HELLO, hello, 2)) {
+		replica_disconnect(r, ENOMEM);
+		return;
+	}
+
+	replica_want_write(r, true);
+}
+
+/**
+ * Read the acknowledgements of the standby
+ */
+static void replica_read_acks(struct replica *r)
+{
+	uint8_t buf[256];
+	ssize_t len = recv(r->out_sock, buf, sizeof buf, MSG_DONTWAIT);
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (len <= 0) {
+		replica_disconnect(r, len < 0 ? errno : 0);
+		return;
+	}
+
+	for (ssize_t i = 0; i < len; ++i)
+	{
+		r->ack[r->ack_len++] = buf[i];
+
+		if (r->ack_len < sizeof r->ack)
+			continue;
+
+		if (r->ack[0] == REPLICA_COMMIT)
+			r->acked = replica_get32(r->ack + 4);
+
+		r->ack_len = 0;
+	}
+}
+
+static void replica_out_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)EV_A;
+
+	struct replica *r = w->data;
+
+	if (!r->connected) {
+		int err = 0;
+		socklen_t len = sizeof err;
+
+		if (getsockopt(r->out_sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			err = errno;
+
+		if (err != 0)
+			replica_disconnect(r, err);
+		else
+			replica_connected(r);
+
+		return;
+	}
+
+	if (revents & EV_READ) {
+		replica_read_acks(r);
+
+		if (!r->connected)
+			return;
+	}
+
+	if (revents & EV_WRITE)
+		replica_write(r);
+}
+
+/**
+ * Connect to the standby, the stream starts when the connection is up
+ */
+static void replica_connect(struct replica *r)
+{
+	r->out_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (r->out_sock < 0) {
+		ev_timer_set(&r->retry_watch, REPLICA_RETRY, 0);
+		ev_timer_start(r->loop, &r->retry_watch);
+		return;
+	}
+
+	/* Writes are batched already, a commit should not wait */
+	setsockopt(r->out_sock, IPPROTO_TCP, TCP_NODELAY, (int[]){1}, sizeof(int));
+
+	if (connect(r->out_sock, (const struct sockaddr *)&r->peer, sizeof r->peer) < 0 &&
+			errno != EINPROGRESS) {
+		replica_disconnect(r, errno);
+		return;
+	}
+
+	ev_io_set(&r->out_watch, r->out_sock, EV_WRITE);
+	ev_io_start(r->loop, &r->out_watch);
+}
+
+static void replica_retry_cb(EV_P_ ev_timer *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	replica_connect(w->data);
+}
+
+static void replica_heartbeat_cb(EV_P_ ev_timer *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	struct replica *r = w->data;
+
+	r->commit = r->connected;
+}
+
+/**
+ * Write what changed in this iteration of the event loop, before it blocks
+ */
+static void replica_flush_cb(EV_P_ ev_prepare *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	struct replica *r = w->data;
+
+	if (!r->connected || (r->dirty_cnt == 0 && !r->snapshot && !r->commit))
+		return;
+
+	/* Only while the socket has room, the write callback comes back */
+	if (r->snapshot && r->dirty_cnt == 0 && !r->commit &&
+			r->out_len - r->out_off >= REPLICA_CHUNK)
+		return;
+
+	if (!replica_fill(r)) {
+		dhcpd_error(0, 0, "Standby %s fell behind", inet_ntoa(r->peer.sin_addr));
+		replica_disconnect(r, 0);
+		return;
+	}
+
+	replica_write(r);
+}
+
+/**
+ * Close the connection of the primary
+ */
+static void replica_unfollow(struct replica *r)
+{
+	if (r->in_sock < 0)
+		return;
+
+	ev_io_stop(r->loop, &r->in_watch);
+	close(r->in_sock);
+
+	r->in_sock = -1;
+	r->in_len = 0;
+	r->syncing = false;
+}
+
+/**
+ * Apply a frame of the primary
+ *
+ * @return Whether it was valid
+ */
+static bool replica_apply(struct replica *r, const uint8_t *p)
+{
+	struct server *s = r->server;
+	struct lease_table *tab = s->leases;
+
+	switch (p[0])
+	{
+		case REPLICA_HELLO:
+			if (replica_get32(p + 4) != tab->base || replica_get32(p + 8) != tab->size) {
+				dhcpd_error(0, 0, "Primary serves another range");
+				return false;
+			}
+
+			memset(r->seen, 0, (tab->size / 64 + 1) * sizeof(uint64_t));
+			r->syncing = true;
+			return true;
+
+		case REPLICA_RECORD: {
+			if (p[1] != LEASE_FREE && p[1] != LEASE_BOUND && p[1] != LEASE_DECLINED)
+				return false;
+
+			struct server_record rec = {
+				.address = { htonl(replica_get32(p + 4)) },
+				.state = p[1],
+				.client = p[2] > 0 ? p + 12 : NULL,
+				.client_len = p[2],
+				.hostname = p[3] > 0 ? p + 12 + p[2] : NULL,
+				.hostname_len = p[3],
+				.expires = ev_now(r->loop) + replica_get32(p + 8)
+			};
+			uint32_t off = replica_get32(p + 4) - tab->base;
+
+			if (server_restore(s, &rec))
+				++r->stats.applied;
+
+			if (r->syncing && off < tab->size)
+				r->seen[off / 64] |= 1ULL << (off % 64);
+
+			return true;
+		}
+
+		case REPLICA_SYNCED: {
+			struct server_record rec = { .state = LEASE_FREE };
+			uint32_t kept = 0;
+
+			/* Leases which ended while we were not connected */
+			for (uint32_t i = 0; i < tab->size; ++i)
+			{
+				if (tab->a[i].state == LEASE_FREE)
+					continue;
+
+				if (r->seen[i / 64] & (1ULL << (i % 64))) {
+					++kept;
+					continue;
+				}
+
+				rec.address.s_addr = htonl(tab->base + i);
+				server_restore(s, &rec);
+			}
+
+			if (r->syncing)
+				dhcpd_error(0, 0, "In sync with primary, %u leases", kept);
+
+			r->syncing = false;
+			return true;
+		}
+
+		case REPLICA_COMMIT:
+			return true;
+	}
+
+	return false;
+}
+
+static void replica_in_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)revents;
+
+	struct replica *r = w->data;
+	ssize_t len = recv(r->in_sock, r->in_buf + r->in_len,
+		sizeof r->in_buf - r->in_len, MSG_DONTWAIT);
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	/* The primary may be back before the silence runs out */
+	if (len <= 0) {
+		dhcpd_error(0, len < 0 ? errno : 0, "Lost primary");
+		replica_unfollow(r);
+		return;
+	}
+
+	r->in_len += len;
+	ev_timer_again(EV_A_ &r->silence_watch);
+
+	size_t off = 0;
+	bool commit = false;
+	uint32_t seq = 0;
+
+	while (r->in_len - off >= 4)
+	{
+		const uint8_t *p = r->in_buf + off;
+		size_t need;
+
+		switch (p[0])
+		{
+			case REPLICA_HELLO:
+				need = 12;
+				break;
+
+			case REPLICA_RECORD:
+				need = 12 + p[2] + p[3];
+				break;
+
+			case REPLICA_COMMIT:
+				need = 8;
+				break;
+
+			case REPLICA_SYNCED:
+				need = 4;
+				break;
+
+			default:
+				need = 0;
+		}
+
+		if (need == 0) {
+			dhcpd_error(0, 0, "Invalid frame from primary");
+			replica_unfollow(r);
+			return;
+		}
+
+		if (r->in_len - off < need)
+			break;
+
+		if (!replica_apply(r, p)) {
+			replica_unfollow(r);
+			return;
+		}
+
+		if (p[0] == REPLICA_COMMIT) {
+			commit = true;
+			seq = replica_get32(p + 4);
+		}
+
+		off += need;
+	}
+
+	memmove(r->in_buf, r->in_buf + off, r->in_len - off);
+	r->in_len -= off;
+
+	/* A lost acknowledgement is made up for by the next one */
+	if (commit) {
+		uint8_t ack[8] = { REPLICA_COMMIT, 0, 0, 0 };
+
+		replica_put32(ack + 4, seq);
+		(void)send(r->in_sock, ack, sizeof ack, MSG_DONTWAIT | MSG_NOSIGNAL);
+	}
+}
+
+static void replica_accept_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)revents;
+
+	struct replica *r = w->data;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof addr;
+	int fd;
+
+	while ((fd = accept4(r->listen_sock, (struct sockaddr *)&addr, &addr_len,
+			SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		/* A primary which reconnects replaces its old connection */
+		replica_unfollow(r);
+
+		r->in_sock = fd;
+		r->followed = true;
+
+		ev_io_set(&r->in_watch, fd, EV_READ);
+		ev_io_start(EV_A_ &r->in_watch);
+		ev_timer_again(EV_A_ &r->silence_watch);
+
+		dhcpd_error(0, 0, "Following primary %s", inet_ntoa(addr.sin_addr));
+
+		addr_len = sizeof addr;
+	}
+}
+
+static void replica_silence_cb(EV_P_ ev_timer *w, int revents)
+{
+	(void)EV_A;
+	(void)revents;
+
+	struct replica *r = w->data;
+
+	dhcpd_error(0, 0, "No word from primary for %.0f seconds", REPLICA_TIMEOUT);
+
+	replica_takeover(r);
+}
+
+int replica_listen(const struct sockaddr_in *addr)
+{
+	int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (sock < 0)
+		return -1;
+
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (int[]){1}, sizeof(int)) < 0 ||
+			bind(sock, (const struct sockaddr *)addr, sizeof *addr) < 0 ||
+			listen(sock, 4) < 0) {
+		int err = errno;
+
+		close(sock);
+		errno = err;
+
+		return -1;
+	}
+
+	return sock;
+}
+
+struct replica *replica_create(struct ev_loop *loop, struct server *server,
+	int listen_sock, const struct sockaddr_in *peer,
+	void (*takeover)(void *ctx), void *ctx)
+{
+	struct replica *r = calloc(1, sizeof(struct replica));
+
+	if (r == NULL) {
+		if (listen_sock >= 0)
+			close(listen_sock);
+
+		return NULL;
+	}
+
+	uint32_t size = server->leases->size;
+
+	r->loop = loop;
+	r->server = server;
+	r->takeover = takeover;
+	r->ctx = ctx;
+	r->listen_sock = listen_sock;
+	r->standby = listen_sock >= 0;
+	r->in_sock = -1;
+	r->out_sock = -1;
+
+	r->out_size = REPLICA_RECV;
+	r->out = malloc(r->out_size);
+	r->dirty = calloc(size > 0 ? size : 1, sizeof(uint32_t));
+	r->marked = calloc(size / 64 + 1, sizeof(uint64_t));
+	r->seen = calloc(size / 64 + 1, sizeof(uint64_t));
+
+	if (r->out == NULL || r->dirty == NULL || r->marked == NULL || r->seen == NULL) {
+		replica_destroy(r);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (peer != NULL)
+		r->peer = *peer;
+
+	ev_io_init(&r->accept_watch, replica_accept_cb, r->listen_sock, EV_READ);
+	r->accept_watch.data = r;
+	ev_init(&r->in_watch, replica_in_cb);
+	r->in_watch.data = r;
+	ev_init(&r->silence_watch, replica_silence_cb);
+	r->silence_watch.repeat = REPLICA_TIMEOUT;
+	r->silence_watch.data = r;
+
+	ev_init(&r->out_watch, replica_out_cb);
+	r->out_watch.data = r;
+	ev_init(&r->retry_watch, replica_retry_cb);
+	r->retry_watch.data = r;
+	ev_timer_init(&r->heartbeat_watch, replica_heartbeat_cb, REPLICA_HEARTBEAT, REPLICA_HEARTBEAT);
+	r->heartbeat_watch.data = r;
+	ev_prepare_init(&r->flush_watch, replica_flush_cb);
+	r->flush_watch.data = r;
+
+	if (r->standby)
+		ev_io_start(loop, &r->accept_watch);
+	else if (peer != NULL)
+		replica_connect(r);
+
+	ev_timer_start(loop, &r->heartbeat_watch);
+	ev_prepare_start(loop, &r->flush_watch);
+
+	return r;
+}
+
+void replica_destroy(struct replica *r)
+{
+	if (r->loop != NULL) {
+		ev_io_stop(r->loop, &r->accept_watch);
+		ev_timer_stop(r->loop, &r->silence_watch);
+		ev_io_stop(r->loop, &r->out_watch);
+		ev_timer_stop(r->loop, &r->retry_watch);
+		ev_timer_stop(r->loop, &r->heartbeat_watch);
+		ev_prepare_stop(r->loop, &r->flush_watch);
+		replica_unfollow(r);
+	}
+
+	if (r->listen_sock >= 0)
+		close(r->listen_sock);
+	if (r->out_sock >= 0)
+		close(r->out_sock);
+
+	free(r->out);
+	free(r->dirty);
+	free(r->marked);
+	free(r->seen);
+	free(r);
+}
+
+void replica_note(struct replica *r, struct in_addr address)
+{
+	if (!r->connected)
+		return;
+
+	uint32_t rec = ntohl(address.s_addr) - r->server->leases->base;
+
+	if (rec >= r->server->leases->size || (r->marked[rec / 64] & (1ULL << (rec % 64))))
+		return;
+
+	r->marked[rec / 64] |= 1ULL << (rec % 64);
+	r->dirty[r->dirty_cnt++] = rec;
+}
+
+bool replica_takeover(struct replica *r)
+{
+	if (!r->standby)
+		return false;
+
+	r->standby = false;
+
+	ev_timer_stop(r->loop, &r->silence_watch);
+	ev_io_stop(r->loop, &r->accept_watch);
+	replica_unfollow(r);
+	close(r->listen_sock);
+	r->listen_sock = -1;
+
+	dhcpd_error(0, 0, "Taking over from primary");
+
+	if (r->peer.sin_port != 0)
+		replica_connect(r);
+
+	if (r->takeover != NULL)
+		r->takeover(r->ctx);
+
+	return true;
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+#include <ev.h>
+
+#include "server.h"
+
+/* Hot standby: a primary server streams its leases over TCP to a standby,
+ * which keeps them in its own lease table without answering clients, and
+ * takes over with that table when the primary falls silent.
+ *
+ * The primary marks the addresses the listener hears about and writes
+ * their state once per iteration of the event loop, so an address which
+ * changed several times in an iteration is sent once, and a storm goes out
+ * in large writes. Every write ends with a commit, which the standby
+ * acknowledges once it applied everything before it. The primary never
+ * waits for that, it only counts how far the standby is behind.
+ *
+ * A record carries the whole state of an address, so applying one twice
+ * does no harm. A standby which connects gets a snapshot of the table,
+ * written in chunks as the socket drains and interleaved with the changes
+ * since, and forgets the leases the snapshot did not mention once it is
+ * complete. A standby which cannot keep up is disconnected and catches up
+ * with a snapshot again.
+ *
+ * Only bound and declined leases are kept, a client with an offer starts
+ * over with the standby. Times are sent as seconds left, so the clocks of
+ * the servers need not agree.
+ *
+ * The stream is made of frames of a type byte and three more header bytes,
+ * followed by 32 bit numbers in network byte order:
+ *
+ *     HELLO  1, 0, 0, 0, first address, number of addresses
+ *     RECORD 2, state, client key length, host name length, address,
+ *            seconds left, followed by client key and host name
+ *     COMMIT 3, 0, 0, 0, sequence number
+ *     SYNCED 4, 0, 0, 0
+ *
+ * The standby answers with COMMIT frames of the last sequence number it
+ * applied. A commit is sent every REPLICA_HEARTBEAT even if nothing
+ * changed, and the standby takes over after hearing nothing for
+ * REPLICA_TIMEOUT, once it followed a primary.
+ */
+
+#ifndef REPLICA_HEARTBEAT
+#define REPLICA_HEARTBEAT 1.
+#endif
+
+#ifndef REPLICA_TIMEOUT
+#define REPLICA_TIMEOUT 3.
+#endif
+
+/* Seconds between attempts to connect to the standby */
+#ifndef REPLICA_RETRY
+#define REPLICA_RETRY 1.
+#endif
+
+/* Bytes waiting for a standby at most before it is disconnected */
+#define REPLICA_BUFFER (16 << 20)
+/* The snapshot is continued while less than this waits */
+#define REPLICA_CHUNK (256 << 10)
+/* Receive buffer of the standby, holds the longest frame */
+#define REPLICA_RECV 65536
+
+enum replica_frame
+{
+	REPLICA_HELLO = 1,
+	REPLICA_RECORD,
+	REPLICA_COMMIT,
+	REPLICA_SYNCED
+};
+
+struct replica_stats
+{
+	/* Records and commits sent */
+	uint64_t records;
+	uint64_t commits;
+	/* Snapshots started, i.e. connections of the standby */
+	uint64_t snapshots;
+
+	/* Records applied by the standby */
+	uint64_t applied;
+};
+
+struct replica
+{
+	struct ev_loop *loop;
+	struct server *server;
+
+	/* Whether we follow a primary and leave the clients to it */
+	bool standby;
+	/* Whether a primary connected since we started */
+	bool followed;
+
+	/* Called when the standby takes over */
+	void (*takeover)(void *ctx);
+	void *ctx;
+
+	/* Standby: socket the primary connects to, and its connection */
+	int listen_sock;
+	ev_io accept_watch;
+	int in_sock;
+	ev_io in_watch;
+	ev_timer silence_watch;
+	uint8_t in_buf[REPLICA_RECV];
+	size_t in_len;
+	/* Addresses heard of since the snapshot started, one bit each */
+	uint64_t *seen;
+	bool syncing;
+
+	/* Primary: the standby, port 0 for none, and the connection */
+	struct sockaddr_in peer;
+	int out_sock;
+	bool connected;
+	ev_io out_watch;
+	ev_timer retry_watch;
+	ev_timer heartbeat_watch;
+	ev_prepare flush_watch;
+
+	/* Frames not written yet */
+	uint8_t *out;
+	size_t out_off;
+	size_t out_len;
+	size_t out_size;
+
+	/* Changed addresses as record numbers, each marked once */
+	uint32_t *dirty;
+	uint32_t dirty_cnt;
+	uint64_t *marked;
+
+	/* Whether a snapshot is being sent, and its next record */
+	bool snapshot;
+	uint32_t cursor;
+	/* Last commit sent and acknowledged, and whether one is due */
+	uint32_t seq;
+	uint32_t acked;
+	bool commit;
+
+	/* Partial acknowledgement */
+	uint8_t ack[8];
+	size_t ack_len;
+
+	struct replica_stats stats;
+};
+
+/**
+ * Open the socket a standby accepts its primary on
+ *
+ * @return The listening socket, or -1 with errno set
+ */
+extern int replica_listen(const struct sockaddr_in *addr);
+
+/**
+ * Start streaming to a standby, following a primary, or both, in which
+ * case the stream starts when the standby takes over
+ *
+ * @param[in] loop Event loop
+ * @param[in] server Server whose leases are streamed or kept
+ * @param[in] listen_sock Socket of replica_listen the primary connects to,
+ *                        owned by the replica afterwards, -1 to be the
+ *                        primary
+ * @param[in] peer Address of the standby, NULL for none
+ * @param[in] takeover Called when the standby takes over
+ * @param[in] ctx Passed to takeover
+ * @return The replica, or NULL with errno set
+ */
+extern struct replica *replica_create(struct ev_loop *loop, struct server *server,
+	int listen_sock, const struct sockaddr_in *peer,
+	void (*takeover)(void *ctx), void *ctx);
+
+/**
+ * Close the connections, a standby does not take over
+ */
+extern void replica_destroy(struct replica *r);
+
+/**
+ * Mark an address whose lease changed, it is sent at the end of the
+ * iteration of the event loop
+ */
+extern void replica_note(struct replica *r, struct in_addr address);
+
+/**
+ * Stop following the primary and serve the clients, with the leases it
+ * sent so far
+ *
+ * @return Whether we were a standby
+ */
+extern bool replica_takeover(struct replica *r);
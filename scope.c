@@ -0,0 +1,60 @@
+#include "scope.h"
+
+#include <arpa/inet.h>
+
+static uint32_t netmask_from_prefixlen(uint8_t prefixlen)
+{
+	return htonl(0xFFFFFFFFU - (1 << (32 - prefixlen)) + 1);
+}
+
+void scope_init(struct scope *scope, struct config *cfg)
+{
+	scope->leasetime = cfg->leasetime;
+	scope->leasetime_min = cfg->leasetime_min > 0 && cfg->leasetime_min < cfg->leasetime ?
+		cfg->leasetime_min : cfg->leasetime;
+	scope->jitter = cfg->lease_jitter;
+	scope->rapid_commit = cfg->rapid_commit;
+
+	memset(&scope->opts, 0, sizeof scope->opts);
+
+	if (cfg->prefixlen > 0)
+		dhcp_optab_add(&scope->opts, DHCP_OPT_NETMASK,
+			(uint32_t[]){netmask_from_prefixlen(cfg->prefixlen)}, 4);
+
+	if (cfg->routers_cnt > 0)
+		dhcp_optab_add(&scope->opts, DHCP_OPT_ROUTER,
+			cfg->routers, cfg->routers_cnt * sizeof(struct in_addr));
+
+	if (cfg->nameservers_cnt > 0)
+		dhcp_optab_add(&scope->opts, DHCP_OPT_DNS,
+			cfg->nameservers, cfg->nameservers_cnt * sizeof(struct in_addr));
+}
+
+void scope_lease_times(const struct scope *scope, uint32_t hash,
+	uint32_t free, uint32_t size, struct dhcp_lease *lease)
+{
+	double used = size > 0 ? 1. - (double)free / size : 1.;
+	double time = scope->leasetime;
+
+	if (used >= SCOPE_USED_TIGHT)
+		time = scope->leasetime_min;
+	else if (used > SCOPE_USED_SPARSE)
+		time -= (time - scope->leasetime_min) *
+			(used - SCOPE_USED_SPARSE) / (SCOPE_USED_TIGHT - SCOPE_USED_SPARSE);
+
+	lease->leasetime = (uint32_t)time;
+
+	if (scope->jitter == 0)
+		return;
+
+	/* T1 at 50% and T2 at 87.5% of the lease (RFC 2131 section 4.4.5), moved
+	 * by up to jitter and half of it, in both directions. Both are derived
+	 * from the hash, so a client keeps its place across renewals.
+	 */
+	uint32_t h = hash * 0x9E3779B1;
+	double j1 = ((h >> 16) / 32767.5 - 1) * scope->jitter / 100;
+	double j2 = ((h & 0xFFFF) / 32767.5 - 1) * scope->jitter / 200;
+
+	lease->renewal = (uint32_t)(lease->leasetime * (0.5 + j1));
+	lease->rebinding = (uint32_t)(lease->leasetime * (0.875 + j2));
+}
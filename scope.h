@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <netinet/in.h>
+
+#include "dhcp.h"
+#include "config.h"
+
+/* A scope holds everything a reply needs which does not depend on the
+ * client. The static options (netmask, routers, nameservers) are encoded
+ * once at startup into a table indexed by option code, so building a reply
+ * is a few copies out of this table.
+ *
+ * The lease time policy depends on the client only through its key hash:
+ * leases get shorter as the pool fills up, so addresses of clients which
+ * left come back sooner when they are needed, and T1 and T2 are spread per
+ * client, so clients which joined at once don't renew at once forever.
+ */
+
+/* Pool usage up to which leases get the full lease time, and from which
+ * they get the shortest one, linear in between
+ */
+#ifndef SCOPE_USED_SPARSE
+#define SCOPE_USED_SPARSE 0.5
+#endif
+#ifndef SCOPE_USED_TIGHT
+#define SCOPE_USED_TIGHT 0.9
+#endif
+struct scope
+{
+	/* Lease time while the pool is sparse */
+	uint32_t leasetime;
+	/* Lease time once the pool is tight */
+	uint32_t leasetime_min;
+	/* How far T1 and T2 are moved per client, in percent of the lease */
+	uint8_t jitter;
+
+	/* Answer a DHCPDISCOVER with Rapid Commit (80) by a DHCPACK */
+	bool rapid_commit;
+
+	struct dhcp_optab opts;
+};
+
+#define SCOPE_EMPTY {\
+		.leasetime = 0,\
+		.leasetime_min = 0,\
+		.jitter = 0,\
+		.rapid_commit = false,\
+		.opts = { .len = 0 }\
+	}
+
+/**
+ * Precompute the option table of a scope from the configuration
+ *
+ * @param[out] scope Scope to initialize
+ * @param[in] cfg Configuration to read the options from
+ */
+extern void scope_init(struct scope *scope, struct config *cfg);
+
+/**
+ * Set lease, renewal and rebinding time of a lease
+ *
+ * @param[in] scope Scope of the lease
+ * @param[in] hash Hash of the client key, which places T1 and T2
+ * @param[in] free Free addresses of the pool
+ * @param[in] size Size of the pool
+ * @param[out] lease Lease whose times are set
+ */
+extern void scope_lease_times(const struct scope *scope, uint32_t hash,
+	uint32_t free, uint32_t size, struct dhcp_lease *lease);
@@ -0,0 +1,856 @@
+#include "server.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+
+#include "iplist.h"
+#include "error.h"
+
+static const char BROKEN_SOFTWARE_NOTIFICATION[] =
+"#################################### ALERT ####################################\n"
+"  BROKEN SOFTWARE NOTIFICATION - SOMETHING SENDS INVALID DHCP MESSAGES IN YOUR\n"
+"                                    NETWORK\n";
+
+bool server_init(struct server *s, struct config *cfg)
+{
+	s->cfg = cfg;
+
+	scope_init(&s->scope, cfg);
+
+	s->sink.broadcast.sin_addr = cfg->reply;
+	s->sink.broadcast.sin_port = htons(cfg->reply_port);
+	s->sink.relay_port = cfg->port;
+	s->sink.unicast = cfg->unicast;
+
+	s->balance = cfg->balance;
+	s->buckets = cfg->buckets;
+
+	s->leases = lease_table_create(cfg->iprange[0], cfg->iprange[1]);
+	s->relays = intern_create(INTERN_MAX);
+	s->clientids = intern_create(INTERN_MAX);
+	s->hostnames = intern_create(INTERN_MAX);
+
+	/* Prepare dummy IP Pool */
+	s->pool = pool_create(cfg->iprange[0], cfg->iprange[1]);
+
+	if (cfg->dedup > 0)
+		s->dedup = dedup_create(cfg->dedup);
+
+	if (cfg->probe > 0)
+		s->pending = pending_create(cfg->probe);
+
+	if (s->leases == NULL || s->relays == NULL || s->clientids == NULL ||
+			s->hostnames == NULL || s->pool == NULL ||
+			(cfg->dedup > 0 && s->dedup == NULL) ||
+			(cfg->probe > 0 && s->pending == NULL)) {
+		server_free(s);
+		return false;
+	}
+
+	s->leases->clientids = s->clientids;
+	s->leases->relays = s->relays;
+	s->leases->hostnames = s->hostnames;
+
+	uint32_t ip;
+
+	IPRANGE_FOREACH(cfg->iprange[0], cfg->iprange[1], ip)
+		pool_add(s->pool, (struct in_addr){htonl(ip)});
+
+	return true;
+}
+
+void server_free(struct server *s)
+{
+	if (s->leases != NULL)
+		lease_table_destroy(s->leases);
+	if (s->relays != NULL)
+		intern_destroy(s->relays);
+	if (s->clientids != NULL)
+		intern_destroy(s->clientids);
+	if (s->hostnames != NULL)
+		intern_destroy(s->hostnames);
+	if (s->pool != NULL)
+		pool_destroy(s->pool);
+	if (s->dedup != NULL)
+		dedup_destroy(s->dedup);
+
+	if (s->pending != NULL)
+		pending_destroy(s->pending);
+
+	s->leases = NULL;
+	s->relays = NULL;
+	s->clientids = NULL;
+	s->hostnames = NULL;
+	s->pool = NULL;
+	s->dedup = NULL;
+	s->pending = NULL;
+}
+
+/**
+ * Return the address of a freed lease to the pool, unless it is pinned to a
+ * relay agent circuit
+ */
+static void lease_free_cb(struct lease_table *tab, struct lease *lease, void *ctx)
+{
+	struct server *s = (struct server *)ctx;
+
+	if (lease_is_pinned(tab, lease))
+		return;
+
+	lease_set_relay(tab, lease, 0);
+
+	pool_add(s->pool, lease_address(tab, lease));
+}
+
+/**
+ * Tell the listener about a change of a bound lease
+ */
+static void server_emit(struct server *s, enum server_event_type type, struct lease *l)
+{
+	if (s->listener.event == NULL)
+		return;
+
+	struct server_event e = {
+		.type = type,
+		.address = lease_address(s->leases, l),
+		.key = &l->key,
+		.client = NULL,
+		.client_len = 0,
+		.hostname = NULL,
+		.hostname_len = 0,
+		.expires = l->expires
+	};
+
+	e.client = ckey_get(&l->key, s->clientids, &e.client_len);
+	e.hostname = intern_get(s->hostnames, l->hostname, &e.hostname_len);
+
+	s->listener.event(s->listener.ctx, &e);
+}
+
+/**
+ * Free an expired lease, see lease_free_cb
+ */
+static void lease_expire_cb(struct lease_table *tab, struct lease *lease, void *ctx)
+{
+	struct server *s = (struct server *)ctx;
+
+	if (lease->state == LEASE_BOUND)
+		server_emit(s, SERVER_EVENT_EXPIRED, lease);
+
+	lease_free_cb(tab, lease, ctx);
+}
+
+/**
+ * Intern the host name of a message as a DNS label: the first label of the
+ * name, in lower case
+ *
+ * @return Id of the name, 0 if the message has none, it is no valid label
+ *         or nobody listens
+ */
+static uint16_t server_hostname(struct server *s, struct dhcp_msg *msg)
+{
+	if (s->listener.event == NULL || msg->hostname == NULL)
+		return 0;
+
+	const uint8_t *name = msg->hostname;
+	size_t len = msg->hostname_len;
+
+	if (msg->hostname_wire) {
+		if (len == 0 || name[0] >= len)
+			return 0;
+
+		len = name[0];
+		++name;
+	} else {
+		const uint8_t *dot = memchr(name, '.', len);
+
+		if (dot != NULL)
+			len = dot - name;
+	}
+
+	/* Clients put trailing zeros into option 12 */
+	while (len > 0 && name[len - 1] == 0)
+		--len;
+
+	if (len == 0 || len > 63 || name[0] == '-')
+		return 0;
+
+	uint8_t label[63];
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		uint8_t c = name[i];
+
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		else if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-'))
+			return 0;
+
+		label[i] = c;
+	}
+
+	return intern_put(s->hostnames, label, len);
+}
+
+/**
+ * Bind a lease for a lease time and tell the listener. A renewing client
+ * which sends no name keeps the one it had.
+ */
+static void server_commit(struct server *s, struct dhcp_msg *msg, struct lease *l,
+	uint32_t leasetime)
+{
+	bool renewed = l->state == LEASE_BOUND;
+	uint16_t hostname = server_hostname(s, msg);
+
+	if (renewed && hostname == 0)
+		hostname = l->hostname;
+
+	if (renewed && hostname != l->hostname) {
+		server_emit(s, SERVER_EVENT_RELEASED, l);
+		renewed = false;
+	}
+
+	l->state = LEASE_BOUND;
+	l->expires = s->now + leasetime;
+	lease_set_hostname(s->leases, l, hostname);
+
+	server_emit(s, renewed ? SERVER_EVENT_RENEWED : SERVER_EVENT_BOUND, l);
+}
+
+/**
+ * Intern the key of a client which gets a lease, see ckey_intern
+ *
+ * @return Whether the key can be assigned, false if the table is full
+ */
+static bool server_key(struct server *s, struct dhcp_msg *msg)
+{
+	return ckey_intern(&msg->key, s->clientids, msg->clientid, msg->clientid_len,
+		*DHCP_MSG_F_HTYPE(msg->data), *DHCP_MSG_F_HLEN(msg->data),
+		(uint8_t *)DHCP_MSG_F_CHADDR(msg->data));
+}
+
+/**
+ * Pin the address of a lease offered or bound to the relay agent circuit
+ * of the client. Only then the relay agent information is interned, so
+ * values which never get an address do not take up the table.
+ */
+static void server_pin(struct server *s, struct dhcp_msg *msg, struct lease *l)
+{
+	if (!s->cfg->pin_relay)
+		return;
+
+	uint16_t relay = 0;
+
+	if (msg->relay != NULL)
+		relay = intern_put(s->relays, msg->relay, msg->relay_len);
+
+	lease_set_relay(s->leases, l, relay);
+	lease_pin(s->leases, l);
+}
+
+static void server_probe_resume(void *ctx, struct pending_entry *e,
+	bool timeout, uint32_t in_use);
+
+/**
+ * Park a DHCPDISCOVER until the address for it is probed, see server_probed
+ *
+ * @return Whether it was parked, otherwise the address is offered right away
+ */
+static bool server_park(struct server *s, struct dhcp_msg *msg, struct lease *l)
+{
+	if (s->prober.start == NULL || s->pending == NULL || s->now < s->probe_resume ||
+			msg->length > DHCP_MSG_MAXLEN)
+		return false;
+
+	ev_tstamp deadline = s->now + s->cfg->probe_timeout / 1000. + SERVER_PROBE_GRACE;
+	struct pending_entry *e = pending_add(s->pending, msg, deadline, server_probe_resume, s);
+
+	if (e == NULL) {
+		s->probe_resume = s->now + SERVER_PROBE_BACKOFF;
+		return false;
+	}
+
+	e->address = lease_address(s->leases, l);
+
+	if (!s->prober.start(s->prober.ctx, e->address, e->handle)) {
+		pending_remove(s->pending, e);
+		return false;
+	}
+
+	l->state = LEASE_PROBING;
+	l->expires = s->now + LEASE_OFFER_TIMEOUT;
+
+	return true;
+}
+
+/**
+ * Handle DHCPDISCOVER request and reply to that
+ */
+static void server_discover(struct server *s, struct dhcp_msg *msg)
+{
+	/* XXX: Take address from pool
+	 * 			If it is empty, ask for new address
+	 *			If not, send offer
+	 *				and rebalance pool if below threshhold?
+	 */
+
+	struct dhcp_lease lease = DHCP_LEASE_EMPTY;
+
+	struct lease *l;
+
+	/* A client which already has a lease gets its address again, a client
+	 * behind a relay agent circuit gets the address pinned to it.
+	 */
+	l = lease_find(s->leases, &msg->key);
+
+	/* A retransmission while the address is probed, the offer follows the
+	 * probe
+	 */
+	if (l != NULL && l->state == LEASE_PROBING && !msg->probed)
+		return;
+
+	bool fresh = false;
+
+	if (l == NULL && s->cfg->pin_relay) {
+		l = lease_pinned(s->leases, msg->relay_id);
+
+		/* A declined or probed address stays out of use, and one bound to
+		 * another client is not taken from it
+		 */
+		if (l != NULL && l->state != LEASE_FREE && l->state != LEASE_OFFERED &&
+				!(l->state == LEASE_BOUND && ckey_eq(&l->key, &msg->key)))
+			l = NULL;
+	}
+
+	if (l == NULL) {
+		struct in_addr address;
+		bool found;
+
+		/* In hash mode the address is derived from the client, so it gets the
+		 * same address after a restart of ours, and other servers with the
+		 * same range tend to pick the same one.
+		 */
+		if (s->cfg->hash_alloc)
+			found = pool_get_hash(s->pool, msg->key.hash, &address);
+		else
+			found = pool_get(s->pool, &address);
+
+		/* If our pool is empty we'll ask the network to offer an address to us.
+		 * In the meantime, we won't respond to the client.
+		 */
+		if (!found) {
+			// XXX: Ask for address
+			return;
+		}
+
+		l = lease_at(s->leases, address);
+		fresh = true;
+	}
+
+	if (!server_key(s, msg)) {
+		if (fresh)
+			pool_add(s->pool, lease_address(s->leases, l));
+		return;
+	}
+
+	lease_assign(s->leases, l, &msg->key);
+
+	/* Addresses the client had before are known to be its own */
+	if (fresh && server_park(s, msg, l))
+		return;
+
+	/* With Rapid Commit the lease is bound right away and the client gets a
+	 * DHCPACK instead of an offer, see RFC 4039 section 3.
+	 */
+	bool commit = msg->rapid_commit && s->scope.rapid_commit;
+
+	scope_lease_times(&s->scope, msg->key.hash, s->pool->free, s->pool->size, &lease);
+
+	if (commit) {
+		server_commit(s, msg, l, lease.leasetime);
+	} else if (l->state != LEASE_BOUND) {
+		l->state = LEASE_OFFERED;
+		l->expires = s->now + LEASE_OFFER_TIMEOUT;
+	}
+
+	server_pin(s, msg, l);
+
+	lease.address = lease_address(s->leases, l);
+
+	if (commit)
+		send_ack(&s->sink, msg, &s->scope, &lease);
+	else
+		send_offer(&s->sink, msg, &s->scope, &lease);
+
+	// XXX: Send (lease.address, msg->key, lease.leasetime) to DHT
+}
+
+/**
+ * Bind a lease and acknowledge it
+ */
+static void server_bind(struct server *s, struct dhcp_msg *msg, struct lease *l)
+{
+	struct dhcp_lease lease = DHCP_LEASE_EMPTY;
+
+	scope_lease_times(&s->scope, msg->key.hash, s->pool->free, s->pool->size, &lease);
+
+	server_commit(s, msg, l, lease.leasetime);
+	server_pin(s, msg, l);
+
+	lease.address = lease_address(s->leases, l);
+
+	// ACK
+	send_ack(&s->sink, msg, &s->scope, &lease);
+}
+
+/**
+ * Handle a DHCPREQUEST of a RENEWING or REBINDING client, which has ciaddr
+ * set and neither a server identifier nor a requested address. Renewals
+ * are most of the steady-state traffic, so the common case is a single
+ * record found by its address.
+ */
+static void server_renew(struct server *s, struct dhcp_msg *msg)
+{
+	struct in_addr ciaddr = { *DHCP_MSG_F_CIADDR(msg->data) };
+	struct lease *l = lease_at(s->leases, ciaddr);
+
+	if (l != NULL && l->state == LEASE_BOUND && ckey_eq(&l->key, &msg->key)) {
+		server_bind(s, msg, l);
+		return;
+	}
+
+	struct lease *own = lease_find(s->leases, &msg->key);
+
+	/* A lease we lost, e.g. by a restart, is taken over in hash mode if the
+	 * address is still free, like in the INIT-REBOOT state.
+	 */
+	if (l != NULL && own == NULL &&
+			s->cfg->hash_alloc && pool_take(s->pool, ciaddr)) {
+		if (!server_key(s, msg)) {
+			pool_add(s->pool, ciaddr);
+			return;
+		}
+
+		lease_assign(s->leases, l, &msg->key);
+		server_bind(s, msg, l);
+		return;
+	}
+
+	/* A client we have no record of may renew a lease of another server,
+	 * e.g. a partner with -balance or a primary we follow, so only a
+	 * record which contradicts it gets it a DHCPNAK: the client has a lease
+	 * with us at another address, or the address is another client's.
+	 */
+	if (own == NULL && (l == NULL ||
+			(l->state != LEASE_BOUND && l->state != LEASE_OFFERED)))
+		return;
+
+	send_nak(&s->sink, msg);
+}
+
+/**
+ * Handle to DHCPREQUEST request and reply to that, and allocate lease if
+ * enabled
+ *
+ * The state of the client tells how to read it, see RFC 2131 section
+ * 4.3.2: SELECTING clients name the server they chose, RENEWING and
+ * REBINDING ones have ciaddr set, INIT-REBOOT ones only request an address.
+ */
+static void server_request(struct server *s, struct dhcp_msg *msg)
+{
+	/* XXX: Requests are answered from our own leases only. Fetching an
+	 * unknown lease from the other servers, with the request suspended
+	 * meanwhile as a probed DHCPDISCOVER is in s->pending, is missing.
+	 */
+
+	if (msg->server_id.s_addr == INADDR_ANY && msg->reqaddr.s_addr == INADDR_ANY &&
+			*DHCP_MSG_F_CIADDR(msg->data) != 0) {
+		server_renew(s, msg);
+		return;
+	}
+
+	struct lease *l;
+
+	l = lease_find(s->leases, &msg->key);
+
+	/* The client chose another server, our offer goes back to the pool */
+	if (msg->server_id.s_addr != INADDR_ANY &&
+			msg->server_id.s_addr != msg->sid->sin_addr.s_addr) {
+		if (l != NULL && l->state == LEASE_OFFERED) {
+			lease_unassign(s->leases, l);
+			lease_free_cb(s->leases, l, s);
+		}
+		return;
+	}
+
+	/* In hash mode a client whose lease we lost, e.g. by a restart, asks
+	 * for the address we would offer it anyway, so it gets it if it is free.
+	 */
+	if (l == NULL && s->cfg->hash_alloc && msg->reqaddr.s_addr != INADDR_ANY &&
+			pool_take(s->pool, msg->reqaddr)) {
+		if (!server_key(s, msg)) {
+			pool_add(s->pool, msg->reqaddr);
+			return;
+		}
+
+		l = lease_at(s->leases, msg->reqaddr);
+		lease_assign(s->leases, l, &msg->key);
+	}
+
+	/* An INIT-REBOOT client we have no record of may hold a lease of
+	 * another server, e.g. a partner with -balance or the primary of a
+	 * standby, so we leave it to that one, see RFC 2131 section 4.3.2.
+	 * Only a client named us or whose lease we know is told it is wrong.
+	 */
+	if (l == NULL && msg->server_id.s_addr == INADDR_ANY)
+		return;
+
+	if (l == NULL || msg->reqaddr.s_addr == INADDR_ANY ||
+			lease_address(s->leases, l).s_addr != msg->reqaddr.s_addr) {
+		// NACK
+		send_nak(&s->sink, msg);
+		return;
+	}
+
+	server_bind(s, msg, l);
+}
+
+/**
+ * Handle DHCPRELEASE request and release the lease if it was allocated
+ */
+static void server_release(struct server *s, struct dhcp_msg *msg)
+{
+	struct lease *l;
+
+	l = lease_find(s->leases, &msg->key);
+
+	if (l == NULL || ntohl(lease_address(s->leases, l).s_addr) != msg->ciaddr.s_addr)
+		return;
+
+	if (l->state == LEASE_BOUND)
+		server_emit(s, SERVER_EVENT_RELEASED, l);
+
+	lease_unassign(s->leases, l);
+	lease_free_cb(s->leases, l, s);
+}
+
+/**
+ * Handle DHCPDECLINE request and keep the declined address out of the pool
+ * for a lease time
+ */
+static void server_decline(struct server *s, struct dhcp_msg *msg)
+{
+	struct lease *l;
+
+	l = lease_find(s->leases, &msg->key);
+
+	if (l == NULL || msg->reqaddr.s_addr == INADDR_ANY ||
+			lease_address(s->leases, l).s_addr != msg->reqaddr.s_addr)
+		return;
+
+	if (l->state == LEASE_BOUND)
+		server_emit(s, SERVER_EVENT_RELEASED, l);
+
+	/* Somebody else uses the address, the expiry returns it to the pool */
+	lease_unassign(s->leases, l);
+	l->state = LEASE_DECLINED;
+	l->expires = s->now + s->scope.leasetime;
+	server_emit(s, SERVER_EVENT_DECLINED, l);
+}
+
+/**
+ * Handle DHCPINFORM request and reply with the configuration of the scope,
+ * see http://tools.ietf.org/html/draft-ietf-dhc-dhcpinform-clarify-04
+ *
+ * The client already has an address, so neither the pool nor any lease is
+ * involved and the reply is built from the precomputed options only.
+ */
+static void server_inform(struct server *s, struct dhcp_msg *msg)
+{
+	send_inform(&s->sink, msg, &s->scope);
+}
+
+/**
+ * Handle a message, see server_handle
+ *
+ * @param[in] probed Whether the message was parked and its address probed
+ */
+static enum dhcp_msg_type server_dispatch(struct server *s, uint8_t *buf,
+	size_t len, struct sockaddr_in *source, ev_tstamp now, bool probed)
+{
+	/* Detect too small messages */
+	if (len < DHCP_MSG_HDRLEN)
+		return 0;
+	/* Check magic value */
+	uint8_t *magic = DHCP_MSG_F_MAGIC(buf);
+	if (!DHCP_MSG_MAGIC_CHECK(magic))
+		return 0;
+
+	/* Extract message type from options */
+	uint8_t *options = DHCP_MSG_F_OPTIONS(buf);
+	struct dhcp_opt current_option;
+
+	enum dhcp_msg_type msg_type = 0;
+	uint8_t *prl = NULL;
+	size_t prl_len = 0;
+	uint16_t maxsize = 0;
+	uint8_t *relay = NULL;
+	size_t relay_len = 0;
+	uint8_t *clientid = NULL;
+	size_t clientid_len = 0;
+	bool rapid_commit = false;
+	uint8_t *hostname = NULL;
+	size_t hostname_len = 0;
+	bool hostname_wire = false;
+	bool fqdn = false;
+	struct in_addr reqaddr = {INADDR_ANY};
+	struct in_addr server_id = {INADDR_ANY};
+
+	while (dhcp_opt_next(&options, &current_option, buf + len))
+		switch (current_option.code)
+		{
+			case DHCP_OPT_MSGTYPE:
+				if (current_option.len == 1)
+					msg_type = (enum dhcp_msg_type)current_option.data[0];
+				break;
+
+			case DHCP_OPT_PARAMLIST:
+				prl = (uint8_t *)current_option.data;
+				prl_len = current_option.len;
+				break;
+
+			case DHCP_OPT_MAXMSGSIZE:
+				if (current_option.len == 2)
+					maxsize = ntohs(*(uint16_t *)current_option.data);
+				break;
+
+			case DHCP_OPT_CLIENTID:
+				clientid = (uint8_t *)current_option.data;
+				clientid_len = current_option.len;
+				break;
+
+			case DHCP_OPT_RELAYINFO:
+				relay = (uint8_t *)current_option.data;
+				relay_len = current_option.len;
+				break;
+
+			case DHCP_OPT_RAPIDCOMMIT:
+				rapid_commit = current_option.len == 0;
+				break;
+
+			case DHCP_OPT_REQIPADDR:
+				if (current_option.len == 4)
+					memcpy(&reqaddr, current_option.data, 4);
+				break;
+
+			case DHCP_OPT_SERVERID:
+				if (current_option.len == 4)
+					memcpy(&server_id, current_option.data, 4);
+				break;
+
+			case DHCP_OPT_HOSTNAME:
+				if (!fqdn) {
+					hostname = (uint8_t *)current_option.data;
+					hostname_len = current_option.len;
+				}
+				break;
+
+			/* Flags, two obsolete RCODEs and the name */
+			case DHCP_OPT_CLIENTFQDN:
+				if (current_option.len > 3) {
+					hostname = (uint8_t *)current_option.data + 3;
+					hostname_len = current_option.len - 3;
+					hostname_wire = current_option.data[0] & 0x04;
+					fqdn = true;
+				}
+				break;
+		}
+
+	struct dhcp_msg msg = {
+		.data = buf,
+		.end = buf + len,
+		.length = len,
+		.type = msg_type,
+		.ciaddr.s_addr = ntohl(*DHCP_MSG_F_CIADDR(buf)),
+		.yiaddr.s_addr = ntohl(*DHCP_MSG_F_YIADDR(buf)),
+		.siaddr.s_addr = ntohl(*DHCP_MSG_F_SIADDR(buf)),
+		.giaddr.s_addr = ntohl(*DHCP_MSG_F_GIADDR(buf)),
+		.prl = prl,
+		.prl_len = prl_len,
+		.maxsize = maxsize,
+		.rapid_commit = rapid_commit,
+		.probed = probed,
+		.hostname = hostname,
+		.hostname_len = hostname_len,
+		.hostname_wire = hostname_wire,
+		.reqaddr = reqaddr,
+		.server_id = server_id,
+		.relay = relay,
+		.relay_len = relay_len,
+		.relay_id = relay != NULL ? intern_find(s->relays, relay, relay_len) : 0,
+		.clientid = clientid,
+		.clientid_len = clientid_len,
+		.source = (struct sockaddr *)source,
+		.sid = &s->id
+	};
+
+	s->now = now;
+
+	ckey_make(&msg.key, s->clientids, clientid, clientid_len,
+		*DHCP_MSG_F_HTYPE(buf), *DHCP_MSG_F_HLEN(buf),
+		(uint8_t *)DHCP_MSG_F_CHADDR(buf));
+
+	/* A retransmission gets the bytes of the first reply again. The other
+	 * types get no reply and are harmless to repeat.
+	 */
+	if (s->dedup != NULL && (msg_type == DHCPDISCOVER ||
+			msg_type == DHCPREQUEST || msg_type == DHCPINFORM)) {
+		uint32_t xid = *DHCP_MSG_F_XID(buf);
+		uint16_t flags = *DHCP_MSG_F_FLAGS(buf);
+		const struct dedup_reply *r = dedup_find(s->dedup, &msg.key, xid, msg_type, flags, now);
+
+		if (r != NULL) {
+			if (!s->sink.send(s->sink.ctx, r->data, r->len, &r->dest))
+				dhcpd_error(0, errno, "Could not resend reply");
+
+			return msg_type;
+		}
+
+		dedup_begin(s->dedup, &msg.key, xid, msg_type, flags, now);
+		s->sink.capture = s->dedup;
+	}
+
+	switch (msg_type)
+	{
+		case DHCPDISCOVER:
+			server_discover(s, &msg);
+			break;
+
+		case DHCPREQUEST:
+			server_request(s, &msg);
+			break;
+
+		case DHCPRELEASE:
+			server_release(s, &msg);
+			break;
+
+		case DHCPDECLINE:
+			server_decline(s, &msg);
+			break;
+
+		case DHCPINFORM:
+			server_inform(s, &msg);
+			break;
+
+		default:
+			fprintf(stderr, BROKEN_SOFTWARE_NOTIFICATION);
+			return 0;
+	}
+
+	s->sink.capture = NULL;
+
+	return msg_type;
+}
+
+enum dhcp_msg_type server_handle(struct server *s, uint8_t *buf,
+	size_t len, struct sockaddr_in *source, ev_tstamp now)
+{
+	return server_dispatch(s, buf, len, source, now, false);
+}
+
+/**
+ * Continue a DHCPDISCOVER parked by server_park, a probe whose result got
+ * lost counts as unanswered
+ */
+static void server_probe_resume(void *ctx, struct pending_entry *e,
+	bool timeout, uint32_t in_use)
+{
+	struct server *s = (struct server *)ctx;
+	struct lease *l = lease_at(s->leases, e->address);
+
+	/* Expired meanwhile, a retransmission starts over */
+	if (l == NULL || l->state != LEASE_PROBING || !ckey_eq(&l->key, &e->key))
+		return;
+
+	if (in_use && !timeout) {
+		lease_unassign(s->leases, l);
+		l->state = LEASE_DECLINED;
+		l->expires = s->now + s->scope.leasetime;
+		server_emit(s, SERVER_EVENT_DECLINED, l);
+	}
+
+	server_dispatch(s, e->data, e->len, &e->source, s->now, timeout || !in_use);
+}
+
+void server_probed(struct server *s, uint32_t id, bool in_use, ev_tstamp now)
+{
+	s->now = now;
+
+	pending_resume(s->pending, id, in_use);
+}
+
+void server_timeout(struct server *s, ev_tstamp now)
+{
+	s->now = now;
+
+	if (s->pending != NULL)
+		pending_expire(s->pending, now);
+}
+
+void server_expire(struct server *s, ev_tstamp now)
+{
+	s->now = now;
+
+	lease_expire(s->leases, now, lease_expire_cb, s);
+}
+
+bool server_restore(struct server *s, const struct server_record *r)
+{
+	struct lease *l = lease_at(s->leases, r->address);
+
+	if (l == NULL)
+		return false;
+
+	if (r->state == LEASE_FREE) {
+		if (l->state != LEASE_FREE) {
+			lease_unassign(s->leases, l);
+			lease_free_cb(s->leases, l, s);
+		}
+
+		return true;
+	}
+
+	if (r->state == LEASE_DECLINED) {
+		lease_unassign(s->leases, l);
+	} else {
+		struct ckey key;
+
+		if (r->client == NULL || !ckey_put(&key, s->clientids, r->client, r->client_len))
+			return false;
+
+		/* The client moved from another address */
+		struct lease *old = lease_find(s->leases, &key);
+
+		if (old != NULL && old != l) {
+			lease_unassign(s->leases, old);
+			lease_free_cb(s->leases, old, s);
+		}
+
+		lease_assign(s->leases, l, &key);
+	}
+
+	/* A free address is in the pool, unless it is pinned */
+	pool_take(s->pool, r->address);
+
+	l->state = r->state;
+	l->expires = r->expires;
+
+	lease_set_hostname(s->leases, l, r->hostname != NULL && s->listener.event != NULL ?
+		intern_put(s->hostnames, r->hostname, r->hostname_len) : 0);
+
+	return true;
+}
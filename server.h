@@ -0,0 +1,255 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+#include <ev.h>
+
+#include "dhcp.h"
+#include "config.h"
+#include "packet.h"
+#include "pool.h"
+#include "scope.h"
+#include "lease.h"
+#include "intern.h"
+#include "dedup.h"
+#include "pending.h"
+#include "balance.h"
+
+/* Checks whether an address is in use before it is offered, the daemon
+ * probes it on the network
+ */
+struct server_prober
+{
+	/* Start a check whose result is passed to server_probed with id, never
+	 * before this returns. Returns false if the check can't be started.
+	 */
+	bool (*start)(void *ctx, struct in_addr address, uint32_t id);
+	void *ctx;
+};
+
+enum server_event_type
+{
+	/* A client got a lease, or its lease under another host name */
+	SERVER_EVENT_BOUND,
+	SERVER_EVENT_RENEWED,
+	/* Released or declined by the client, or bound under another name */
+	SERVER_EVENT_RELEASED,
+	SERVER_EVENT_EXPIRED,
+	/* The address was declined or answered a probe, no client holds it */
+	SERVER_EVENT_DECLINED
+};
+
+/* A change of a bound lease, or of an address taken out of use */
+struct server_event
+{
+	enum server_event_type type;
+	struct in_addr address;
+	const struct ckey *key;
+	/* Bytes of the key, see ckey.h, NULL if they are unknown */
+	const uint8_t *client;
+	size_t client_len;
+	/* Host name of the client, a single sanitized label, not terminated,
+	 * NULL if it sent none
+	 */
+	const uint8_t *hostname;
+	size_t hostname_len;
+	/* Until when the lease is bound, in server time */
+	ev_tstamp expires;
+};
+
+/* The state of an address as a standby keeps it, see replica.h */
+struct server_record
+{
+	struct in_addr address;
+	/* LEASE_FREE, LEASE_BOUND or LEASE_DECLINED */
+	enum lease_state state;
+	/* Key of the client of a bound lease, see ckey.h */
+	const uint8_t *client;
+	size_t client_len;
+	/* Host name, NULL for none */
+	const uint8_t *hostname;
+	size_t hostname_len;
+	ev_tstamp expires;
+};
+
+/* Told about leases as they change, e.g. to update DNS. Called while a
+ * message is handled, so it has to return quickly.
+ */
+struct server_listener
+{
+	void (*event)(void *ctx, const struct server_event *e);
+	void *ctx;
+};
+
+/* Probing is skipped for this long after a DHCPDISCOVER found the pending
+ * table full, a storm gets blind offers rather than a queue
+ */
+#ifndef SERVER_PROBE_BACKOFF
+#define SERVER_PROBE_BACKOFF 1.
+#endif
+
+/* A DHCPDISCOVER waits this much longer than the probe, in case the result
+ * never comes
+ */
+#ifndef SERVER_PROBE_GRACE
+#define SERVER_PROBE_GRACE 1.
+#endif
+
+/* Everything the message handlers work on. The handlers neither touch a
+ * socket nor the event loop: messages come in through server_handle, with
+ * the time they arrived, and replies go out through the sink. The daemon
+ * feeds it from its socket and libev, the benchmark from memory with a
+ * virtual clock.
+ */
+struct server
+{
+	struct config *cfg;
+
+	struct scope scope;
+
+	struct pool *pool;
+
+	struct lease_table *leases;
+
+	/* Relay agent information seen so far */
+	struct intern *relays;
+
+	/* Client keys too long to be stored inline */
+	struct intern *clientids;
+
+	/* Host names of bound leases, only kept if there is a listener. Names
+	 * which come after it filled up are not passed on.
+	 */
+	struct intern *hostnames;
+
+	/* Replies to recent requests, NULL if retransmissions are handled
+	 * like new requests
+	 */
+	struct dedup *dedup;
+
+	/* Address we identify with (54) */
+	struct sockaddr_in id;
+
+	/* Whether requests of clients outside our buckets are dropped, the
+	 * daemon checks before it hands them to us
+	 */
+	bool balance;
+	struct balance buckets;
+
+	struct packet_sink sink;
+
+	/* Told about bound leases if event is set */
+	struct server_listener listener;
+
+	/* Offers wait for probes if start is set and cfg->probe > 0 */
+	struct server_prober prober;
+	/* No probing before, see SERVER_PROBE_BACKOFF */
+	ev_tstamp probe_resume;
+
+	/* Requests waiting for a result, NULL if nothing is asynchronous */
+	struct pending *pending;
+
+	/* Time of the message being handled */
+	ev_tstamp now;
+};
+
+#define SERVER_EMPTY {\
+		.cfg = NULL,\
+		.scope = SCOPE_EMPTY,\
+		.pool = NULL,\
+		.leases = NULL,\
+		.relays = NULL,\
+		.clientids = NULL,\
+		.hostnames = NULL,\
+		.dedup = NULL,\
+		.id = { .sin_family = AF_INET, .sin_addr = {INADDR_ANY} },\
+		.balance = false,\
+		.buckets = {{0}},\
+		.sink = PACKET_SINK_EMPTY,\
+		.listener = { .event = NULL, .ctx = NULL },\
+		.prober = { .start = NULL, .ctx = NULL },\
+		.probe_resume = 0,\
+		.pending = NULL,\
+		.now = 0\
+	}
+
+/**
+ * Set up scope, address pool and lease table from the configuration
+ *
+ * @param[out] s Server to initialize, the id, the send callback of the
+ *                sink, the listener and the prober are left to the caller
+ * @param[in] cfg Configuration, which has to outlive the server
+ * @return Whether all tables could be allocated
+ */
+extern bool server_init(struct server *s, struct config *cfg);
+
+/**
+ * Free all tables of a server
+ */
+extern void server_free(struct server *s);
+
+/**
+ * Handle a message from a client or relay agent and send the replies to the
+ * sink of the server. A retransmitted request is answered with the reply
+ * sent the first time.
+ *
+ * @param[in] s Server
+ * @param[in] buf Message, not modified but referenced while handling it
+ * @param[in] len Length of the message
+ * @param[in] source Address the message came from
+ * @param[in] now Time the message arrived
+ * @return Type of the handled message, 0 if it was dropped as invalid
+ */
+extern enum dhcp_msg_type server_handle(struct server *s, uint8_t *buf,
+	size_t len, struct sockaddr_in *source, ev_tstamp now);
+
+/**
+ * Continue with a DHCPDISCOVER whose address was probed: offer the address
+ * if nobody answered, otherwise keep it out of the pool for a lease time
+ * like a declined one and handle the DHCPDISCOVER again.
+ *
+ * @param[in] s Server
+ * @param[in] id Id the probe was started with
+ * @param[in] in_use Whether the address answered
+ * @param[in] now Time of the result
+ */
+extern void server_probed(struct server *s, uint32_t id, bool in_use,
+	ev_tstamp now);
+
+/**
+ * Time out requests which waited too long for a result, e.g. the
+ * DHCPDISCOVER of a probe that got lost
+ */
+extern void server_timeout(struct server *s, ev_tstamp now);
+
+/**
+ * When server_timeout has to be called next
+ *
+ * @return Whether any request is waiting
+ */
+static inline bool server_next_timeout(const struct server *s, ev_tstamp *at)
+{
+	return s->pending != NULL && pending_next(s->pending, at);
+}
+
+/**
+ * Put an address into a state received from another server, taking it
+ * from the pool or returning it. A client bound elsewhere loses its old
+ * lease, and the listener is not told.
+ *
+ * @param[in] s Server
+ * @param[in] r State of the address
+ * @return Whether it was applied, false if the address is out of range or
+ *         the client key could not be kept
+ */
+extern bool server_restore(struct server *s, const struct server_record *r);
+
+/**
+ * Free leases which expired before now and return their addresses to the
+ * pool
+ */
+extern void server_expire(struct server *s, ev_tstamp now);
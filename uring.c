@@ -0,0 +1,400 @@
+#include "uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __linux__
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <linux/io_uring.h>
+
+#include "error.h"
+
+/* user_data of the receive, sends carry their slot + 1 */
+#define URING_RECV 0
+
+#define URING_BGID 0
+
+static int uring_enter(struct uring *u, unsigned submit)
+{
+	return syscall(__NR_io_uring_enter, u->fd, submit, 0, 0, NULL, 0);
+}
+
+/**
+ * Pass the queued submissions to the kernel
+ */
+static void uring_submit(struct uring *u)
+{
+	while (u->sq_queued > 0) {
+		int ret = uring_enter(u, u->sq_queued);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		u->sq_queued -= ret;
+	}
+}
+
+/**
+ * Next free submission, the queue is submitted first if it is full
+ */
+static struct io_uring_sqe *uring_sqe(struct uring *u)
+{
+	unsigned tail = *u->sq_tail;
+
+	if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) > u->sq_mask) {
+		uring_submit(u);
+
+		if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) > u->sq_mask)
+			return NULL;
+	}
+
+	struct io_uring_sqe *sqe = &u->sqes[tail & u->sq_mask];
+
+	memset(sqe, 0, sizeof *sqe);
+	u->sq_array[tail & u->sq_mask] = tail & u->sq_mask;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++u->sq_queued;
+
+	return sqe;
+}
+
+/**
+ * Hand a receive buffer back to the kernel, it sees it once the tail is
+ * published by uring_poll
+ */
+static void uring_recycle(struct uring *u, uint16_t bid)
+{
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (URING_BUFS - 1)];
+
+	b->addr = (uintptr_t)(u->bufs + (size_t)bid * URING_BUF_LEN);
+	b->len = URING_BUF_LEN;
+	b->bid = bid;
+
+	++u->br_tail;
+}
+
+static bool uring_arm(struct uring *u)
+{
+	struct io_uring_sqe *sqe = uring_sqe(u);
+
+	if (sqe == NULL)
+		return false;
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = u->sock;
+	sqe->addr = (uintptr_t)&u->recv_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = URING_RECV;
+
+	u->recv_armed = true;
+
+	return true;
+}
+
+struct uring *uring_create(int sock)
+{
+	struct uring *u = calloc(1, sizeof(struct uring));
+
+	if (u == NULL)
+		return NULL;
+
+	u->fd = -1;
+	u->sock = sock;
+
+	/* Every send and many receives complete per submission */
+	struct io_uring_params p = {
+		.flags = IORING_SETUP_CQSIZE,
+		.cq_entries = URING_DEPTH * 8
+	};
+
+	u->fd = syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+
+	if (u->fd < 0)
+		goto fail;
+
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		errno = ENOSYS;
+		goto fail;
+	}
+
+	size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	u->ring_len = sq_len > cq_len ? sq_len : cq_len;
+	u->ring = mmap(NULL, u->ring_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+
+	if (u->ring == MAP_FAILED) {
+		u->ring = NULL;
+		goto fail;
+	}
+
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		goto fail;
+	}
+
+	uint8_t *ring = u->ring;
+
+	u->sq_head = (unsigned *)(ring + p.sq_off.head);
+	u->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+	u->sq_array = (unsigned *)(ring + p.sq_off.array);
+	u->sq_mask = *(unsigned *)(ring + p.sq_off.ring_mask);
+	u->cq_head = (unsigned *)(ring + p.cq_off.head);
+	u->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+	u->cq_mask = *(unsigned *)(ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+	/* The buffer ring has to be page aligned */
+	u->br_len = URING_BUFS * sizeof(struct io_uring_buf);
+	u->br = mmap(NULL, u->br_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (u->br == MAP_FAILED) {
+		u->br = NULL;
+		goto fail;
+	}
+
+	struct io_uring_buf_reg reg = {
+		.ring_addr = (uintptr_t)u->br,
+		.ring_entries = URING_BUFS,
+		.bgid = URING_BGID
+	};
+
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		goto fail;
+
+	u->bufs = malloc((size_t)URING_BUFS * URING_BUF_LEN);
+	u->slots = malloc(URING_DEPTH * sizeof(struct uring_slot));
+	u->free = malloc(URING_DEPTH * sizeof(uint32_t));
+
+	if (u->bufs == NULL || u->slots == NULL || u->free == NULL)
+		goto fail;
+
+	for (uint16_t bid = 0; bid < URING_BUFS; ++bid)
+		uring_recycle(u, bid);
+
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+
+	for (uint32_t i = 0; i < URING_DEPTH; ++i)
+		u->free[u->free_cnt++] = URING_DEPTH - 1 - i;
+
+	/* Only the source address is of interest, no control messages */
+	u->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+
+	if (!uring_arm(u))
+		goto fail;
+
+	uring_submit(u);
+
+	return u;
+
+fail:
+	{
+		int err = errno;
+
+		uring_destroy(u);
+		errno = err;
+	}
+
+	return NULL;
+}
+
+void uring_destroy(struct uring *u)
+{
+	if (u->sqes != NULL)
+		munmap(u->sqes, u->sqes_len);
+	if (u->ring != NULL)
+		munmap(u->ring, u->ring_len);
+	if (u->fd >= 0)
+		close(u->fd);
+	if (u->br != NULL)
+		munmap(u->br, u->br_len);
+
+	free(u->bufs);
+	free(u->slots);
+	free(u->free);
+	free(u);
+}
+
+bool uring_poll(struct uring *u,
+	void (*cb)(void *ctx, uint8_t *buf, size_t len, struct sockaddr_in *src),
+	void *ctx)
+{
+	unsigned head = *u->cq_head;
+	unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	/* Leave the loop to the other watchers after a full ring */
+	unsigned budget = u->cq_mask + 1;
+	int err = 0;
+
+	while (head != tail && budget-- > 0)
+	{
+		struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+
+		if (cqe->user_data != URING_RECV) {
+			uint32_t i = cqe->user_data - 1;
+
+			/* Like a failed sendto of the ev engine, see reply_send */
+			if (cqe->res < 0)
+				dhcpd_error(0, -cqe->res, "Could not send reply to %s",
+					inet_ntoa(u->slots[i].dest.sin_addr));
+
+			u->free[u->free_cnt++] = i;
+		} else {
+			if (!(cqe->flags & IORING_CQE_F_MORE))
+				u->recv_armed = false;
+
+			/* Running out of buffers only stops the receive, anything else
+			 * means the kernel can't do it
+			 */
+			if (cqe->res < 0 && cqe->res != -ENOBUFS)
+				err = -cqe->res;
+
+			if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+				uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+				uint8_t *buf = u->bufs + (size_t)bid * URING_BUF_LEN;
+				struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+				uint8_t *name = buf + sizeof *out;
+				uint8_t *payload = name + u->recv_msg.msg_namelen;
+
+				if (out->namelen >= sizeof(struct sockaddr_in) && !(out->flags & MSG_TRUNC)) {
+					struct sockaddr_in src;
+
+					memcpy(&src, name, sizeof src);
+					cb(ctx, payload, out->payloadlen, &src);
+				}
+
+				uring_recycle(u, bid);
+			}
+		}
+
+		__atomic_store_n(u->cq_head, ++head, __ATOMIC_RELEASE);
+
+		if (head == tail)
+			tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+
+	if (err != 0 && !u->recv_armed) {
+		uring_submit(u);
+		errno = err;
+		return false;
+	}
+
+	if (!u->recv_armed)
+		uring_arm(u);
+
+	uring_submit(u);
+
+	return true;
+}
+
+void uring_flush(struct uring *u)
+{
+	uring_submit(u);
+}
+
+bool uring_send(void *ctx, const uint8_t *buf, size_t len,
+	const struct sockaddr_in *dest)
+{
+	struct uring *u = (struct uring *)ctx;
+	struct io_uring_sqe *sqe = NULL;
+
+	if (u->free_cnt > 0 && len <= DHCP_MSG_MAXLEN)
+		sqe = uring_sqe(u);
+
+	/* All slots are in flight, better late than dropped */
+	if (sqe == NULL) {
+		++u->fallbacks;
+
+		return sendto(u->sock, buf, len, MSG_DONTWAIT,
+			(const struct sockaddr *)dest, sizeof *dest) >= 0;
+	}
+
+	uint32_t i = u->free[--u->free_cnt];
+	struct uring_slot *slot = &u->slots[i];
+
+	memcpy(slot->data, buf, len);
+	slot->dest = *dest;
+	slot->iov = (struct iovec){ .iov_base = slot->data, .iov_len = len };
+	slot->msg = (struct msghdr){
+		.msg_name = &slot->dest,
+		.msg_namelen = sizeof slot->dest,
+		.msg_iov = &slot->iov,
+		.msg_iovlen = 1
+	};
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = u->sock;
+	sqe->addr = (uintptr_t)&slot->msg;
+	sqe->len = 1;
+	sqe->user_data = i + 1;
+
+	return true;
+}
+
+#else
+
+void uring_flush(struct uring *u)
+{
+	(void)u;
+}
+
+struct uring *uring_create(int sock)
+{
+	(void)sock;
+
+	errno = ENOSYS;
+
+	return NULL;
+}
+
+void uring_destroy(struct uring *u)
+{
+	free(u);
+}
+
+bool uring_poll(struct uring *u,
+	void (*cb)(void *ctx, uint8_t *buf, size_t len, struct sockaddr_in *src),
+	void *ctx)
+{
+	(void)u;
+	(void)cb;
+	(void)ctx;
+
+	errno = ENOSYS;
+
+	return false;
+}
+
+bool uring_send(void *ctx, const uint8_t *buf, size_t len,
+	const struct sockaddr_in *dest)
+{
+	(void)ctx;
+	(void)buf;
+	(void)len;
+	(void)dest;
+
+	errno = ENOSYS;
+
+	return false;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "dhcp.h"
+
+/* io_uring engine for the socket of the server, an alternative to reading
+ * it on every wakeup of an ev_io watcher with recvfrom and answering with
+ * one sendto per reply.
+ *
+ * A single multishot recvmsg keeps receiving into a ring of provided
+ * buffers without being submitted again, and replies are queued as sendmsg
+ * submissions which go to the kernel in one io_uring_enter per batch. The
+ * ring descriptor becomes readable when completions are waiting, so it is
+ * watched by the event loop like the socket was, and timers and other
+ * watchers keep working.
+ */
+
+#ifndef URING_DEPTH
+#define URING_DEPTH 256
+#endif
+
+/* Provided receive buffers, a power of two */
+#ifndef URING_BUFS
+#define URING_BUFS 512
+#endif
+
+/* Size of a receive buffer, including the recvmsg header and the source
+ * address. Longer datagrams are dropped.
+ */
+#ifndef URING_BUF_LEN
+#define URING_BUF_LEN 2048
+#endif
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/* A reply between being queued and being sent */
+struct uring_slot
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct sockaddr_in dest;
+	uint8_t data[DHCP_MSG_MAXLEN];
+};
+
+struct uring
+{
+	int fd;
+	int sock;
+
+	/* Rings shared with the kernel */
+	void *ring;
+	size_t ring_len;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	/* Submissions written but not yet passed to the kernel */
+	unsigned sq_queued;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Provided buffers of the multishot receive */
+	struct io_uring_buf_ring *br;
+	size_t br_len;
+	uint16_t br_tail;
+	uint8_t *bufs;
+	struct msghdr recv_msg;
+	bool recv_armed;
+
+	/* Replies in flight and a stack of the free ones */
+	struct uring_slot *slots;
+	uint32_t *free;
+	uint32_t free_cnt;
+
+	/* Replies sent with sendto since all slots were in use */
+	uint64_t fallbacks;
+};
+
+/**
+ * Set up a ring for a bound UDP socket and start receiving
+ *
+ * @param[in] sock Socket, which has to outlive the ring
+ * @return The ring, or NULL with errno set if the kernel lacks io_uring or
+ *         one of the features used
+ */
+extern struct uring *uring_create(int sock);
+
+extern void uring_destroy(struct uring *u);
+
+/**
+ * Descriptor to wait on for completions
+ */
+static inline int uring_fd(const struct uring *u)
+{
+	return u->fd;
+}
+
+/**
+ * Handle the waiting completions: pass received datagrams to cb, recycle
+ * their buffers and free the slots of sent replies. Replies queued meanwhile
+ * are submitted at the end, all at once.
+ *
+ * @param[in] u Ring
+ * @param[in] cb Called for every received datagram, buf is only valid
+ *               during the call
+ * @param[in] ctx Passed to cb
+ * @return Whether the ring still receives, otherwise errno is set
+ */
+extern bool uring_poll(struct uring *u,
+	void (*cb)(void *ctx, uint8_t *buf, size_t len, struct sockaddr_in *src),
+	void *ctx);
+
+/**
+ * Submit the replies queued outside of uring_poll, e.g. from a timer
+ */
+extern void uring_flush(struct uring *u);
+
+/**
+ * Queue a reply, as send callback of a packet sink with the ring as ctx.
+ * The reply is copied, so buf may be reused right away.
+ */
+extern bool uring_send(void *ctx, const uint8_t *buf, size_t len,
+	const struct sockaddr_in *dest);